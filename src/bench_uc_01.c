@@ -0,0 +1,1090 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* dprintf() with --std=c11 */
+#endif
+
+/* Microbenchmarks for the hot paths in probe_uc_01, and the analysis pipeline end to end
+ * over a synthetic transport stream (ts_gen.c).
+ * Exits non-zero if any implementation disagrees with the reference, the pipeline disagrees
+ * with what was generated, the HEVC headers parse to anything but what was written, the steady
+ * state nal enumeration touches the heap, or records don't survive a segment store and the
+ * reader unchanged.
+ * With -j every result is also written to stdout as one json object per line,
+ *   {"bench":"startcode","impl":"avx2","metric":"GB/s","value":15.011}
+ * and the human readable report moves to stderr.
+ * Usage: bench_uc_01 [-n iterations] [-l buffer length bytes] [-H slice headers] [-j]
+ *                    [-g out.ts] [-b bitrate] [-G gop] [-B bframes] [-s slices] [-z zero percent] [-t seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+/* Count every heap allocation the nal code makes, so we can prove the hot path doesn't. */
+static uint64_t gAllocations = 0;
+static void *bench_malloc(size_t size) { gAllocations++; return malloc(size); }
+static void *bench_calloc(size_t n, size_t size) { gAllocations++; return calloc(n, size); }
+static void *bench_realloc(void *ptr, size_t size) { gAllocations++; return realloc(ptr, size); }
+#define malloc(size) bench_malloc(size)
+#define calloc(n, size) bench_calloc(n, size)
+#define realloc(ptr, size) bench_realloc(ptr, size)
+
+#include "nal_h264.c"
+
+#undef malloc
+#undef calloc
+#undef realloc
+
+#include "misc.c"
+#include "bitreader.c"
+#include "h264_params.c"
+#include "hevc_params.c"
+#include "ts_gen.c"
+#include "memmem.h"
+#include "record.c"
+#include "record_reader.c"
+#include "segment_store.c"
+#include "pes_arena.c"
+#include "pes_asm.c"
+
+static int gJson = 0;
+
+/* Human readable results, out of the way of the json when -j */
+#define bench_log(...) fprintf(gJson ? stderr : stdout, __VA_ARGS__)
+
+static void bench_report(const char *bench, const char *impl, const char *metric, double value)
+{
+    if (gJson) {
+        printf("{\"bench\":\"%s\",\"impl\":\"%s\",\"metric\":\"%s\",\"value\":%.6g}\n", bench, impl, metric, value);
+    }
+}
+
+static uint64_t gSeed = 0x9e3779b97f4a7c15ULL;
+static uint32_t bench_rand()
+{
+    gSeed ^= gSeed << 13;
+    gSeed ^= gSeed >> 7;
+    gSeed ^= gSeed << 17;
+    return (uint32_t)gSeed;
+}
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* Build something that looks like a PES payload of H.264: an AUD, then slices of
+ * CABAC-ish random payload. Emulation prevention is applied so the only 00 00 01
+ * sequences in the buffer are real start codes, same as a compliant encoder.
+ */
+static int bench_build_es(uint8_t *buf, int lengthBytes, int nalSizeBytes)
+{
+    int idx = 0;
+    int nals = 0;
+    int zeros = 0;
+
+    while (idx < lengthBytes - 8) {
+        buf[idx++] = 0;
+        buf[idx++] = 0;
+        buf[idx++] = 1;
+        if (nals == 0) {
+            buf[idx++] = 0x09;
+        } else
+        if (nals % 50 == 49) {
+            /* A stray PES start code, the forbidden zero bit is set so it must be ignored */
+            buf[idx++] = 0xe0;
+        } else {
+            buf[idx++] = nals % 30 == 1 ? 0x65 : 0x41;
+        }
+        nals++;
+        zeros = 0;
+
+        int len = nalSizeBytes / 2 + (bench_rand() % nalSizeBytes);
+        for (int i = 0; i < len && idx < lengthBytes - 8; i++) {
+            /* Skewed towards zero so the scanners see plenty of false candidates */
+            uint8_t b = (bench_rand() % 8) == 0 ? 0 : (uint8_t)bench_rand();
+            if (zeros >= 2 && b <= 3) {
+                buf[idx++] = 3;
+                zeros = 0;
+            }
+            buf[idx++] = b;
+            zeros = b == 0 ? zeros + 1 : 0;
+        }
+        /* rbsp_trailing_bits, no nal ends in a zero byte */
+        buf[idx++] = 0x80;
+    }
+    while (idx < lengthBytes) {
+        buf[idx++] = 0xff;
+    }
+
+    return nals;
+}
+
+/* The pre-SIMD implementation, kept as the baseline. */
+static int bench_find_headers_memmem(const uint8_t *buf, int lengthBytes, struct ltn_nal_headers_s *a, int maxitems)
+{
+    const uint8_t start_code[3] = {0, 0, 1};
+    const uint8_t *end = buf + lengthBytes;
+    const uint8_t *p = buf;
+    int idx = 0;
+
+    while (p < end - 3 && idx < maxitems) {
+        p = ltn_memmem(p, end - p, start_code, sizeof(start_code));
+        if (!p)
+            break;
+        a[idx].ptr = p;
+        a[idx].nalType = p[3] & 0x1f;
+        if (idx > 0)
+            a[idx - 1].lengthBytes = p - a[idx - 1].ptr;
+        idx++;
+        p += 3;
+    }
+    if (idx > 0)
+        a[idx - 1].lengthBytes = end - a[idx - 1].ptr;
+
+    return idx;
+}
+
+static int bench_verify(const uint8_t *buf, int lengthBytes, const char *implName)
+{
+    int arrayLength = 0;
+    struct ltn_nal_headers_s *array = NULL;
+    if (ltn_nal_h264_find_headers(buf, lengthBytes, &array, &arrayLength) < 0) {
+        fprintf(stderr, "%s: find_headers failed\n", implName);
+        return -1;
+    }
+
+    /* The byte at a time enumerator is the reference */
+    int count = 0;
+    int offset = -1;
+    while (ltn_nal_h264_findHeader(buf, lengthBytes, &offset) == 0) {
+        if (count >= arrayLength || array[count].ptr != buf + offset) {
+            fprintf(stderr, "%s: header %d mismatch at offset %d\n", implName, count, offset);
+            free(array);
+            return -1;
+        }
+        count++;
+    }
+    if (count != arrayLength) {
+        fprintf(stderr, "%s: found %d headers, reference found %d\n", implName, arrayLength, count);
+        free(array);
+        return -1;
+    }
+
+    free(array);
+    return 0; /* Success */
+}
+
+static void bench_startcode(const uint8_t *buf, int lengthBytes, int iterations)
+{
+    int maxitems = lengthBytes / 4;
+    struct ltn_nal_headers_s *a = malloc(sizeof(*a) * maxitems);
+
+    double start = bench_now();
+    int found = 0;
+    for (int i = 0; i < iterations; i++) {
+        found = bench_find_headers_memmem(buf, lengthBytes, a, maxitems);
+    }
+    double baseline = bench_now() - start;
+    bench_log("startcode %-8s %8.3f GB/s  %6d headers\n", "memmem",
+        ((double)lengthBytes * iterations) / baseline / 1e9, found);
+    bench_report("startcode", "memmem", "GB/s", ((double)lengthBytes * iterations) / baseline / 1e9);
+    free(a);
+
+    for (int i = 0; ltn_startcode_impls[i].name; i++) {
+        const char *name = ltn_startcode_impls[i].name;
+        if (ltn_startcode_select(name) < 0) {
+            bench_log("startcode %-8s not supported on this cpu\n", name);
+            continue;
+        }
+        if (bench_verify(buf, lengthBytes, name) < 0) {
+            exit(1);
+        }
+
+        int arrayLength = 0;
+        struct ltn_nal_headers_s *array = NULL;
+        start = bench_now();
+        for (int j = 0; j < iterations; j++) {
+            ltn_nal_h264_find_headers(buf, lengthBytes, &array, &arrayLength);
+            free(array);
+        }
+        double elapsed = bench_now() - start;
+        bench_log("startcode %-8s %8.3f GB/s  %6d headers  %5.2fx\n", name,
+            ((double)lengthBytes * iterations) / elapsed / 1e9, arrayLength, baseline / elapsed);
+        bench_report("startcode", name, "GB/s", ((double)lengthBytes * iterations) / elapsed / 1e9);
+    }
+
+    ltn_startcode_select(NULL);
+}
+
+/* Steady state enumeration must not touch the heap. Returns < 0 if it does. */
+static int bench_allocations(const uint8_t *buf, int lengthBytes, int iterations)
+{
+    int arrayLength = 0;
+    struct ltn_nal_headers_s *array = NULL;
+
+    gAllocations = 0;
+    for (int i = 0; i < iterations; i++) {
+        ltn_nal_h264_find_headers(buf, lengthBytes, &array, &arrayLength);
+        free(array);
+    }
+    bench_log("allocs    %-8s %8.2f per PES\n", "legacy", (double)gAllocations / iterations);
+    bench_report("allocs", "legacy", "per_pes", (double)gAllocations / iterations);
+
+    struct ltn_nal_headers_array_s a = { 0 };
+    ltn_nal_h264_find_headers_array(buf, lengthBytes, &a); /* Warm up, sizes the array */
+    gAllocations = 0;
+    for (int i = 0; i < iterations; i++) {
+        ltn_nal_h264_find_headers_array(buf, lengthBytes, &a);
+    }
+    uint64_t arrayAllocations = gAllocations;
+    bench_log("allocs    %-8s %8.2f per PES\n", "array", (double)arrayAllocations / iterations);
+    bench_report("allocs", "array", "per_pes", (double)arrayAllocations / iterations);
+
+    gAllocations = 0;
+    int count = 0;
+    for (int i = 0; i < iterations; i++) {
+        struct ltn_nal_headers_iter_s it;
+        struct ltn_nal_headers_s hdr;
+        ltn_nal_h264_headers_iter_init(&it, buf, lengthBytes);
+        for (count = 0; ltn_nal_h264_headers_iter_next(&it, &hdr) == 0; count++) {
+            if (count >= a.count || hdr.ptr != a.items[count].ptr || hdr.lengthBytes != a.items[count].lengthBytes) {
+                fprintf(stderr, "iterator: header %d differs from the array enumeration\n", count);
+                return -1;
+            }
+        }
+    }
+    uint64_t iterAllocations = gAllocations;
+    bench_log("allocs    %-8s %8.2f per PES\n", "iter", (double)iterAllocations / iterations);
+    bench_report("allocs", "iter", "per_pes", (double)iterAllocations / iterations);
+
+    if (count != a.count) {
+        fprintf(stderr, "iterator: found %d headers, array found %d\n", count, a.count);
+        return -1;
+    }
+    ltn_nal_headers_array_free(&a);
+
+    if (arrayAllocations || iterAllocations) {
+        fprintf(stderr, "steady state nal enumeration allocated memory\n");
+        return -1;
+    }
+
+    return 0; /* Success */
+}
+
+/* The original one bit per call reader, kept as the baseline. */
+typedef struct {
+    const uint8_t *data;
+    int size;
+    int bit_pos;
+    int zeros;
+} BenchBitReaderV1;
+
+static int bench_v1_read_bit(BenchBitReaderV1 *br)
+{
+    if ((br->bit_pos % 8) == 0) {
+        int byte_offset = br->bit_pos / 8;
+        if (br->zeros >= 2 && byte_offset < br->size && br->data[byte_offset] == 0x03) {
+            br->bit_pos += 8;
+            br->zeros = 0;
+        }
+    }
+    if (br->bit_pos >= br->size * 8) return -1;
+    int byte_offset = br->bit_pos / 8;
+    int bit_offset = 7 - (br->bit_pos % 8);
+    br->bit_pos++;
+    if (bit_offset == 0) {
+        br->zeros = br->data[byte_offset] ? 0 : br->zeros + 1;
+    }
+    return (br->data[byte_offset] >> bit_offset) & 0x01;
+}
+
+static uint32_t bench_v1_read_bits(BenchBitReaderV1 *br, int n)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < n; i++) {
+        int bit = bench_v1_read_bit(br);
+        if (bit < 0) return 0xFFFFFFFF;
+        result = (result << 1) | bit;
+    }
+    return result;
+}
+
+static int bench_v1_read_ue(BenchBitReaderV1 *br)
+{
+    int leadingZeroBits = -1;
+    for (int b = 0; !b; leadingZeroBits++) {
+        b = bench_v1_read_bit(br);
+        if (b < 0) return -1;
+    }
+    if (leadingZeroBits > 31) return -1;
+    return (1 << leadingZeroBits) - 1 + bench_v1_read_bits(br, leadingZeroBits);
+}
+
+static int bench_v1_read_se(BenchBitReaderV1 *br)
+{
+    int k = bench_v1_read_ue(br);
+    return (k & 1) ? (k + 1) / 2 : -(k / 2);
+}
+
+/* A cut down slice_header(), enough fields to exercise ue(v), u(n) and se(v).
+ * first_mb_in_slice, slice_type, pic_parameter_set_id, frame_num, pic_order_cnt_lsb, slice_qp_delta
+ */
+#define BENCH_SLICE_HEADER_FIELDS 6
+
+static void bench_slice_headers(int count)
+{
+    int stride = 32;
+    uint8_t *buf = malloc(count * stride);
+    int *lengths = malloc(count * sizeof(int));
+    int64_t expected = 0;
+
+    for (int i = 0; i < count; i++) {
+        struct ts_gen_bitwriter_s w = { .buf = buf + (i * stride) };
+        uint32_t first_mb = bench_rand() % 3600;
+        uint32_t slice_type = bench_rand() % 10;
+        uint32_t frame_num = bench_rand() % 16;
+        uint32_t poc_lsb = bench_rand() % 256;
+        int qp_delta = (int)(bench_rand() % 25) - 12;
+
+        ts_gen_put_ue(&w, first_mb);
+        ts_gen_put_ue(&w, slice_type);
+        ts_gen_put_ue(&w, 0);
+        ts_gen_put_bits(&w, 4, frame_num);
+        ts_gen_put_bits(&w, 8, poc_lsb);
+        ts_gen_put_se(&w, qp_delta);
+        /* Some slice data after the header, skewed towards zero so emulation prevention kicks in */
+        while (w.bytes < stride - 8) {
+            ts_gen_put_bits(&w, 8, (bench_rand() % 8) == 0 ? 0 : (uint8_t)bench_rand());
+        }
+        lengths[i] = w.bytes;
+
+        expected += (int64_t)first_mb + slice_type + frame_num + poc_lsb + qp_delta;
+    }
+
+    int64_t sum = 0;
+    double start = bench_now();
+    for (int i = 0; i < count; i++) {
+        BenchBitReaderV1 br = { .data = buf + (i * stride), .size = lengths[i] };
+        sum += bench_v1_read_ue(&br);
+        sum += bench_v1_read_ue(&br);
+        sum += bench_v1_read_ue(&br);
+        sum += bench_v1_read_bits(&br, 4);
+        sum += bench_v1_read_bits(&br, 8);
+        sum += bench_v1_read_se(&br);
+    }
+    double baseline = bench_now() - start;
+    if (sum != expected) {
+        fprintf(stderr, "bitreader v1: checksum mismatch\n");
+        exit(1);
+    }
+    bench_log("bitread   %-8s %8.2f Mheaders/s  %6.1f ns/header\n", "bitwise",
+        count / baseline / 1e6, baseline * 1e9 / count);
+    bench_report("slice_header", "bitwise", "ns/header", baseline * 1e9 / count);
+
+    sum = 0;
+    start = bench_now();
+    for (int i = 0; i < count; i++) {
+        BitReader br;
+        init_bitreader_rbsp(&br, buf + (i * stride), lengths[i]);
+        sum += read_ue(&br);
+        sum += read_ue(&br);
+        sum += read_ue(&br);
+        sum += read_bits(&br, 4);
+        sum += read_bits(&br, 8);
+        sum += read_se(&br);
+    }
+    double elapsed = bench_now() - start;
+    if (sum != expected) {
+        fprintf(stderr, "bitreader: checksum mismatch\n");
+        exit(1);
+    }
+    bench_log("bitread   %-8s %8.2f Mheaders/s  %6.1f ns/header  %5.2fx\n", "cached",
+        count / elapsed / 1e6, elapsed * 1e9 / count, baseline / elapsed);
+    bench_report("slice_header", "cached", "ns/header", elapsed * 1e9 / count);
+
+    free(lengths);
+    free(buf);
+}
+
+/* Strip every emulation prevention byte from the buffer, the copy a full RBSP decode pays for */
+static void bench_strip(const uint8_t *buf, int lengthBytes, int iterations)
+{
+    uint8_t *dst = malloc(lengthBytes);
+    int len = 0;
+
+    double start = bench_now();
+    for (int i = 0; i < iterations; i++) {
+        len = ltn_nal_h264_strip_emulation_prevention(buf, lengthBytes, dst);
+    }
+    double elapsed = bench_now() - start;
+
+    bench_log("strip     %-8s %8.3f GB/s  %6d escapes\n", "scalar",
+        ((double)lengthBytes * iterations) / elapsed / 1e9, lengthBytes - len);
+    bench_report("strip_emulation_prevention", "scalar", "GB/s", ((double)lengthBytes * iterations) / elapsed / 1e9);
+    free(dst);
+}
+
+/* read_ue() on its own, values skewed small the way slice header fields are */
+static void bench_read_ue(int count)
+{
+    int lengthBytes = (count * 4) + 64;
+    uint8_t *buf = calloc(1, lengthBytes);
+    struct ts_gen_bitwriter_s w = { .buf = buf };
+    int64_t expected = 0;
+
+    for (int i = 0; i < count; i++) {
+        uint32_t v = bench_rand() % (1u << (bench_rand() % 12));
+        ts_gen_put_ue(&w, v);
+        expected += v;
+    }
+    ts_gen_put_trailing(&w);
+
+    int64_t sum = 0;
+    double start = bench_now();
+    BitReader br;
+    init_bitreader_rbsp(&br, buf, w.bytes);
+    for (int i = 0; i < count; i++) {
+        sum += read_ue(&br);
+    }
+    double elapsed = bench_now() - start;
+    if (sum != expected) {
+        fprintf(stderr, "read_ue: checksum mismatch\n");
+        exit(1);
+    }
+    bench_log("read_ue   %-8s %8.2f Mvalues/s  %6.1f ns/value\n", "cached",
+        count / elapsed / 1e6, elapsed * 1e9 / count);
+    bench_report("read_ue", "cached", "ns/value", elapsed * 1e9 / count);
+
+    free(buf);
+}
+
+/* The probe's PES path minus libltntstools: reassemble the video pid with pes_asm.c from a
+ * capped arena, enumerate the nals and parse every slice header through to the QP, as
+ * analyze_h264() does.
+ */
+#define BENCH_PES_ARENA_BYTES (4 * 1024 * 1024)   /* The smallest -m the probe allows */
+
+struct bench_pes_s
+{
+    struct pes_arena_s *arena;
+    struct pes_asm_s *pe;
+    struct ltn_nal_headers_array_s nals;
+    struct h264_params_s h264;
+
+    uint64_t sliceCount[3];
+    uint64_t sliceBytes;
+    uint64_t parsed;
+    int largest;             /* PES sizes seen, elementary stream bytes */
+    int smallest;
+};
+
+static void bench_pes_callback(void *userContext, struct pes_asm_packet_s *pes)
+{
+    struct bench_pes_s *b = (struct bench_pes_s *)userContext;
+
+    if (pes->dataLengthBytes > b->largest)
+        b->largest = pes->dataLengthBytes;
+    if (b->smallest == 0 || pes->dataLengthBytes < b->smallest)
+        b->smallest = pes->dataLengthBytes;
+
+    if (ltn_nal_h264_find_headers_array(pes->data, pes->dataLengthBytes, &b->nals) < 0)
+        return;
+
+    for (int i = 0; i < b->nals.count; i++) {
+        struct ltn_nal_headers_s *e = &b->nals.items[i];
+        struct h264_slice_header_s sh;
+
+        switch (e->nalType) {
+        case 1:
+        case 5:
+            if (h264_params_slice_header(&b->h264, e->ptr + 4, e->lengthBytes - 4, e->nalType,
+                (e->ptr[3] >> 5) & 3, &sh) == 0)
+            {
+                b->parsed++;
+            }
+            if (sh.slice_type >= 0)
+                b->sliceCount[sh.slice_type % 5 % 3]++;
+            b->sliceBytes += e->lengthBytes - 3;
+            break;
+        case 7:
+            h264_params_sps(&b->h264, e->ptr + 4, e->lengthBytes - 4);
+            break;
+        case 8:
+            h264_params_pps(&b->h264, e->ptr + 4, e->lengthBytes - 4);
+            break;
+        }
+    }
+}
+
+static int bench_pes_alloc(struct bench_pes_s *b, uint16_t pid, size_t capBytes)
+{
+    memset(b, 0, sizeof(*b));
+    h264_params_reset(&b->h264);
+    if (pes_arena_alloc(&b->arena, capBytes) < 0)
+        return -1;
+    if (pes_asm_alloc(&b->pe, b->arena, pid, 0xe0, bench_pes_callback, b) < 0) {
+        pes_arena_free(b->arena);
+        return -1;
+    }
+    return 0; /* Success */
+}
+
+/* Returns < 0 if the arena still holds buffers once the reassembler has gone */
+static int bench_pes_free(struct bench_pes_s *b, const char *impl)
+{
+    pes_asm_free(b->pe);
+
+    struct pes_arena_stats_s s;
+    pes_arena_query(b->arena, &s, 0);
+    pes_arena_free(b->arena);
+    ltn_nal_headers_array_free(&b->nals);
+
+    if (s.inUseBytes || s.buffersInUse) {
+        fprintf(stderr, "%s: %u arena buffers, %zu bytes, never released\n", impl, s.buffersInUse, s.inUseBytes);
+        return -1;
+    }
+    return 0; /* Success */
+}
+
+static void bench_pipeline_report(const char *impl, uint64_t packets, double elapsed)
+{
+    bench_log("pipeline  %-8s %8.2f Mpackets/s  %6.1f ns/packet  %8.1f Mbps\n", impl,
+        packets / elapsed / 1e6, elapsed * 1e9 / packets, (packets * 188 * 8) / elapsed / 1e6);
+    bench_report("pipeline", impl, "packets/s", packets / elapsed);
+    bench_report("pipeline", impl, "ns/packet", elapsed * 1e9 / packets);
+}
+
+static int bench_pipeline_check(const char *impl, const struct ts_gen_s *g, const uint64_t *counts, uint64_t sliceBytes)
+{
+    if (counts[0] != g->sliceCount[0] || counts[1] != g->sliceCount[1] || counts[2] != g->sliceCount[2] ||
+        sliceBytes != g->sliceBytes)
+    {
+        fprintf(stderr, "%s: counted %" PRIu64 "/%" PRIu64 "/%" PRIu64 " P/B/I slices, %" PRIu64 " bytes, generated %"
+            PRIu64 "/%" PRIu64 "/%" PRIu64 ", %" PRIu64 " bytes\n", impl, counts[0], counts[1], counts[2], sliceBytes,
+            g->sliceCount[0], g->sliceCount[1], g->sliceCount[2], g->sliceBytes);
+        return -1;
+    }
+    return 0; /* Success */
+}
+
+/* Generate a stream into memory, then time each analysis path over the whole of it */
+static int bench_pipeline(const struct ts_gen_params_s *params)
+{
+    struct ts_gen_s *g;
+    if (ts_gen_alloc(&g, params) < 0) {
+        fprintf(stderr, "pipeline: bad generator params\n");
+        return -1;
+    }
+
+    uint8_t *ts = NULL;
+    uint64_t packets = 0, allocated = 0;
+    const uint8_t *pkts;
+    int count;
+    while ((count = ts_gen_next(g, &pkts)) > 0) {
+        if (packets + count > allocated) {
+            allocated = (allocated * 2) + count;
+            ts = realloc(ts, allocated * 188);
+        }
+        memcpy(ts + (packets * 188), pkts, count * 188);
+        packets += count;
+    }
+    bench_log("pipeline  %" PRIu64 " packets, %" PRIu64 " pictures, %" PRIu64 " slices, %" PRIu64 " escapes\n",
+        packets, g->pesCount - 1, g->sliceCount[0] + g->sliceCount[1] + g->sliceCount[2], g->escapes);
+
+    int ret = 0;
+
+    /* PES reassembly, nal enumeration and slice headers, in probe sized chunks */
+    struct bench_pes_s pes;
+    if (bench_pes_alloc(&pes, params->pid, BENCH_PES_ARENA_BYTES) < 0) {
+        fprintf(stderr, "pes: unable to allocate the reassembler\n");
+        free(ts);
+        ts_gen_free(g);
+        return -1;
+    }
+    double start = bench_now();
+    for (uint64_t i = 0; i < packets; i += 7)
+        pes_asm_write(pes.pe, ts + (i * 188), packets - i < 7 ? packets - i : 7);
+    double elapsed = bench_now() - start;
+    bench_pipeline_report("pes", packets, elapsed);
+    if (bench_pipeline_check("pes", g, pes.sliceCount, pes.sliceBytes) < 0 ||
+        pes.parsed != pes.sliceCount[0] + pes.sliceCount[1] + pes.sliceCount[2] || pes.pe->drops)
+    {
+        fprintf(stderr, "pes: %" PRIu64 " slice headers parsed, %" PRIu64 " PES dropped\n", pes.parsed, pes.pe->drops);
+        ret = -1;
+    }
+    int largest = pes.largest, smallest = pes.smallest;
+    if (bench_pes_free(&pes, "pes") < 0)
+        ret = -1;
+
+    /* Again with an arena half the size class of the largest PES. That PES can't fit and must
+     * be dropped, and any PES under a quarter of the class must still be analyzed.
+     */
+    size_t starved = ((size_t)PES_ARENA_MIN_BYTES << pes_arena_class(largest)) / 2;
+    if (bench_pes_alloc(&pes, params->pid, starved) < 0) {
+        fprintf(stderr, "pes: unable to allocate the reassembler\n");
+        ret = -1;
+    } else {
+        for (uint64_t i = 0; i < packets; i += 7)
+            pes_asm_write(pes.pe, ts + (i * 188), packets - i < 7 ? packets - i : 7);
+        uint64_t slices = pes.sliceCount[0] + pes.sliceCount[1] + pes.sliceCount[2];
+        uint64_t drops = pes.pe->drops;
+        int smallFits = (size_t)smallest + 64 <= starved / 2; /* PES header included */
+        if (drops == 0 || (smallFits && pes.pe->pesCount == 0) ||
+            slices >= g->sliceCount[0] + g->sliceCount[1] + g->sliceCount[2])
+        {
+            fprintf(stderr, "pes: %zu KB arena, %" PRIu64 " PES dropped, %" PRIu64 " analyzed, %" PRIu64 " slices counted\n",
+                starved / 1024, drops, pes.pe->pesCount, slices);
+            ret = -1;
+        } else {
+            bench_log("pipeline  pes arena at %zu KB, %" PRIu64 " PES dropped, %" PRIu64 " analyzed\n",
+                starved / 1024, drops, pes.pe->pesCount);
+        }
+        if (bench_pes_free(&pes, "pes starved") < 0)
+            ret = -1;
+    }
+
+    /* The packet level counter, -C */
+    void *counter = h264_slice_counter_alloc(params->pid);
+    start = bench_now();
+    for (uint64_t i = 0; i < packets; i += 7)
+        h264_slice_counter_write(counter, ts + (i * 188), packets - i < 7 ? packets - i : 7);
+    elapsed = bench_now() - start;
+    bench_pipeline_report("counter", packets, elapsed);
+
+    struct h264_slice_counter_results_s r;
+    h264_slice_counter_query(counter, &r);
+    uint64_t counts[3] = { r.p, r.b, r.i };
+    if (bench_pipeline_check("counter", g, counts, r.sliceBytes) < 0)
+        ret = -1;
+    h264_slice_counter_free(counter);
+
+    free(ts);
+    ts_gen_free(g);
+    return ret;
+}
+
+/* ts_gen.c only writes H.264, so the HEVC path (hevc_params.c, as analyze_hevc() in the probe
+ * drives it) is checked against hand built nals instead. 1920x1080 in 64x64 CTBs, 510 of them
+ * so a 9 bit slice_segment_address, 8 bit pic_order_cnt_lsb and dependent slice segments on.
+ */
+#define BENCH_HEVC_ADDRESS_BITS 9
+
+struct bench_hevc_slice_s
+{
+    int nalType;
+    int first;               /* first_slice_segment_in_pic_flag */
+    int dependent;           /* dependent_slice_segment_flag */
+    int address;             /* slice_segment_address */
+    int sliceType;           /* Written, or inherited by a dependent segment */
+    int poc;                 /* pic_order_cnt_lsb, not written for IDR pictures */
+};
+
+static const struct bench_hevc_slice_s bench_hevc_slices[] = {
+    { HEVC_NAL_IDR_W_RADL, 1, 0,   0, HEVC_SLICE_I,  0 },
+    { HEVC_NAL_IDR_W_RADL, 0, 1, 255, HEVC_SLICE_I,  0 },
+    { HEVC_NAL_IDR_W_RADL, 0, 0, 300, HEVC_SLICE_I,  0 },
+    { 1 /* TRAIL_R */,     1, 0,   0, HEVC_SLICE_P,  8 },
+    { 1,                   0, 1, 509, HEVC_SLICE_P,  8 },
+    { 0 /* TRAIL_N */,     1, 0,   0, HEVC_SLICE_B,  4 },
+    { 0,                   0, 0, 128, HEVC_SLICE_B,  4 },
+    { 0,                   0, 1, 256, HEVC_SLICE_B,  4 },
+    { 21 /* CRA_NUT */,    1, 0,   0, HEVC_SLICE_I, 16 },
+};
+#define BENCH_HEVC_SLICES (int)(sizeof(bench_hevc_slices) / sizeof(bench_hevc_slices[0]))
+
+/* Start code and the two byte nal header, nuh_layer_id 0, nuh_temporal_id_plus1 1 */
+static void bench_hevc_nal_start(struct ts_gen_bitwriter_s *w, int nalType)
+{
+    ts_gen_nal_start(w, nalType << 1);
+    w->buf[w->bytes++] = 0x01;
+}
+
+/* Returns the expected header_bytes, of the slice payload after its nal header */
+static int bench_hevc_slice(struct ts_gen_bitwriter_s *w, const struct bench_hevc_slice_s *sl)
+{
+    bench_hevc_nal_start(w, sl->nalType);
+    int start = w->bytes;
+
+    ts_gen_put_bits(w, 1, sl->first);
+    if (HEVC_NAL_IS_IRAP(sl->nalType))
+        ts_gen_put_bits(w, 1, 0);  /* no_output_of_prior_pics_flag */
+    ts_gen_put_ue(w, 0);           /* slice_pic_parameter_set_id */
+    if (!sl->first) {
+        ts_gen_put_bits(w, 1, sl->dependent);
+        ts_gen_put_bits(w, BENCH_HEVC_ADDRESS_BITS, sl->address);
+    }
+    if (!sl->dependent) {
+        ts_gen_put_ue(w, sl->sliceType);
+        if (sl->nalType != HEVC_NAL_IDR_W_RADL && sl->nalType != HEVC_NAL_IDR_N_LP)
+            ts_gen_put_bits(w, 8, sl->poc);
+    }
+    int headerBytes = w->bytes - start + (w->nbits ? 1 : 0);
+
+    /* Whatever follows in the header and the slice data, zero heavy for emulation prevention */
+    for (int i = 0; i < 64; i++)
+        ts_gen_put_bits(w, 8, (bench_rand() % 4) == 0 ? 0 : (uint8_t)bench_rand());
+    ts_gen_put_trailing(w);
+
+    return headerBytes;
+}
+
+static int bench_hevc_headers()
+{
+    uint8_t *es = malloc(64 * 1024);
+    struct ts_gen_bitwriter_s w = { .buf = es };
+    int headerBytes[BENCH_HEVC_SLICES];
+
+    /* The VPS, ignored by the probe, only has to enumerate */
+    bench_hevc_nal_start(&w, 32);
+    ts_gen_put_bits(&w, 16, 0x0c01);
+    ts_gen_put_trailing(&w);
+
+    bench_hevc_nal_start(&w, HEVC_NAL_SPS);
+    ts_gen_put_bits(&w, 4, 0);          /* sps_video_parameter_set_id */
+    ts_gen_put_bits(&w, 3, 0);          /* sps_max_sub_layers_minus1 */
+    ts_gen_put_bits(&w, 1, 1);          /* sps_temporal_id_nesting_flag */
+    ts_gen_put_bits(&w, 8, 0x01);       /* general_profile_space, tier, profile_idc Main */
+    ts_gen_put_bits(&w, 32, 0x60000000); /* general_profile_compatibility_flag[] */
+    ts_gen_put_bits(&w, 32, 0x90000000); /* progressive, frame only and reserved constraint flags */
+    ts_gen_put_bits(&w, 16, 0);
+    ts_gen_put_bits(&w, 8, 120);        /* general_level_idc, 4.0 */
+    ts_gen_put_ue(&w, 0);               /* sps_seq_parameter_set_id */
+    ts_gen_put_ue(&w, 1);               /* chroma_format_idc, 4:2:0 */
+    ts_gen_put_ue(&w, 1920);            /* pic_width_in_luma_samples */
+    ts_gen_put_ue(&w, 1080);            /* pic_height_in_luma_samples */
+    ts_gen_put_bits(&w, 1, 0);          /* conformance_window_flag */
+    ts_gen_put_ue(&w, 0);               /* bit_depth_luma_minus8 */
+    ts_gen_put_ue(&w, 0);               /* bit_depth_chroma_minus8 */
+    ts_gen_put_ue(&w, 4);               /* log2_max_pic_order_cnt_lsb_minus4 */
+    ts_gen_put_bits(&w, 1, 1);          /* sps_sub_layer_ordering_info_present_flag */
+    ts_gen_put_ue(&w, 4);               /* sps_max_dec_pic_buffering_minus1 */
+    ts_gen_put_ue(&w, 2);               /* sps_max_num_reorder_pics */
+    ts_gen_put_ue(&w, 0);               /* sps_max_latency_increase_plus1 */
+    ts_gen_put_ue(&w, 0);               /* log2_min_luma_coding_block_size_minus3 */
+    ts_gen_put_ue(&w, 3);               /* log2_diff_max_min_luma_coding_block_size */
+    ts_gen_put_trailing(&w);
+
+    bench_hevc_nal_start(&w, HEVC_NAL_PPS);
+    ts_gen_put_ue(&w, 0);               /* pps_pic_parameter_set_id */
+    ts_gen_put_ue(&w, 0);               /* pps_seq_parameter_set_id */
+    ts_gen_put_bits(&w, 1, 1);          /* dependent_slice_segments_enabled_flag */
+    ts_gen_put_bits(&w, 1, 0);          /* output_flag_present_flag */
+    ts_gen_put_bits(&w, 3, 0);          /* num_extra_slice_header_bits */
+    ts_gen_put_bits(&w, 1, 0);          /* sign_data_hiding_enabled_flag */
+    ts_gen_put_bits(&w, 1, 0);          /* cabac_init_present_flag */
+    ts_gen_put_ue(&w, 0);               /* num_ref_idx_l0_default_active_minus1 */
+    ts_gen_put_ue(&w, 0);               /* num_ref_idx_l1_default_active_minus1 */
+    ts_gen_put_se(&w, 0);               /* init_qp_minus26 */
+    ts_gen_put_trailing(&w);
+
+    for (int i = 0; i < BENCH_HEVC_SLICES; i++)
+        headerBytes[i] = bench_hevc_slice(&w, &bench_hevc_slices[i]);
+
+    struct ltn_nal_headers_array_s nals = { 0 };
+    struct hevc_params_s *p = malloc(sizeof(*p));
+    hevc_params_reset(p);
+    int ret = 0;
+
+    /* Twice, the second pass finds both parameter sets unchanged */
+    for (int pass = 0; pass < 2 && ret == 0; pass++) {
+        if (ltn_nal_hevc_find_headers_array(es, w.bytes, &nals) < 0 || nals.count != 3 + BENCH_HEVC_SLICES) {
+            fprintf(stderr, "hevc: %d nals found, wrote %d\n", nals.count, 3 + BENCH_HEVC_SLICES);
+            ret = -1;
+            break;
+        }
+
+        for (int i = 0; i < nals.count && ret == 0; i++) {
+            struct ltn_nal_headers_s *e = &nals.items[i];
+            const uint8_t *payload = e->ptr + 5;
+            int payloadLength = e->lengthBytes - 5;
+
+            if (e->nalType == HEVC_NAL_SPS) {
+                if (hevc_params_sps(p, payload, payloadLength) < 0 || p->sps[0].width != 1920 ||
+                    p->sps[0].height != 1080 || p->sps[0].log2_max_pic_order_cnt_lsb != 8 ||
+                    p->sps[0].slice_segment_address_bits != BENCH_HEVC_ADDRESS_BITS)
+                {
+                    fprintf(stderr, "hevc: SPS parsed as %dx%d, %d bit poc lsb, %d bit slice address\n",
+                        p->sps[0].width, p->sps[0].height, p->sps[0].log2_max_pic_order_cnt_lsb,
+                        p->sps[0].slice_segment_address_bits);
+                    ret = -1;
+                }
+                continue;
+            } else
+            if (e->nalType == HEVC_NAL_PPS) {
+                if (hevc_params_pps(p, payload, payloadLength) < 0 || !p->pps[0].dependent_slice_segments_enabled_flag ||
+                    p->pps[0].init_qp != 26)
+                {
+                    fprintf(stderr, "hevc: PPS doesn't parse back\n");
+                    ret = -1;
+                }
+                continue;
+            } else
+            if (!HEVC_NAL_IS_VCL(e->nalType)) {
+                continue;
+            }
+
+            int n = i - 3;
+            const struct bench_hevc_slice_s *sl = &bench_hevc_slices[n];
+            struct hevc_slice_header_s sh = { 0 };
+            if (e->nalType != sl->nalType ||
+                hevc_params_slice_header(p, payload, payloadLength, e->nalType, &sh) < 0 ||
+                sh.slice_type != sl->sliceType || sh.irap != HEVC_NAL_IS_IRAP(sl->nalType) ||
+                sh.dependent_slice_segment_flag != sl->dependent || sh.header_bytes != headerBytes[n] ||
+                (!sl->dependent && sh.pic_order_cnt_lsb != sl->poc))
+            {
+                fprintf(stderr, "hevc: slice %d, nal %d, parsed slice_type %d irap %d dependent %d poc %d header %d bytes, "
+                    "wrote %d/%d/%d/%d/%d\n", n, e->nalType, sh.slice_type, sh.irap, sh.dependent_slice_segment_flag,
+                    sh.pic_order_cnt_lsb, sh.header_bytes, sl->sliceType, HEVC_NAL_IS_IRAP(sl->nalType), sl->dependent,
+                    sl->poc, headerBytes[n]);
+                ret = -1;
+            }
+        }
+    }
+    if (ret == 0 && (p->parses != 2 || p->repeats != 2)) {
+        fprintf(stderr, "hevc: parameter sets parsed %" PRIu64 " times, repeated %" PRIu64 ", expected 2 and 2\n",
+            p->parses, p->repeats);
+        ret = -1;
+    }
+    if (ret == 0) {
+        bench_log("hevc      %d slice segment headers, %d dependent, parse back as written\n", BENCH_HEVC_SLICES, 3);
+    }
+
+    ltn_nal_headers_array_free(&nals);
+    free(p);
+    free(es);
+    return ret;
+}
+
+/* Records of the widest layout a reader accepts, every type and absent optional values, through
+ * a segment store (segment_store.c) and back out with record_reader.c, must come back as the
+ * json the producer would have written. The probes own layouts are held under
+ * RECORD_MAX_FIELDS where they are declared.
+ */
+#define BENCH_RECORDS 16
+
+static int bench_record_roundtrip()
+{
+    static char names[RECORD_MAX_FIELDS][16];
+    static struct record_field_s fields[RECORD_MAX_FIELDS];
+    static uint8_t values[RECORD_MAX_FIELDS * 8];
+    static const enum record_type_e types[] = { RECORD_U32, RECORD_I64, RECORD_F32, RECORD_BOOL };
+
+    for (int i = 0; i < RECORD_MAX_FIELDS; i++) {
+        snprintf(names[i], sizeof(names[i]), "field_%03d", i);
+        fields[i].name = names[i];
+        fields[i].type = types[i % 4];
+        fields[i].offset = i * 8;
+        fields[i].optional = fields[i].type == RECORD_F32;
+    }
+
+    uint8_t hdr[RECORD_MAX_BYTES];
+    int hdrLength = record_binary_header(fields, RECORD_MAX_FIELDS, hdr, sizeof(hdr));
+    if (hdrLength < 0 || record_binary_header(fields, RECORD_MAX_FIELDS + 1, hdr, sizeof(hdr)) >= 0) {
+        fprintf(stderr, "record: header of %d fields refused, or of %d accepted\n", RECORD_MAX_FIELDS, RECORD_MAX_FIELDS + 1);
+        return -1;
+    }
+
+    char dir[] = "/tmp/bench_uc_01.XXXXXX";
+    struct segment_store_s *store;
+    if (!mkdtemp(dir) || segment_store_alloc(&store, dir, 3600, hdr, hdrLength) < 0) {
+        fprintf(stderr, "record: unable to create a store in %s\n", dir);
+        return -1;
+    }
+
+    int jsonSize = record_json_max_length(fields, RECORD_MAX_FIELDS);
+    char *expected = malloc((size_t)jsonSize * BENCH_RECORDS);
+    char *line = malloc(jsonSize);
+    uint8_t rec[RECORD_MAX_BYTES];
+    int ret = 0;
+
+    for (int r = 0; r < BENCH_RECORDS && ret == 0; r++) {
+        for (int i = 0; i < RECORD_MAX_FIELDS; i++) {
+            uint8_t *v = values + fields[i].offset;
+            switch (fields[i].type) {
+            case RECORD_U32: *(unsigned int *)v = bench_rand(); break;
+            case RECORD_I64: *(int64_t *)v = (int64_t)(((uint64_t)bench_rand() << 32) | bench_rand()); break;
+            case RECORD_F32: *(float *)v = (bench_rand() % 4 == 0) ? -1.0f : (bench_rand() % 1000000) / 1000.0f; break;
+            case RECORD_BOOL: *(int *)v = bench_rand() & 1; break;
+            }
+        }
+        int len = record_to_binary(fields, RECORD_MAX_FIELDS, values, rec, sizeof(rec));
+        if (len < 0 || record_to_json(fields, RECORD_MAX_FIELDS, values, expected + ((size_t)r * jsonSize), jsonSize) < 0 ||
+            segment_store_append(store, rec, len, 3600 + r, r & 1) < 0)
+        {
+            ret = -1;
+        }
+    }
+    segment_store_flush(store);
+    segment_store_free(store);
+
+    char fn[64];
+    snprintf(fn, sizeof(fn), "%s/" SEGMENT_STORE_PREFIX "3600.seg", dir);
+    FILE *fh = fopen(fn, "rb");
+    uint8_t *seg = malloc(hdrLength + (BENCH_RECORDS * sizeof(rec)));
+    size_t segLength = fh ? fread(seg, 1, hdrLength + (BENCH_RECORDS * sizeof(rec)), fh) : 0;
+    if (fh)
+        fclose(fh);
+
+    struct record_layout_s *layout = malloc(sizeof(*layout));
+    if (ret == 0 && (record_binary_parse_header(seg, segLength, layout) < 0 || layout->count != RECORD_MAX_FIELDS ||
+        segLength != layout->headerLength + ((size_t)layout->recordLength * BENCH_RECORDS)))
+    {
+        fprintf(stderr, "record: %zu byte segment of %d records doesn't parse back\n", segLength, BENCH_RECORDS);
+        ret = -1;
+    }
+    for (int r = 0; r < BENCH_RECORDS && ret == 0; r++) {
+        if (record_binary_to_json(layout, seg + layout->headerLength + (r * layout->recordLength), line, jsonSize) < 0 ||
+            strcmp(line, expected + ((size_t)r * jsonSize)) != 0)
+        {
+            fprintf(stderr, "record: record %d differs after the round trip\n", r);
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        bench_log("record    %d fields, %d records through a segment store and back\n", RECORD_MAX_FIELDS, BENCH_RECORDS);
+    }
+
+    unlink(fn);
+    snprintf(fn, sizeof(fn), "%s/" SEGMENT_STORE_PREFIX "3600.idx", dir);
+    unlink(fn);
+    rmdir(dir);
+    free(layout);
+    free(seg);
+    free(line);
+    free(expected);
+    return ret;
+}
+
+/* -g, write the synthetic stream to a file, eg. for probe_uc_01 -i file.ts -B results.json */
+static int bench_write_ts(const struct ts_gen_params_s *params, const char *filename)
+{
+    struct ts_gen_s *g;
+    if (ts_gen_alloc(&g, params) < 0) {
+        fprintf(stderr, "bad generator params\n");
+        return -1;
+    }
+    FILE *fh = fopen(filename, "wb");
+    if (!fh) {
+        perror(filename);
+        ts_gen_free(g);
+        return -1;
+    }
+
+    const uint8_t *pkts;
+    int count;
+    while ((count = ts_gen_next(g, &pkts)) > 0) {
+        fwrite(pkts, 188, count, fh);
+    }
+    fclose(fh);
+
+    bench_log("%s: %" PRIu64 " packets, %" PRIu64 " pictures, %" PRIu64 "/%" PRIu64 "/%" PRIu64 " P/B/I slices\n",
+        filename, g->packets, g->pesCount - 1, g->sliceCount[0], g->sliceCount[1], g->sliceCount[2]);
+    ts_gen_free(g);
+    return 0; /* Success */
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s -n iterations -l buffer_length_bytes -H slice_headers\n", prog);
+    printf("  -j also write every result to stdout as json, one object per line\n");
+    printf("  -g out.ts write the synthetic stream to a file and exit\n");
+    printf("  Synthetic stream: -b bitrate (def 20000000) -G gop (def 60) -B bframes (def 2) -s slices (def 4)\n");
+    printf("                    -z zero percent of slice data, drives emulation prevention (def 1) -t seconds (def 10)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = 200;
+    int lengthBytes = 2 * 1024 * 1024;
+    int sliceHeaders = 5 * 1000 * 1000;
+    const char *tsname = NULL;
+
+    struct ts_gen_params_s params;
+    ts_gen_defaults(&params);
+
+    int ch;
+    while ((ch = getopt(argc, argv, "?hb:B:g:G:jn:l:H:s:t:z:")) != -1) {
+        switch(ch) {
+        case 'b':
+            params.bitrate = atoi(optarg);
+            break;
+        case 'B':
+            params.bframes = atoi(optarg);
+            break;
+        case 'g':
+            tsname = optarg;
+            break;
+        case 'G':
+            params.gop = atoi(optarg);
+            break;
+        case 'j':
+            gJson = 1;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'l':
+            lengthBytes = atoi(optarg);
+            break;
+        case 'H':
+            sliceHeaders = atoi(optarg);
+            break;
+        case 's':
+            params.slices = atoi(optarg);
+            break;
+        case 't':
+            params.seconds = atoi(optarg);
+            break;
+        case 'z':
+            params.zeroPercent = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (iterations < 1 || lengthBytes < 1024 || sliceHeaders < 1) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if (tsname) {
+        exit(bench_write_ts(&params, tsname) < 0 ? 1 : 0);
+    }
+
+    uint8_t *buf = malloc(lengthBytes);
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+
+    /* Roughly a 20Mbps 720p59.94 slice size */
+    int nals = bench_build_es(buf, lengthBytes, 40000);
+    bench_log("buffer %d bytes, %d nals, %d iterations\n", lengthBytes, nals, iterations);
+
+    bench_startcode(buf, lengthBytes, iterations);
+    if (bench_allocations(buf, lengthBytes, iterations) < 0) {
+        exit(1);
+    }
+    bench_strip(buf, lengthBytes, iterations);
+    bench_read_ue(sliceHeaders * BENCH_SLICE_HEADER_FIELDS);
+    bench_slice_headers(sliceHeaders);
+    if (bench_pipeline(&params) < 0) {
+        exit(1);
+    }
+    if (bench_hevc_headers() < 0) {
+        exit(1);
+    }
+    if (bench_record_roundtrip() < 0) {
+        exit(1);
+    }
+
+    free(buf);
+    return 0;
+}
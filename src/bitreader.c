@@ -1,47 +1,223 @@
 
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+/* A cached, big endian bit reader. Up to 64 bits are held in a register, the next bit
+ * to be read is always bit 63 of cache. Refills pull in whole bytes, eight at a time
+ * when we're not near the end of the buffer, so a read is typically a shift and a mask.
+ *
+ * Errors: read_bit() returns -1, read_bits() returns 0xFFFFFFFF and read_ue() returns -1
+ * when the buffer is exhausted. Once a read fails all future reads fail.
+ */
 typedef struct {
-    const uint8_t *data;
-    int size;
-    int bit_pos;
+    const uint8_t *data;   /* Next byte to be loaded into the cache */
+    const uint8_t *end;
+    uint64_t cache;        /* MSB aligned, bits below the valid count are always zero */
+    int bits;              /* Number of valid bits in cache */
+    int rbsp;              /* Boolean. Skip emulation prevention bytes as they're reached. */
+    int zeros;             /* Consecutive zero bytes loaded so far, rbsp mode only. */
+    int escapes;           /* Emulation prevention bytes skipped so far, rbsp mode only. */
 } BitReader;
 
+static inline uint64_t bitreader_load_be64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+/* 0x80 in every byte position of v that holds a zero byte, 0x00 elsewhere */
+static inline uint64_t bitreader_zero_bytes(uint64_t v)
+{
+    uint64_t t = (v & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL;
+    return ~(t | v | 0x7f7f7f7f7f7f7f7fULL);
+}
+
 void init_bitreader(BitReader *br, const uint8_t *data, int size)
 {
     br->data = data;
-    br->size = size;
-    br->bit_pos = 0;
+    br->end = data + (size > 0 ? size : 0);
+    br->cache = 0;
+    br->bits = 0;
+    br->rbsp = 0;
+    br->zeros = 0;
+    br->escapes = 0;
 }
 
-int read_bit(BitReader *br)
+/* Read the RBSP of a nal directly from its escaped payload. Any 00 00 03 sequence has the
+ * 03 skipped as the reader reaches it, so the caller only pays for the bytes it consumes
+ * and the payload is never modified. See ISO-14496-10:2004 section 7.4.1.
+ */
+void init_bitreader_rbsp(BitReader *br, const uint8_t *data, int size)
 {
-    if (br->bit_pos >= br->size * 8) return -1;
-    int byte_offset = br->bit_pos / 8;
-    int bit_offset = 7 - (br->bit_pos % 8);
-    br->bit_pos++;
-    return (br->data[byte_offset] >> bit_offset) & 0x01;
+    init_bitreader(br, data, size);
+    br->rbsp = 1;
+}
+
+/* Top the cache up to at least 57 valid bits, or until the buffer runs out. */
+static void bitreader_refill(BitReader *br)
+{
+    int nbytes = (64 - br->bits) / 8;
+    if (nbytes == 0)
+        return;
+
+    if (br->end - br->data >= 8) {
+        uint64_t w = bitreader_load_be64(br->data);
+
+        /* Keep only the bytes that fit, the rest are loaded next time */
+        if (nbytes < 8) {
+            w = (w >> (64 - (nbytes * 8))) << (64 - (nbytes * 8));
+        }
+
+        if (!br->rbsp) {
+            br->cache |= w >> br->bits;
+            br->bits += nbytes * 8;
+            br->data += nbytes;
+            return;
+        }
+
+        /* An emulation prevention byte needs a 00 00 ahead of it. If the bytes we're taking
+         * contain no pair of zeros, and don't complete one with the zeros we already hold,
+         * the whole run can be taken at once.
+         */
+        int shift = 64 - (nbytes * 8);
+        uint64_t z = bitreader_zero_bytes(w | ((1ULL << shift) - 1));
+        uint8_t first = w >> 56;
+        if ((z & (z << 8)) == 0 &&
+            !(br->zeros >= 1 && first == 0x00) &&
+            !(br->zeros >= 2 && first == 0x03))
+        {
+            br->zeros = ((w >> shift) & 0xff) ? 0 : 1;
+            br->cache |= w >> br->bits;
+            br->bits += nbytes * 8;
+            br->data += nbytes;
+            return;
+        }
+    }
+
+    /* Near the end of the buffer, or an emulation prevention byte is possible. One byte at a time. */
+    while (br->bits <= 56 && br->data < br->end) {
+        uint8_t b = *(br->data++);
+        if (br->rbsp) {
+            if (br->zeros >= 2 && b == 0x03) {
+                br->zeros = 0;
+                br->escapes++;
+                continue;
+            }
+            br->zeros = b ? 0 : br->zeros + 1;
+        }
+        br->cache |= (uint64_t)b << (56 - br->bits);
+        br->bits += 8;
+    }
+}
+
+/* The buffer ran dry, make sure every future read fails too. */
+static inline void bitreader_exhaust(BitReader *br)
+{
+    br->data = br->end;
+    br->cache = 0;
+    br->bits = 0;
+}
+
+static inline void bitreader_skip_cached(BitReader *br, int n)
+{
+    br->cache = n < 64 ? br->cache << n : 0;
+    br->bits -= n;
 }
 
 uint32_t read_bits(BitReader *br, int n)
 {
-    uint32_t result = 0;
-    for (int i = 0; i < n; i++) {
-        int bit = read_bit(br);
-        if (bit < 0) return 0xFFFFFFFF;
-        result = (result << 1) | bit;
+    if (n <= 0)
+        return 0;
+
+    if (br->bits < n) {
+        bitreader_refill(br);
+        if (br->bits < n) {
+            bitreader_exhaust(br);
+            return 0xFFFFFFFF;
+        }
     }
+
+    uint32_t result = (uint32_t)(br->cache >> (64 - n));
+    bitreader_skip_cached(br, n);
     return result;
 }
 
+int read_bit(BitReader *br)
+{
+    uint32_t bit = read_bits(br, 1);
+    return bit == 0xFFFFFFFF ? -1 : (int)bit;
+}
+
+/* Bytes of the buffer given to init consumed so far, a partly read byte counts as consumed.
+ * Emulation prevention bytes are counted, so this is an offset into the escaped buffer. The
+ * cache can hold bytes loaded past an escape, so in rbsp mode the escaped buffer is walked
+ * again up to the last byte read, a few bytes for a slice header.
+ */
+static inline int bitreader_offset(const BitReader *br, const uint8_t *start)
+{
+    int consumed = (int)(br->data - start) - (br->bits / 8);
+    if (!br->rbsp || br->escapes == 0)
+        return consumed;
+
+    int rbspBytes = consumed - br->escapes;
+    const uint8_t *p = start;
+    int zeros = 0;
+    while (rbspBytes > 0) {
+        uint8_t b = *(p++);
+        if (zeros >= 2 && b == 0x03) {
+            zeros = 0;
+            continue;
+        }
+        zeros = b ? 0 : zeros + 1;
+        rbspBytes--;
+    }
+    return (int)(p - start);
+}
+
 // Unsigned Exp-Golomb code
 int read_ue(BitReader *br)
 {
-    int leadingZeroBits = -1;
-    for (int b = 0; !b; leadingZeroBits++) {
-        b = read_bit(br);
-        if (b < 0) return -1;
+    if (br->bits < 57) {
+        bitreader_refill(br);
+    }
+
+    /* Bits below the valid count are zero, so a marker bit beyond them is treated as missing */
+    int leadingZeroBits = br->cache ? __builtin_clzll(br->cache) : 64;
+    if (leadingZeroBits >= br->bits) {
+        bitreader_exhaust(br);
+        return -1;
+    }
+    if (leadingZeroBits > 31) {
+        bitreader_exhaust(br);
+        return -1;
+    }
+
+    /* Short codes, the common case, come straight out of the cache */
+    if (leadingZeroBits < 31 && (leadingZeroBits * 2) + 1 <= br->bits) {
+        uint32_t value = (uint32_t)(br->cache >> (64 - ((leadingZeroBits * 2) + 1)));
+        bitreader_skip_cached(br, (leadingZeroBits * 2) + 1);
+        return (int)(value - 1);
     }
-    if (leadingZeroBits > 31) return -1;
 
-    int infoBits = read_bits(br, leadingZeroBits);
-    return (1 << leadingZeroBits) - 1 + infoBits;
+    bitreader_skip_cached(br, leadingZeroBits + 1);
+    uint32_t infoBits = read_bits(br, leadingZeroBits);
+    if (infoBits == 0xFFFFFFFF) return -1;
+
+    uint64_t value = (1ULL << leadingZeroBits) - 1 + infoBits;
+    if (value > 0x7fffffff) return -1;
+    return (int)value;
+}
+
+// Signed Exp-Golomb code, returns INT_MIN on error
+int read_se(BitReader *br)
+{
+    int k = read_ue(br);
+    if (k < 0) return INT_MIN;
+
+    return (k & 1) ? (k + 1) / 2 : -(k / 2);
 }
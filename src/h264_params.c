@@ -0,0 +1,468 @@
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+/* H.264 parameter set cache and slice header parser. Everything in a slice header past
+ * slice_type depends on the active SPS and PPS, so those are parsed once and kept by id.
+ * Encoders repeat them with every IDR, typically unchanged, so each arriving SPS/PPS is
+ * compared against the bytes it was last parsed from and only re-parsed when they differ.
+ * A slice header parse is then a few dozen exp-golomb reads through the cached BitReader.
+ *
+ * Syntax and semantics from ISO-14496-10:2004 sections 7.3.2.1, 7.3.2.2, 7.3.3 and 8.2.1.
+ * Requires bitreader.c.
+ */
+#define H264_MAX_SPS 32
+#define H264_MAX_PPS 256
+#define H264_SPS_MAX_BYTES 256 /* Larger parameter sets are re-parsed every time */
+#define H264_PPS_MAX_BYTES 64
+
+struct h264_sps_s
+{
+    int valid;
+    int chroma_format_idc;
+    int separate_colour_plane_flag;
+    int log2_max_frame_num;
+    int pic_order_cnt_type;
+    int log2_max_pic_order_cnt_lsb;
+    int delta_pic_order_always_zero_flag;
+    int frame_mbs_only_flag;
+    int width_mbs;
+    int height_map_units;
+
+    int lengthBytes;         /* Of the nal payload this was parsed from */
+    uint8_t bytes[H264_SPS_MAX_BYTES];
+};
+
+struct h264_pps_s
+{
+    int valid;
+    int sps_id;
+    int entropy_coding_mode_flag;
+    int bottom_field_pic_order_in_frame_present_flag;
+    int num_ref_idx_l0_default_active;
+    int num_ref_idx_l1_default_active;
+    int weighted_pred_flag;
+    int weighted_bipred_idc;
+    int pic_init_qp;
+    int redundant_pic_cnt_present_flag;
+
+    int lengthBytes;
+    uint8_t bytes[H264_PPS_MAX_BYTES];
+};
+
+struct h264_params_s
+{
+    struct h264_sps_s sps[H264_MAX_SPS];
+    struct h264_pps_s pps[H264_MAX_PPS];
+
+    /* Picture order count decoding state, 8.2.1.1 */
+    int prevPicOrderCntMsb;
+    int prevPicOrderCntLsb;
+
+    /* Lifetime counters */
+    uint64_t parses;         /* Parameter sets parsed */
+    uint64_t repeats;        /* Parameter sets that matched the cache, not parsed */
+};
+
+/* The fields of a slice header this probe uses */
+struct h264_slice_header_s
+{
+    int first_mb_in_slice;
+    int slice_type;
+    int pps_id;
+    int frame_num;
+    int idr;                 /* Boolean */
+    int field_pic_flag;
+    int bottom_field_flag;
+    int pic_order_cnt_lsb;
+    int pic_order_cnt;       /* Decoded, first slice of a picture with pic_order_cnt_type 0 or 2 only, otherwise INT_MIN */
+    int num_ref_idx_l0_active;
+    int num_ref_idx_l1_active;
+    int qp;                  /* SliceQPY, 26 + pic_init_qp_minus26 + slice_qp_delta */
+    int header_bytes;        /* Of buf consumed through slice_qp_delta, what follows no longer varies picture to picture */
+};
+
+static void h264_params_reset(struct h264_params_s *p)
+{
+    memset(p, 0, sizeof(*p));
+}
+
+/* Returns 1 when the nal matches what the entry was last parsed from, otherwise keeps the new bytes */
+static int h264_params_same(int *lengthBytes, uint8_t *bytes, int size, const uint8_t *buf, int len)
+{
+    if (len > size) {
+        *lengthBytes = 0;
+        return 0;
+    }
+    if (*lengthBytes == len && memcmp(bytes, buf, len) == 0)
+        return 1;
+
+    memcpy(bytes, buf, len);
+    *lengthBytes = len;
+    return 0;
+}
+
+static int h264_skip_scaling_list(BitReader *br, int size)
+{
+    int lastScale = 8, nextScale = 8;
+    for (int j = 0; j < size; j++) {
+        if (nextScale != 0) {
+            int delta = read_se(br);
+            if (delta == INT_MIN)
+                return -1;
+            nextScale = (lastScale + delta + 256) % 256;
+        }
+        lastScale = nextScale == 0 ? lastScale : nextScale;
+    }
+    return 0; /* Success */
+}
+
+/**
+ * @brief         Update the cache from a SPS nal.
+ * @param[in]     const uint8_t *buf, int lengthBytes - The nal, from the byte after its nal header byte.
+ * @return          0 - Success, parsed or unchanged
+ * @return        < 0 - Malformed or unsupported, the id (when readable) is invalidated
+ */
+static int h264_params_sps(struct h264_params_s *p, const uint8_t *buf, int lengthBytes)
+{
+    BitReader br;
+    init_bitreader_rbsp(&br, buf, lengthBytes);
+
+    int profile_idc = read_bits(&br, 8);
+    read_bits(&br, 16); /* constraint flags, level_idc */
+    int id = read_ue(&br);
+    if (id < 0 || id >= H264_MAX_SPS)
+        return -1;
+
+    struct h264_sps_s *sps = &p->sps[id];
+    if (h264_params_same(&sps->lengthBytes, sps->bytes, sizeof(sps->bytes), buf, lengthBytes) && sps->valid) {
+        p->repeats++;
+        return 0; /* Success */
+    }
+    sps->valid = 0;
+    p->parses++;
+
+    sps->chroma_format_idc = 1;
+    sps->separate_colour_plane_flag = 0;
+    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244 ||
+        profile_idc == 44 || profile_idc == 83 || profile_idc == 86 || profile_idc == 118 ||
+        profile_idc == 128 || profile_idc == 138 || profile_idc == 139 || profile_idc == 134 ||
+        profile_idc == 135)
+    {
+        sps->chroma_format_idc = read_ue(&br);
+        if (sps->chroma_format_idc == 3)
+            sps->separate_colour_plane_flag = read_bit(&br);
+        read_ue(&br); /* bit_depth_luma_minus8 */
+        read_ue(&br); /* bit_depth_chroma_minus8 */
+        read_bit(&br); /* qpprime_y_zero_transform_bypass_flag */
+        if (read_bit(&br) == 1) { /* seq_scaling_matrix_present_flag */
+            for (int i = 0; i < (sps->chroma_format_idc != 3 ? 8 : 12); i++) {
+                if (read_bit(&br) == 1 && h264_skip_scaling_list(&br, i < 6 ? 16 : 64) < 0)
+                    return -1;
+            }
+        }
+    }
+
+    int v = read_ue(&br);
+    if (v < 0 || v > 12)
+        return -1;
+    sps->log2_max_frame_num = v + 4;
+
+    sps->pic_order_cnt_type = read_ue(&br);
+    if (sps->pic_order_cnt_type == 0) {
+        v = read_ue(&br);
+        if (v < 0 || v > 12)
+            return -1;
+        sps->log2_max_pic_order_cnt_lsb = v + 4;
+    } else
+    if (sps->pic_order_cnt_type == 1) {
+        sps->delta_pic_order_always_zero_flag = read_bit(&br);
+        read_se(&br); /* offset_for_non_ref_pic */
+        read_se(&br); /* offset_for_top_to_bottom_field */
+        int cycle = read_ue(&br);
+        if (cycle < 0 || cycle > 255)
+            return -1;
+        for (int i = 0; i < cycle; i++)
+            read_se(&br);
+    } else
+    if (sps->pic_order_cnt_type != 2) {
+        return -1;
+    }
+
+    read_ue(&br); /* max_num_ref_frames */
+    read_bit(&br); /* gaps_in_frame_num_value_allowed_flag */
+    sps->width_mbs = read_ue(&br) + 1;
+    sps->height_map_units = read_ue(&br) + 1;
+    sps->frame_mbs_only_flag = read_bit(&br);
+    if (sps->frame_mbs_only_flag < 0 || sps->width_mbs <= 0 || sps->height_map_units <= 0)
+        return -1;
+
+    sps->valid = 1;
+    return 0; /* Success */
+}
+
+/**
+ * @brief         Update the cache from a PPS nal.
+ * @param[in]     const uint8_t *buf, int lengthBytes - The nal, from the byte after its nal header byte.
+ * @return          0 - Success, parsed or unchanged
+ * @return        < 0 - Malformed or unsupported, the id (when readable) is invalidated
+ */
+static int h264_params_pps(struct h264_params_s *p, const uint8_t *buf, int lengthBytes)
+{
+    BitReader br;
+    init_bitreader_rbsp(&br, buf, lengthBytes);
+
+    int id = read_ue(&br);
+    if (id < 0 || id >= H264_MAX_PPS)
+        return -1;
+
+    struct h264_pps_s *pps = &p->pps[id];
+    if (h264_params_same(&pps->lengthBytes, pps->bytes, sizeof(pps->bytes), buf, lengthBytes) && pps->valid) {
+        p->repeats++;
+        return 0; /* Success */
+    }
+    pps->valid = 0;
+    p->parses++;
+
+    pps->sps_id = read_ue(&br);
+    if (pps->sps_id < 0 || pps->sps_id >= H264_MAX_SPS)
+        return -1;
+    pps->entropy_coding_mode_flag = read_bit(&br);
+    pps->bottom_field_pic_order_in_frame_present_flag = read_bit(&br);
+
+    /* Slice groups (FMO) are baseline only and never seen in broadcast, not supported */
+    if (read_ue(&br) != 0)
+        return -1;
+
+    pps->num_ref_idx_l0_default_active = read_ue(&br) + 1;
+    pps->num_ref_idx_l1_default_active = read_ue(&br) + 1;
+    pps->weighted_pred_flag = read_bit(&br);
+    pps->weighted_bipred_idc = read_bits(&br, 2);
+    int qp = read_se(&br);
+    read_se(&br); /* pic_init_qs_minus26 */
+    read_se(&br); /* chroma_qp_index_offset */
+    read_bit(&br); /* deblocking_filter_control_present_flag */
+    read_bit(&br); /* constrained_intra_pred_flag */
+    pps->redundant_pic_cnt_present_flag = read_bit(&br);
+    if (qp == INT_MIN || pps->redundant_pic_cnt_present_flag < 0 ||
+        pps->num_ref_idx_l0_default_active <= 0 || pps->num_ref_idx_l1_default_active <= 0)
+    {
+        return -1;
+    }
+    pps->pic_init_qp = 26 + qp;
+
+    pps->valid = 1;
+    return 0; /* Success */
+}
+
+static int h264_skip_ref_pic_list_modification(BitReader *br)
+{
+    if (read_bit(br) != 1) /* ref_pic_list_modification_flag_lX */
+        return 0;
+
+    int idc;
+    do {
+        idc = read_ue(br); /* modification_of_pic_nums_idc */
+        if (idc < 0 || idc > 5)
+            return -1;
+        if (idc != 3)
+            read_ue(br); /* abs_diff_pic_num_minus1 or long_term_pic_num */
+    } while (idc != 3);
+
+    return 0; /* Success */
+}
+
+/* A short read shows up as a failed slice_qp_delta later on */
+static void h264_skip_pred_weight_table(BitReader *br, int chromaArrayType, int l0, int l1)
+{
+    read_ue(br); /* luma_log2_weight_denom */
+    if (chromaArrayType != 0)
+        read_ue(br); /* chroma_log2_weight_denom */
+
+    for (int list = 0; list < 2; list++) {
+        for (int i = 0; i < (list == 0 ? l0 : l1); i++) {
+            if (read_bit(br) == 1) { /* luma_weight_flag */
+                read_se(br);
+                read_se(br);
+            }
+            if (chromaArrayType != 0 && read_bit(br) == 1) { /* chroma_weight_flag */
+                for (int j = 0; j < 4; j++)
+                    read_se(br);
+            }
+        }
+    }
+}
+
+static int h264_skip_dec_ref_pic_marking(BitReader *br, int idr)
+{
+    if (idr) {
+        read_bits(br, 2); /* no_output_of_prior_pics_flag, long_term_reference_flag */
+        return 0;
+    }
+    if (read_bit(br) != 1) /* adaptive_ref_pic_marking_mode_flag */
+        return 0;
+
+    int mmco;
+    do {
+        mmco = read_ue(br); /* memory_management_control_operation */
+        if (mmco < 0 || mmco > 6)
+            return -1;
+        if (mmco == 1 || mmco == 3)
+            read_ue(br); /* difference_of_pic_nums_minus1 */
+        if (mmco == 2)
+            read_ue(br); /* long_term_pic_num */
+        if (mmco == 3 || mmco == 6)
+            read_ue(br); /* long_term_frame_idx */
+        if (mmco == 4)
+            read_ue(br); /* max_long_term_frame_idx_plus1 */
+    } while (mmco != 0);
+
+    return 0; /* Success */
+}
+
+/* 8.2.1.1 and 8.2.1.3. Type 1 needs the offset cycle, which isn't cached, so it's reported as INT_MIN. */
+static int h264_decode_poc(struct h264_params_s *p, const struct h264_sps_s *sps, struct h264_slice_header_s *sh, int nal_ref_idc)
+{
+    if (sps->pic_order_cnt_type == 0) {
+        int maxLsb = 1 << sps->log2_max_pic_order_cnt_lsb;
+        if (sh->idr) {
+            p->prevPicOrderCntMsb = 0;
+            p->prevPicOrderCntLsb = 0;
+        }
+
+        int msb = p->prevPicOrderCntMsb;
+        if (sh->pic_order_cnt_lsb < p->prevPicOrderCntLsb && (p->prevPicOrderCntLsb - sh->pic_order_cnt_lsb) >= maxLsb / 2) {
+            msb += maxLsb;
+        } else
+        if (sh->pic_order_cnt_lsb > p->prevPicOrderCntLsb && (sh->pic_order_cnt_lsb - p->prevPicOrderCntLsb) > maxLsb / 2) {
+            msb -= maxLsb;
+        }
+
+        if (nal_ref_idc) {
+            p->prevPicOrderCntMsb = msb;
+            p->prevPicOrderCntLsb = sh->pic_order_cnt_lsb;
+        }
+        return msb + sh->pic_order_cnt_lsb;
+    } else
+    if (sps->pic_order_cnt_type == 2) {
+        /* Output order is decode order, frame_num is as good as a full FrameNumOffset here */
+        if (sh->idr)
+            return 0;
+        return (2 * sh->frame_num) - (nal_ref_idc ? 0 : 1);
+    }
+
+    return INT_MIN;
+}
+
+/**
+ * @brief         Parse a slice header against the cached parameter sets.
+ * @param[in]     const uint8_t *buf, int lengthBytes - The slice nal, from the byte after its nal header byte.
+ * @param[in]     int nalType, int nal_ref_idc - From the nal header byte.
+ * @param[out]    struct h264_slice_header_s *sh
+ * @return          0 - Success, every field of sh is valid
+ * @return        < 0 - Malformed, or its parameter sets haven't been seen yet.
+ *                      first_mb_in_slice and slice_type are still valid when >= 0.
+ */
+static int h264_params_slice_header(struct h264_params_s *p, const uint8_t *buf, int lengthBytes,
+    int nalType, int nal_ref_idc, struct h264_slice_header_s *sh)
+{
+    BitReader br;
+    init_bitreader_rbsp(&br, buf, lengthBytes);
+
+    sh->first_mb_in_slice = read_ue(&br);
+    sh->slice_type = read_ue(&br);
+    sh->pps_id = read_ue(&br);
+    sh->pic_order_cnt = INT_MIN;
+    sh->qp = 0;
+    if (sh->slice_type < 0 || sh->slice_type > 9 || sh->pps_id < 0 || sh->pps_id >= H264_MAX_PPS)
+        return -1;
+
+    const struct h264_pps_s *pps = &p->pps[sh->pps_id];
+    if (!pps->valid || !p->sps[pps->sps_id].valid)
+        return -1;
+    const struct h264_sps_s *sps = &p->sps[pps->sps_id];
+
+    int type = sh->slice_type % 5;
+    int isB = type == 1;
+    int isI = type == 2 || type == 4;
+    sh->idr = nalType == 5;
+
+    if (sps->separate_colour_plane_flag)
+        read_bits(&br, 2); /* colour_plane_id */
+    sh->frame_num = read_bits(&br, sps->log2_max_frame_num);
+
+    sh->field_pic_flag = 0;
+    sh->bottom_field_flag = 0;
+    if (!sps->frame_mbs_only_flag) {
+        sh->field_pic_flag = read_bit(&br);
+        if (sh->field_pic_flag == 1)
+            sh->bottom_field_flag = read_bit(&br);
+    }
+    if (sh->idr)
+        read_ue(&br); /* idr_pic_id */
+
+    sh->pic_order_cnt_lsb = 0;
+    if (sps->pic_order_cnt_type == 0) {
+        sh->pic_order_cnt_lsb = read_bits(&br, sps->log2_max_pic_order_cnt_lsb);
+        if (pps->bottom_field_pic_order_in_frame_present_flag && !sh->field_pic_flag)
+            read_se(&br); /* delta_pic_order_cnt_bottom */
+    }
+    if (sps->pic_order_cnt_type == 1 && !sps->delta_pic_order_always_zero_flag) {
+        read_se(&br); /* delta_pic_order_cnt[0] */
+        if (pps->bottom_field_pic_order_in_frame_present_flag && !sh->field_pic_flag)
+            read_se(&br); /* delta_pic_order_cnt[1] */
+    }
+    if (pps->redundant_pic_cnt_present_flag)
+        read_ue(&br); /* redundant_pic_cnt */
+    if (isB)
+        read_bit(&br); /* direct_spatial_mv_pred_flag */
+
+    sh->num_ref_idx_l0_active = pps->num_ref_idx_l0_default_active;
+    sh->num_ref_idx_l1_active = pps->num_ref_idx_l1_default_active;
+    if (!isI && read_bit(&br) == 1) { /* num_ref_idx_active_override_flag */
+        sh->num_ref_idx_l0_active = read_ue(&br) + 1;
+        if (isB)
+            sh->num_ref_idx_l1_active = read_ue(&br) + 1;
+    }
+    if (sh->num_ref_idx_l0_active <= 0 || sh->num_ref_idx_l0_active > 32 ||
+        sh->num_ref_idx_l1_active <= 0 || sh->num_ref_idx_l1_active > 32)
+    {
+        return -1;
+    }
+    if (isI) {
+        sh->num_ref_idx_l0_active = 0;
+    }
+    if (!isB) {
+        sh->num_ref_idx_l1_active = 0;
+    }
+
+    if (!isI && h264_skip_ref_pic_list_modification(&br) < 0)
+        return -1;
+    if (isB && h264_skip_ref_pic_list_modification(&br) < 0)
+        return -1;
+
+    if ((pps->weighted_pred_flag == 1 && (type == 0 || type == 3)) || (pps->weighted_bipred_idc == 1 && isB)) {
+        int chromaArrayType = sps->separate_colour_plane_flag ? 0 : sps->chroma_format_idc;
+        h264_skip_pred_weight_table(&br, chromaArrayType, sh->num_ref_idx_l0_active, sh->num_ref_idx_l1_active);
+    }
+
+    if (nal_ref_idc && h264_skip_dec_ref_pic_marking(&br, sh->idr) < 0)
+        return -1;
+
+    if (pps->entropy_coding_mode_flag == 1 && !isI)
+        read_ue(&br); /* cabac_init_idc */
+
+    int qp_delta = read_se(&br);
+    if (qp_delta == INT_MIN)
+        return -1;
+    sh->qp = pps->pic_init_qp + qp_delta;
+    if (sh->qp < -12 || sh->qp > 51) /* Lower bound is -QpBdOffsetY, 14 bit video */
+        return -1;
+    sh->header_bytes = bitreader_offset(&br, buf);
+
+    /* Once per picture, from its first slice */
+    if (sh->first_mb_in_slice == 0)
+        sh->pic_order_cnt = h264_decode_poc(p, sps, sh, nal_ref_idc);
+
+    return 0; /* Success */
+}
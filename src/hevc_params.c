@@ -0,0 +1,295 @@
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+/* HEVC parameter set cache and slice segment header parser, the counterpart of h264_params.c.
+ * Parameter sets are kept by id and only re-parsed when their bytes change. Only the fields
+ * needed to reach slice_type and slice_pic_order_cnt_lsb are kept; anything further into the
+ * slice header needs the reference picture sets, which aren't worth their cost here.
+ *
+ * The VPS carries nothing the slice header depends on and is ignored.
+ *
+ * Syntax from ITU-T H.265 (02/2018) sections 7.3.1.2, 7.3.2.2, 7.3.2.3 and 7.3.6.1.
+ * Requires bitreader.c and h264_params.c.
+ */
+#define HEVC_MAX_SPS 16
+#define HEVC_MAX_PPS 64
+#define HEVC_PARAMS_MAX_BYTES 256 /* Larger parameter sets are re-parsed every time */
+
+/* nal_unit_type, table 7-1 */
+#define HEVC_NAL_BLA_W_LP    16
+#define HEVC_NAL_IDR_W_RADL  19
+#define HEVC_NAL_IDR_N_LP    20
+#define HEVC_NAL_RSV_IRAP_23 23
+#define HEVC_NAL_SPS         33
+#define HEVC_NAL_PPS         34
+
+#define HEVC_NAL_IS_VCL(t)   ((t) < 32)
+#define HEVC_NAL_IS_IRAP(t)  ((t) >= HEVC_NAL_BLA_W_LP && (t) <= HEVC_NAL_RSV_IRAP_23)
+
+struct hevc_sps_s
+{
+    int valid;
+    int separate_colour_plane_flag;
+    int width;
+    int height;
+    int log2_max_pic_order_cnt_lsb;
+    int slice_segment_address_bits; /* Ceil(Log2(PicSizeInCtbsY)) */
+
+    int lengthBytes;
+    uint8_t bytes[HEVC_PARAMS_MAX_BYTES];
+};
+
+struct hevc_pps_s
+{
+    int valid;
+    int sps_id;
+    int dependent_slice_segments_enabled_flag;
+    int output_flag_present_flag;
+    int num_extra_slice_header_bits;
+    int init_qp;
+
+    int lengthBytes;
+    uint8_t bytes[HEVC_PARAMS_MAX_BYTES];
+};
+
+struct hevc_params_s
+{
+    struct hevc_sps_s sps[HEVC_MAX_SPS];
+    struct hevc_pps_s pps[HEVC_MAX_PPS];
+
+    int lastSliceType;       /* Of the last independent slice segment, dependent segments inherit it */
+
+    /* Lifetime counters */
+    uint64_t parses;
+    uint64_t repeats;
+};
+
+/* slice_type, table 7-7 */
+#define HEVC_SLICE_B 0
+#define HEVC_SLICE_P 1
+#define HEVC_SLICE_I 2
+
+struct hevc_slice_header_s
+{
+    int first_slice_segment_in_pic_flag;
+    int dependent_slice_segment_flag;
+    int pps_id;
+    int slice_type;          /* HEVC_SLICE_B/P/I */
+    int irap;                /* Boolean. IDR, CRA or BLA */
+    int pic_order_cnt_lsb;   /* 0 for IDR pictures */
+    int header_bytes;        /* Of buf consumed through pic_order_cnt_lsb (the segment address when dependent) */
+};
+
+static void hevc_params_reset(struct hevc_params_s *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->lastSliceType = -1;
+}
+
+/* 7.3.3, profile_tier_level(1, maxNumSubLayersMinus1) */
+static void hevc_skip_profile_tier_level(BitReader *br, int maxNumSubLayersMinus1)
+{
+    int profilePresent[8] = { 0 }, levelPresent[8] = { 0 };
+
+    /* general profile space, tier, idc, compatibility flags, constraint flags, level */
+    read_bits(br, 8);
+    read_bits(br, 32);
+    read_bits(br, 32);
+    read_bits(br, 16);
+    read_bits(br, 8);
+
+    for (int i = 0; i < maxNumSubLayersMinus1; i++) {
+        profilePresent[i] = read_bit(br) == 1;
+        levelPresent[i] = read_bit(br) == 1;
+    }
+    if (maxNumSubLayersMinus1 > 0) {
+        for (int i = maxNumSubLayersMinus1; i < 8; i++)
+            read_bits(br, 2); /* reserved_zero_2bits */
+    }
+    for (int i = 0; i < maxNumSubLayersMinus1; i++) {
+        if (profilePresent[i]) {
+            read_bits(br, 8);
+            read_bits(br, 32);
+            read_bits(br, 32);
+            read_bits(br, 16);
+        }
+        if (levelPresent[i])
+            read_bits(br, 8);
+    }
+}
+
+/**
+ * @brief         Update the cache from a SPS nal.
+ * @param[in]     const uint8_t *buf, int lengthBytes - The nal, after its two byte nal header.
+ * @return          0 - Success, parsed or unchanged
+ * @return        < 0 - Malformed or unsupported
+ */
+static int hevc_params_sps(struct hevc_params_s *p, const uint8_t *buf, int lengthBytes)
+{
+    BitReader br;
+    init_bitreader_rbsp(&br, buf, lengthBytes);
+
+    read_bits(&br, 4); /* sps_video_parameter_set_id */
+    int maxSubLayersMinus1 = read_bits(&br, 3);
+    if (maxSubLayersMinus1 > 6)
+        return -1;
+    read_bit(&br); /* sps_temporal_id_nesting_flag */
+    hevc_skip_profile_tier_level(&br, maxSubLayersMinus1);
+
+    int id = read_ue(&br);
+    if (id < 0 || id >= HEVC_MAX_SPS)
+        return -1;
+
+    struct hevc_sps_s *sps = &p->sps[id];
+    if (h264_params_same(&sps->lengthBytes, sps->bytes, HEVC_PARAMS_MAX_BYTES, buf, lengthBytes) && sps->valid) {
+        p->repeats++;
+        return 0; /* Success */
+    }
+    sps->valid = 0;
+    p->parses++;
+
+    int chroma_format_idc = read_ue(&br);
+    sps->separate_colour_plane_flag = 0;
+    if (chroma_format_idc == 3)
+        sps->separate_colour_plane_flag = read_bit(&br);
+    sps->width = read_ue(&br);
+    sps->height = read_ue(&br);
+    if (read_bit(&br) == 1) { /* conformance_window_flag */
+        for (int i = 0; i < 4; i++)
+            read_ue(&br);
+    }
+    read_ue(&br); /* bit_depth_luma_minus8 */
+    read_ue(&br); /* bit_depth_chroma_minus8 */
+
+    int v = read_ue(&br);
+    if (v < 0 || v > 12)
+        return -1;
+    sps->log2_max_pic_order_cnt_lsb = v + 4;
+
+    int orderingInfo = read_bit(&br); /* sps_sub_layer_ordering_info_present_flag */
+    for (int i = orderingInfo ? 0 : maxSubLayersMinus1; i <= maxSubLayersMinus1; i++) {
+        read_ue(&br); /* sps_max_dec_pic_buffering_minus1 */
+        read_ue(&br); /* sps_max_num_reorder_pics */
+        read_ue(&br); /* sps_max_latency_increase_plus1 */
+    }
+
+    int log2MinCb = read_ue(&br) + 3;
+    int log2Ctb = log2MinCb + read_ue(&br);
+    if (log2MinCb < 3 || log2Ctb < 4 || log2Ctb > 6 || sps->width <= 0 || sps->height <= 0)
+        return -1;
+
+    int ctbSize = 1 << log2Ctb;
+    int picSizeInCtbs = ((sps->width + ctbSize - 1) >> log2Ctb) * ((sps->height + ctbSize - 1) >> log2Ctb);
+    sps->slice_segment_address_bits = 0;
+    while ((1 << sps->slice_segment_address_bits) < picSizeInCtbs)
+        sps->slice_segment_address_bits++;
+
+    sps->valid = 1;
+    return 0; /* Success */
+}
+
+/**
+ * @brief         Update the cache from a PPS nal.
+ * @param[in]     const uint8_t *buf, int lengthBytes - The nal, after its two byte nal header.
+ * @return          0 - Success, parsed or unchanged
+ * @return        < 0 - Malformed
+ */
+static int hevc_params_pps(struct hevc_params_s *p, const uint8_t *buf, int lengthBytes)
+{
+    BitReader br;
+    init_bitreader_rbsp(&br, buf, lengthBytes);
+
+    int id = read_ue(&br);
+    if (id < 0 || id >= HEVC_MAX_PPS)
+        return -1;
+
+    struct hevc_pps_s *pps = &p->pps[id];
+    if (h264_params_same(&pps->lengthBytes, pps->bytes, HEVC_PARAMS_MAX_BYTES, buf, lengthBytes) && pps->valid) {
+        p->repeats++;
+        return 0; /* Success */
+    }
+    pps->valid = 0;
+    p->parses++;
+
+    pps->sps_id = read_ue(&br);
+    if (pps->sps_id < 0 || pps->sps_id >= HEVC_MAX_SPS)
+        return -1;
+    pps->dependent_slice_segments_enabled_flag = read_bit(&br);
+    pps->output_flag_present_flag = read_bit(&br);
+    pps->num_extra_slice_header_bits = read_bits(&br, 3);
+    read_bit(&br); /* sign_data_hiding_enabled_flag */
+    read_bit(&br); /* cabac_init_present_flag */
+    read_ue(&br); /* num_ref_idx_l0_default_active_minus1 */
+    read_ue(&br); /* num_ref_idx_l1_default_active_minus1 */
+    int qp = read_se(&br);
+    if (qp == INT_MIN || pps->num_extra_slice_header_bits < 0)
+        return -1;
+    pps->init_qp = 26 + qp;
+
+    pps->valid = 1;
+    return 0; /* Success */
+}
+
+/**
+ * @brief         Parse the start of a slice segment header against the cached parameter sets.
+ * @param[in]     const uint8_t *buf, int lengthBytes - The slice nal, after its two byte nal header.
+ * @param[in]     int nalType - From the nal header.
+ * @param[out]    struct hevc_slice_header_s *sh
+ * @return          0 - Success, every field of sh is valid
+ * @return        < 0 - Malformed, or its parameter sets haven't been seen yet. irap is still valid.
+ */
+static int hevc_params_slice_header(struct hevc_params_s *p, const uint8_t *buf, int lengthBytes,
+    int nalType, struct hevc_slice_header_s *sh)
+{
+    BitReader br;
+    init_bitreader_rbsp(&br, buf, lengthBytes);
+
+    sh->irap = HEVC_NAL_IS_IRAP(nalType);
+    sh->slice_type = -1;
+    sh->pic_order_cnt_lsb = 0;
+    sh->dependent_slice_segment_flag = 0;
+
+    sh->first_slice_segment_in_pic_flag = read_bit(&br);
+    if (sh->irap)
+        read_bit(&br); /* no_output_of_prior_pics_flag */
+    sh->pps_id = read_ue(&br);
+    if (sh->first_slice_segment_in_pic_flag < 0 || sh->pps_id < 0 || sh->pps_id >= HEVC_MAX_PPS)
+        return -1;
+
+    const struct hevc_pps_s *pps = &p->pps[sh->pps_id];
+    if (!pps->valid || !p->sps[pps->sps_id].valid)
+        return -1;
+    const struct hevc_sps_s *sps = &p->sps[pps->sps_id];
+
+    if (!sh->first_slice_segment_in_pic_flag) {
+        if (pps->dependent_slice_segments_enabled_flag)
+            sh->dependent_slice_segment_flag = read_bit(&br);
+        read_bits(&br, sps->slice_segment_address_bits); /* slice_segment_address */
+    }
+    if (sh->dependent_slice_segment_flag) {
+        /* Everything else comes from the independent segment before it */
+        sh->slice_type = p->lastSliceType;
+        sh->header_bytes = bitreader_offset(&br, buf);
+        return sh->slice_type < 0 ? -1 : 0;
+    }
+
+    read_bits(&br, pps->num_extra_slice_header_bits); /* slice_reserved_flag[] */
+    sh->slice_type = read_ue(&br);
+    if (sh->slice_type < 0 || sh->slice_type > 2)
+        return -1;
+    p->lastSliceType = sh->slice_type;
+
+    if (pps->output_flag_present_flag)
+        read_bit(&br); /* pic_output_flag */
+    if (sps->separate_colour_plane_flag)
+        read_bits(&br, 2); /* colour_plane_id */
+    if (nalType != HEVC_NAL_IDR_W_RADL && nalType != HEVC_NAL_IDR_N_LP) {
+        sh->pic_order_cnt_lsb = read_bits(&br, sps->log2_max_pic_order_cnt_lsb);
+        if (sh->pic_order_cnt_lsb == (int)0xFFFFFFFF)
+            return -1;
+    }
+    sh->header_bytes = bitreader_offset(&br, buf);
+
+    return 0; /* Success */
+}
@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/pixdesc.h>
+
+/* Keyframe decode for pixel level features. Services hand their intra coded pictures to a
+ * small pool of decode threads, nothing else is ever decoded. The decoder skips the loop
+ * filter, uses lowres output when the codec supports it (H.264 and HEVC don't, so there the
+ * luma plane is point sampled onto a grid of at most KEYFRAME_GRID_W x KEYFRAME_GRID_H) and
+ * is drained after every picture so nothing waits on reordering.
+ *
+ * Work is shed, never queued up: a service has at most one picture in flight, each service may
+ * spend budgetPct of one core (decode thread CPU time), and the queue holds one picture per
+ * thread. On linux the decode threads run SCHED_IDLE, so when the cores are busy with anything
+ * else they stall, the queue fills and keyframes are skipped rather than delaying analysis.
+ *
+ * Replays run many times faster than real time and would shed nearly everything, differently
+ * from run to run. A blocking pool sheds nothing instead, the service waits for the decoder
+ * and every intra picture is decoded within the period it arrived in.
+ */
+#define KEYFRAME_GRID_W 160
+#define KEYFRAME_GRID_H 90
+#define KEYFRAME_HIST_BINS 8         /* Of 32 luma levels each */
+#define KEYFRAME_BLACK_LEVEL 32      /* 8 bit luma at or below this is black, limited or full range */
+#define KEYFRAME_BURST_NS 250000000LL /* Budget a quiet service can bank */
+
+/* Colour bars, SMPTE or EBU, are seven flat bands of falling luma across the top of the picture */
+#define KEYFRAME_BARS 7
+#define KEYFRAME_BAR_FLATNESS 10     /* Largest luma range within a band */
+#define KEYFRAME_BAR_STEP 12         /* Smallest luma drop from one band to the next */
+
+/* Features accumulated between keyframe_take() calls */
+struct keyframe_features_s
+{
+    unsigned int decoded;
+    unsigned int shedBudget;     /* Not decoded, the service was over budget */
+    unsigned int shedBusy;       /* Not decoded, its previous picture or every decode thread was still busy */
+    unsigned int errors;         /* Decoded nothing, or a pixel format without luma */
+    uint64_t cpuNs;
+    double lumaSum;
+    double histSum[KEYFRAME_HIST_BINS];
+    double blackSum;
+    double diffSum;
+    unsigned int diffCount;      /* Pictures with a previous grid of the same size to compare with */
+    unsigned int bars;
+};
+
+struct keyframe_pool_s;
+
+/* One per service */
+struct keyframe_stream_s
+{
+    struct keyframe_pool_s *pool;
+
+    /* Service thread only */
+    int64_t creditNs;            /* Decode time the service may still spend */
+    uint64_t lastNs;             /* Of the last submit, monotonic */
+
+    /* Written by the service thread while idle, read by a decode thread while busy */
+    _Atomic int busy;
+    uint8_t *buf;                /* The picture, padded for the decoder */
+    int bufSize;
+    int len;
+
+    /* Decode thread, one at a time */
+    AVCodecContext *avctx;
+    AVPacket *pkt;
+    AVFrame *frame;
+    uint8_t grid[KEYFRAME_GRID_W * KEYFRAME_GRID_H]; /* Luma samples of the last picture decoded */
+    int gridW;
+    int gridH;
+
+    _Atomic uint64_t spentNs;    /* Decode CPU time the service thread hasn't charged yet */
+
+    pthread_mutex_t mutex;       /* Protects acc */
+    struct keyframe_features_s acc;
+};
+
+struct keyframe_pool_s
+{
+    int budgetPct;               /* Of one core, per service */
+    int block;                   /* Boolean. Wait for the decoder instead of shedding, no budget */
+
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;      /* A picture was taken off the queue or finished */
+    pthread_t *threadIds;
+    int threadCount;
+    int running;                 /* Protected by mutex */
+
+    struct keyframe_stream_s **queue;
+    int capacity;
+    int head;
+    int count;
+};
+
+static uint64_t keyframe_clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* Seven flat bands, each darker than the last, over the top 60% of the grid */
+static int keyframe_colour_bars(const uint8_t *grid, int gw, int gh)
+{
+    int rows = (gh * 6) / 10;
+    int margin = gw / (KEYFRAME_BARS * 5); /* Stay clear of the band edges */
+    if (rows < 2 || margin < 1)
+        return 0;
+
+    int prev = 0;
+    for (int b = 0; b < KEYFRAME_BARS; b++) {
+        int x0 = ((b * gw) / KEYFRAME_BARS) + margin;
+        int x1 = (((b + 1) * gw) / KEYFRAME_BARS) - margin;
+        int lo = 255, hi = 0, sum = 0;
+        for (int y = 0; y < rows; y++) {
+            const uint8_t *row = grid + (y * gw);
+            for (int x = x0; x < x1; x++) {
+                if (row[x] < lo)
+                    lo = row[x];
+                if (row[x] > hi)
+                    hi = row[x];
+                sum += row[x];
+            }
+        }
+        int range = hi - lo;
+        int mean = sum / (rows * (x1 - x0));
+        if (range > KEYFRAME_BAR_FLATNESS)
+            return 0;
+        /* A smooth horizontal gradient has flat looking bands too, but steps barely larger than their range */
+        if (b && (prev - mean < KEYFRAME_BAR_STEP || prev - mean < 2 * range))
+            return 0;
+        prev = mean;
+    }
+    return 1;
+}
+
+/* Sample the luma plane onto the grid and measure it, acc is locked by the caller */
+static int keyframe_measure(struct keyframe_stream_s *kf, const AVFrame *frame, struct keyframe_features_s *acc)
+{
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(frame->format);
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_HWACCEL)) || frame->width < 1 || frame->height < 1)
+        return -1;
+
+    int depth = desc->comp[0].depth;
+    int stepX = (frame->width + KEYFRAME_GRID_W - 1) / KEYFRAME_GRID_W;
+    int stepY = (frame->height + KEYFRAME_GRID_H - 1) / KEYFRAME_GRID_H;
+    int gw = frame->width / stepX;
+    int gh = frame->height / stepY;
+
+    uint8_t grid[KEYFRAME_GRID_W * KEYFRAME_GRID_H];
+    unsigned int hist[KEYFRAME_HIST_BINS] = { 0 };
+    unsigned int black = 0;
+    uint64_t sum = 0;
+
+    for (int y = 0; y < gh; y++) {
+        const uint8_t *row = frame->data[0] + ((y * stepY) + (stepY / 2)) * frame->linesize[0];
+        uint8_t *out = grid + (y * gw);
+        for (int x = 0; x < gw; x++) {
+            int px = (x * stepX) + (stepX / 2);
+            int v = depth > 8 ? ((const uint16_t *)row)[px] >> (depth - 8) : row[px];
+            if (v > 255)
+                v = 255;
+            out[x] = v;
+            hist[v >> 5]++;
+            black += v <= KEYFRAME_BLACK_LEVEL;
+            sum += v;
+        }
+    }
+
+    int n = gw * gh;
+    acc->lumaSum += (double)sum / n;
+    for (int i = 0; i < KEYFRAME_HIST_BINS; i++)
+        acc->histSum[i] += (double)hist[i] / n;
+    acc->blackSum += (double)black / n;
+    acc->bars += keyframe_colour_bars(grid, gw, gh);
+
+    if (kf->gridW == gw && kf->gridH == gh) {
+        uint64_t diff = 0;
+        for (int i = 0; i < n; i++)
+            diff += abs(grid[i] - kf->grid[i]);
+        acc->diffSum += (double)diff / (n * 255.0);
+        acc->diffCount++;
+    }
+    memcpy(kf->grid, grid, n);
+    kf->gridW = gw;
+    kf->gridH = gh;
+
+    return 0; /* Success */
+}
+
+/* Decode thread. The decoder is drained after the picture, then flushed so it accepts the next
+ * one, parameter sets survive the flush.
+ */
+static void keyframe_decode(struct keyframe_stream_s *kf)
+{
+    uint64_t t0 = keyframe_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    int got = 0, measured = -1;
+
+    kf->pkt->data = kf->buf;
+    kf->pkt->size = kf->len;
+    if (avcodec_send_packet(kf->avctx, kf->pkt) >= 0) {
+        avcodec_send_packet(kf->avctx, NULL);
+        while (avcodec_receive_frame(kf->avctx, kf->frame) == 0) {
+            if (!got++) {
+                pthread_mutex_lock(&kf->mutex);
+                measured = keyframe_measure(kf, kf->frame, &kf->acc);
+                pthread_mutex_unlock(&kf->mutex);
+            }
+            av_frame_unref(kf->frame);
+        }
+    }
+    avcodec_flush_buffers(kf->avctx);
+    kf->pkt->data = NULL;
+    kf->pkt->size = 0;
+
+    uint64_t ns = keyframe_clock_ns(CLOCK_THREAD_CPUTIME_ID) - t0;
+    atomic_fetch_add_explicit(&kf->spentNs, ns, memory_order_relaxed);
+
+    pthread_mutex_lock(&kf->mutex);
+    if (measured == 0) {
+        kf->acc.decoded++;
+    } else {
+        kf->acc.errors++;
+    }
+    kf->acc.cpuNs += ns;
+    pthread_mutex_unlock(&kf->mutex);
+}
+
+static void *keyframe_thread_func(void *p)
+{
+    struct keyframe_pool_s *pool = (struct keyframe_pool_s *)p;
+
+#if defined(__linux__)
+    /* Only idle CPU, decoding must never compete with packet analysis */
+    struct sched_param sp = { 0 };
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &sp);
+#endif
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (pool->count == 0 && pool->running)
+            pthread_cond_wait(&pool->notEmpty, &pool->mutex);
+        if (pool->count == 0)
+            break; /* Stopped and drained */
+
+        struct keyframe_stream_s *kf = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->capacity;
+        pool->count--;
+        pthread_mutex_unlock(&pool->mutex);
+
+        keyframe_decode(kf);
+        atomic_store_explicit(&kf->busy, 0, memory_order_release);
+
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_broadcast(&pool->notFull);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+/**
+ * @brief         Start the decode threads.
+ * @param[out]    struct keyframe_pool_s **handle - new pool
+ * @param[in]     int threads - Decode threads, also the number of pictures that can wait for one.
+ * @param[in]     int budgetPct - CPU each service may use, percent of one core.
+ * @param[in]     int block - Boolean. Services wait for the decoder rather than shed, for replays.
+ * @return          0 - Success
+ * @return        < 0 - Error
+ */
+static int keyframe_pool_alloc(struct keyframe_pool_s **handle, int threads, int budgetPct, int block)
+{
+    struct keyframe_pool_s *pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return -1;
+
+    pool->budgetPct = budgetPct;
+    pool->block = block;
+    pool->capacity = threads < 1 ? 1 : threads;
+    pool->queue = calloc(pool->capacity, sizeof(struct keyframe_stream_s *));
+    pool->threadIds = calloc(pool->capacity, sizeof(pthread_t));
+    if (!pool->queue || !pool->threadIds) {
+        free(pool->queue);
+        free(pool->threadIds);
+        free(pool);
+        return -1;
+    }
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->notEmpty, NULL);
+    pthread_cond_init(&pool->notFull, NULL);
+    pool->running = 1;
+
+    for (int i = 0; i < pool->capacity; i++) {
+        if (pthread_create(&pool->threadIds[i], NULL, keyframe_thread_func, pool) != 0)
+            break;
+        pool->threadCount++;
+    }
+    if (pool->threadCount == 0) {
+        pthread_mutex_destroy(&pool->mutex);
+        pthread_cond_destroy(&pool->notEmpty);
+        pthread_cond_destroy(&pool->notFull);
+        free(pool->queue);
+        free(pool->threadIds);
+        free(pool);
+        return -1;
+    }
+
+    *handle = pool;
+    return 0; /* Success */
+}
+
+/* Decode whatever is queued, then stop the threads */
+static void keyframe_pool_free(struct keyframe_pool_s *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->running = 0;
+    pthread_cond_broadcast(&pool->notEmpty);
+    pthread_cond_broadcast(&pool->notFull);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->threadCount; i++)
+        pthread_join(pool->threadIds[i], NULL);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->notEmpty);
+    pthread_cond_destroy(&pool->notFull);
+    free(pool->queue);
+    free(pool->threadIds);
+    free(pool);
+}
+
+/* Blocking pools, wait for the services picture in flight to finish */
+static void keyframe_wait(struct keyframe_stream_s *kf)
+{
+    struct keyframe_pool_s *pool = kf->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (atomic_load_explicit(&kf->busy, memory_order_acquire) && pool->running)
+        pthread_cond_wait(&pool->notFull, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void keyframe_stream_free(struct keyframe_stream_s *kf)
+{
+    /* Wait for a picture in flight, the pool always finishes what it took */
+    while (atomic_load_explicit(&kf->busy, memory_order_acquire))
+        usleep(1000);
+
+    avcodec_free_context(&kf->avctx);
+    av_packet_free(&kf->pkt);
+    av_frame_free(&kf->frame);
+    pthread_mutex_destroy(&kf->mutex);
+    free(kf->buf);
+    free(kf);
+}
+
+/**
+ * @brief         Open a keyframe decoder for one service.
+ * @param[in]     enum AVCodecID codecId - AV_CODEC_ID_H264 or AV_CODEC_ID_HEVC
+ * @return          0 - Success
+ * @return        < 0 - Error, libavcodec lacks the decoder
+ */
+static int keyframe_stream_alloc(struct keyframe_pool_s *pool, struct keyframe_stream_s **handle, enum AVCodecID codecId)
+{
+    const AVCodec *codec = avcodec_find_decoder(codecId);
+    if (!codec)
+        return -1;
+
+    struct keyframe_stream_s *kf = calloc(1, sizeof(*kf));
+    if (!kf)
+        return -1;
+    kf->pool = pool;
+    pthread_mutex_init(&kf->mutex, NULL);
+
+    kf->avctx = avcodec_alloc_context3(codec);
+    kf->pkt = av_packet_alloc();
+    kf->frame = av_frame_alloc();
+    if (!kf->avctx || !kf->pkt || !kf->frame) {
+        keyframe_stream_free(kf);
+        return -1;
+    }
+
+    kf->avctx->thread_count = 1;                    /* The pool is the parallelism, and budgets are per thread CPU time */
+    kf->avctx->skip_frame = AVDISCARD_NONINTRA;     /* Only intra pictures are submitted, this keeps it that way */
+    kf->avctx->skip_loop_filter = AVDISCARD_ALL;
+    kf->avctx->flags2 |= AV_CODEC_FLAG2_FAST | AV_CODEC_FLAG2_SHOW_ALL; /* Output I pictures that aren't IDRs too */
+    kf->avctx->lowres = codec->max_lowres < 2 ? codec->max_lowres : 2;
+
+    if (avcodec_open2(kf->avctx, codec, NULL) < 0) {
+        keyframe_stream_free(kf);
+        return -1;
+    }
+
+    *handle = kf;
+    return 0; /* Success */
+}
+
+/**
+ * @brief         Offer an intra coded picture for decoding. Service thread only.
+ * @param[in]     const uint8_t *data, int len - One access unit of elementary stream, copied.
+ * @return          0 - Queued
+ * @return        < 0 - Shed, counted in the features
+ */
+static int keyframe_submit(struct keyframe_stream_s *kf, const uint8_t *data, int len)
+{
+    struct keyframe_pool_s *pool = kf->pool;
+
+    if (pool->block)
+        keyframe_wait(kf);
+
+    /* Budget accrues with walltime and is charged for the CPU the decodes actually took */
+    uint64_t now = keyframe_clock_ns(CLOCK_MONOTONIC);
+    if (kf->lastNs)
+        kf->creditNs += ((int64_t)(now - kf->lastNs) * pool->budgetPct) / 100;
+    kf->lastNs = now;
+    kf->creditNs -= atomic_exchange_explicit(&kf->spentNs, 0, memory_order_relaxed);
+    if (kf->creditNs > KEYFRAME_BURST_NS)
+        kf->creditNs = KEYFRAME_BURST_NS;
+
+    int shed = 0;
+    if (kf->creditNs < 0 && !pool->block) {
+        shed = 1;
+    } else
+    if (atomic_load_explicit(&kf->busy, memory_order_acquire) || len <= 0) {
+        shed = 2;
+    }
+
+    if (!shed) {
+        if (kf->bufSize < len + AV_INPUT_BUFFER_PADDING_SIZE) {
+            uint8_t *buf = realloc(kf->buf, len + AV_INPUT_BUFFER_PADDING_SIZE);
+            if (!buf) {
+                shed = 2;
+            } else {
+                kf->buf = buf;
+                kf->bufSize = len + AV_INPUT_BUFFER_PADDING_SIZE;
+            }
+        }
+    }
+
+    if (!shed) {
+        memcpy(kf->buf, data, len);
+        memset(kf->buf + len, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+        kf->len = len;
+
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->block && pool->count == pool->capacity && pool->running)
+            pthread_cond_wait(&pool->notFull, &pool->mutex);
+        if (pool->count == pool->capacity || !pool->running) {
+            shed = 2;
+        } else {
+            atomic_store_explicit(&kf->busy, 1, memory_order_relaxed);
+            pool->queue[(pool->head + pool->count) % pool->capacity] = kf;
+            pool->count++;
+            pthread_cond_signal(&pool->notEmpty);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    if (!shed)
+        return 0; /* Success */
+
+    pthread_mutex_lock(&kf->mutex);
+    if (shed == 1) {
+        kf->acc.shedBudget++;
+    } else {
+        kf->acc.shedBusy++;
+    }
+    pthread_mutex_unlock(&kf->mutex);
+    return -1;
+}
+
+/* Everything accumulated since the last call, then start over */
+static void keyframe_take(struct keyframe_stream_s *kf, struct keyframe_features_s *f)
+{
+    if (kf->pool->block)
+        keyframe_wait(kf); /* Its picture belongs to this period */
+
+    pthread_mutex_lock(&kf->mutex);
+    *f = kf->acc;
+    memset(&kf->acc, 0, sizeof(kf->acc));
+    pthread_mutex_unlock(&kf->mutex);
+}
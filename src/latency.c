@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+/* Log bucketed latency histograms for the probes hot path stages, cheap enough to leave on.
+ * Bucket b counts samples in [2^(b-1), 2^b) nanoseconds, bucket 0 holds zero, the last bucket
+ * everything from ~1 second up. Recording is a clock read, a count leading zeros and an
+ * increment. Quantiles are reported as the upper edge of the bucket they fall in, clamped to
+ * the largest sample, so they overstate by less than a factor of two and never understate.
+ *
+ * A histogram is owned by the one thread that records into it.
+ */
+#define LATENCY_BUCKETS 32
+
+enum latency_stage_e
+{
+    LATENCY_READ = 0,        /* avio_read() or a ts file read, recvmmsg() waits in poll() so isn't timed */
+    LATENCY_MODEL,           /* ltntstools_streammodel_write() */
+    LATENCY_PES,             /* PES extractor or -C counter write, including the nal parsing it calls back into */
+    LATENCY_NAL,             /* Nal enumeration and slice headers of one PES */
+    LATENCY_PUBLISH,         /* Formatting a record and queueing it for the publisher */
+    LATENCY_STAGES
+};
+
+static const char *latency_stage_names[LATENCY_STAGES] = { "read", "model", "pes", "nal", "publish" };
+
+struct latency_hist_s
+{
+    uint64_t count;
+    uint64_t maxNs;
+    uint32_t buckets[LATENCY_BUCKETS];
+};
+
+/* What a record carries for each stage, nanoseconds */
+struct latency_summary_s
+{
+    unsigned int count;
+    unsigned int p50;
+    unsigned int p99;
+    unsigned int max;
+};
+
+static inline uint64_t latency_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static inline void latency_add(struct latency_hist_s *h, uint64_t ns)
+{
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (b >= LATENCY_BUCKETS)
+        b = LATENCY_BUCKETS - 1;
+    h->buckets[b]++;
+    h->count++;
+    if (ns > h->maxNs)
+        h->maxNs = ns;
+}
+
+static void latency_reset(struct latency_hist_s *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+static void latency_merge(struct latency_hist_s *dst, const struct latency_hist_s *src)
+{
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->maxNs > dst->maxNs)
+        dst->maxNs = src->maxNs;
+}
+
+static unsigned int latency_quantile(const struct latency_hist_s *h, double q)
+{
+    uint64_t rank = (uint64_t)(q * h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank) {
+            uint64_t edge = b ? (1ULL << b) - 1 : 0;
+            if (edge > h->maxNs)
+                edge = h->maxNs;
+            return edge > UINT32_MAX ? UINT32_MAX : (unsigned int)edge;
+        }
+    }
+    return h->maxNs > UINT32_MAX ? UINT32_MAX : (unsigned int)h->maxNs;
+}
+
+static void latency_summarize(const struct latency_hist_s *h, struct latency_summary_s *s)
+{
+    memset(s, 0, sizeof(*s));
+    if (h->count == 0)
+        return;
+    s->count = h->count > UINT32_MAX ? UINT32_MAX : (unsigned int)h->count;
+    s->p50 = latency_quantile(h, 0.50);
+    s->p99 = latency_quantile(h, 0.99);
+    s->max = h->maxNs > UINT32_MAX ? UINT32_MAX : (unsigned int)h->maxNs;
+}
+
+/* One line per non empty bucket, for the -v summary at exit */
+static void latency_print(FILE *fh, const char *name, const struct latency_hist_s *h)
+{
+    if (h->count == 0)
+        return;
+
+    fprintf(fh, "Latency %s: %llu samples, max %llu ns\n", name, (unsigned long long)h->count,
+        (unsigned long long)h->maxNs);
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        if (h->buckets[b] == 0)
+            continue;
+        fprintf(fh, "  < %12llu ns %10u %6.2f%%\n", b ? (unsigned long long)(1ULL << b) : 1ULL, h->buckets[b],
+            (100.0 * h->buckets[b]) / h->count);
+    }
+}
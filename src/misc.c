@@ -1,20 +1,23 @@
 /* TODO: Move this into the libltntstools once we're completely happy with it.
  * See ISO-14496-10:2004 section 7.3.1 NAL unit Syntax.
+ *
+ * Copy the nal at src into dst with every emulation prevention byte removed, in a single
+ * pass. dst must hold at least lengthBytes. Returns the number of bytes written to dst.
+ * For reading a handful of header fields prefer init_bitreader_rbsp(), it doesn't copy at all.
  */
-static void ltn_nal_h264_strip_emulation_prevention(struct ltn_nal_headers_s *h)
+int ltn_nal_h264_strip_emulation_prevention(const uint8_t *src, int lengthBytes, uint8_t *dst)
 {
-        int dropped = 0;
-        for (unsigned int i = 1; i < h->lengthBytes; i++) {
-                if (i + 2 < h->lengthBytes &&
-                        h->ptr[i + 0] == 0x00 &&
-                        h->ptr[i + 1] == 0x00 &&
-                        h->ptr[i + 2] == 0x03)
-                {
-                                /* Convert 00 00 03 to 00 00 */
-                                memcpy((unsigned char *)&h->ptr[i + 2], &h->ptr[i + 3], h->lengthBytes - i - 3);
-                                dropped++;
+        int zeros = 0;
+        int len = 0;
+        for (int i = 0; i < lengthBytes; i++) {
+                if (zeros >= 2 && src[i] == 0x03) {
+                        /* Convert 00 00 03 to 00 00 */
+                        zeros = 0;
+                        continue;
                 }
+                zeros = src[i] ? 0 : zeros + 1;
+                dst[len++] = src[i];
         }
-        h->lengthBytes -= dropped;
-}
 
+        return len;
+}
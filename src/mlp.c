@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+/* Native inference for the small dense classifiers built in training/, so a probe can score its
+ * own records without a python runtime. The weight file is written by
+ * training/uc01-export-model.py and carries the StandardScaler parameters along with each
+ * layer, in the order keras evaluates them:
+ *
+ *   uc01-mlp 1
+ *   features <n> <name> ... <name>
+ *   scaler_mean <n floats>
+ *   scaler_scale <n floats>
+ *   dense <in> <out> <relu|sigmoid|linear>
+ *   <in * out kernel floats, row major [in][out] as keras stores them>
+ *   <out bias floats>
+ *   ... further dense layers
+ *
+ * Layers are evaluated four outputs at a time with the gcc/clang vector extension, which maps
+ * onto SSE on x86 and NEON on arm without per arch code.
+ */
+#define MLP_MAX_FEATURES 32
+#define MLP_MAX_LAYERS 8
+#define MLP_MAX_WIDTH 256
+#define MLP_FEATURE_NAME_LEN 48
+
+typedef float mlp_v4f __attribute__((vector_size(16)));
+typedef int32_t mlp_v4i __attribute__((vector_size(16)));
+
+enum mlp_activation_e
+{
+    MLP_LINEAR = 0,
+    MLP_RELU,
+    MLP_SIGMOID,
+};
+
+struct mlp_layer_s
+{
+    int inputs;
+    int outputs;
+    int stride;              /* outputs rounded up to a multiple of four, padding weights are zero */
+    enum mlp_activation_e activation;
+    float *kernel;           /* [inputs][stride], 16 byte aligned */
+    float *bias;             /* [stride] */
+};
+
+struct mlp_s
+{
+    int featureCount;
+    char featureNames[MLP_MAX_FEATURES][MLP_FEATURE_NAME_LEN];
+    float mean[MLP_MAX_FEATURES];
+    float scale[MLP_MAX_FEATURES];
+
+    int layerCount;
+    struct mlp_layer_s layers[MLP_MAX_LAYERS];
+};
+
+static void mlp_free(struct mlp_s *m)
+{
+    for (int i = 0; i < m->layerCount; i++) {
+        free(m->layers[i].kernel);
+        free(m->layers[i].bias);
+    }
+    free(m);
+}
+
+static int mlp_read_floats(FILE *fh, float *dst, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (fscanf(fh, "%f", &dst[i]) != 1)
+            return -1;
+    }
+    return 0; /* Success */
+}
+
+static int mlp_load_layer(FILE *fh, struct mlp_layer_s *l, int inputs)
+{
+    char activation[16];
+    if (fscanf(fh, " dense %d %d %15s", &l->inputs, &l->outputs, activation) != 3)
+        return -1;
+    if (l->inputs != inputs || l->outputs < 1 || l->outputs > MLP_MAX_WIDTH)
+        return -1;
+
+    if (strcmp(activation, "relu") == 0) {
+        l->activation = MLP_RELU;
+    } else
+    if (strcmp(activation, "sigmoid") == 0) {
+        l->activation = MLP_SIGMOID;
+    } else
+    if (strcmp(activation, "linear") == 0) {
+        l->activation = MLP_LINEAR;
+    } else {
+        return -1;
+    }
+
+    l->stride = (l->outputs + 3) & ~3;
+    l->kernel = aligned_alloc(16, sizeof(float) * l->inputs * l->stride);
+    l->bias = aligned_alloc(16, sizeof(float) * l->stride);
+    if (!l->kernel || !l->bias)
+        return -1;
+    memset(l->kernel, 0, sizeof(float) * l->inputs * l->stride);
+    memset(l->bias, 0, sizeof(float) * l->stride);
+
+    for (int i = 0; i < l->inputs; i++) {
+        if (mlp_read_floats(fh, &l->kernel[i * l->stride], l->outputs) < 0)
+            return -1;
+    }
+    return mlp_read_floats(fh, l->bias, l->outputs);
+}
+
+/**
+ * @brief         Load a model exported by training/uc01-export-model.py
+ * @param[out]    struct mlp_s **model - new model
+ * @param[in]     const char *filename
+ * @return          0 - Success
+ * @return        < 0 - Error, the file is missing or malformed
+ */
+static int mlp_load(struct mlp_s **model, const char *filename)
+{
+    FILE *fh = fopen(filename, "r");
+    if (!fh) {
+        perror("mlp: fopen");
+        return -1;
+    }
+
+    struct mlp_s *m = calloc(1, sizeof(*m));
+    if (!m) {
+        fclose(fh);
+        return -1;
+    }
+
+    int version = 0;
+    if (fscanf(fh, " uc01-mlp %d", &version) != 1 || version != 1)
+        goto fail;
+
+    if (fscanf(fh, " features %d", &m->featureCount) != 1 ||
+        m->featureCount < 1 || m->featureCount > MLP_MAX_FEATURES)
+        goto fail;
+    for (int i = 0; i < m->featureCount; i++) {
+        if (fscanf(fh, " %47s", m->featureNames[i]) != 1)
+            goto fail;
+    }
+
+    int n = -1;
+    if (fscanf(fh, " scaler_mean%n", &n) < 0 || n < 0 || mlp_read_floats(fh, m->mean, m->featureCount) < 0)
+        goto fail;
+    n = -1;
+    if (fscanf(fh, " scaler_scale%n", &n) < 0 || n < 0 || mlp_read_floats(fh, m->scale, m->featureCount) < 0)
+        goto fail;
+    for (int i = 0; i < m->featureCount; i++) {
+        /* StandardScaler leaves the scale of a constant feature at 1, be as forgiving */
+        if (m->scale[i] == 0.0f)
+            m->scale[i] = 1.0f;
+    }
+
+    int inputs = m->featureCount;
+    while (m->layerCount < MLP_MAX_LAYERS) {
+        int c = fgetc(fh);
+        while (c == ' ' || c == '\n' || c == '\r' || c == '\t')
+            c = fgetc(fh);
+        if (c == EOF)
+            break;
+        ungetc(c, fh);
+
+        struct mlp_layer_s *l = &m->layers[m->layerCount++];
+        if (mlp_load_layer(fh, l, inputs) < 0)
+            goto fail;
+        inputs = l->outputs;
+    }
+    if (m->layerCount == 0 || inputs != 1)
+        goto fail;
+
+    fclose(fh);
+    *model = m;
+    return 0; /* Success */
+
+fail:
+    fprintf(stderr, "mlp: %s is not a valid uc01 model file\n", filename);
+    fclose(fh);
+    mlp_free(m);
+    return -1;
+}
+
+/* out[0..stride) = activation(in . kernel + bias) */
+static void mlp_dense(const struct mlp_layer_s *l, const float *in, float *out)
+{
+    mlp_v4f *o = (mlp_v4f *)out;
+    const mlp_v4f *b = (const mlp_v4f *)l->bias;
+    int lanes = l->stride / 4;
+
+    for (int j = 0; j < lanes; j++)
+        o[j] = b[j];
+
+    for (int i = 0; i < l->inputs; i++) {
+        mlp_v4f x = { in[i], in[i], in[i], in[i] };
+        const mlp_v4f *w = (const mlp_v4f *)&l->kernel[i * l->stride];
+        for (int j = 0; j < lanes; j++)
+            o[j] += x * w[j];
+    }
+
+    if (l->activation == MLP_RELU) {
+        mlp_v4f zero = { 0, 0, 0, 0 };
+        for (int j = 0; j < lanes; j++)
+            o[j] = (mlp_v4f)((mlp_v4i)o[j] & (o[j] > zero));
+    } else
+    if (l->activation == MLP_SIGMOID) {
+        for (int j = 0; j < l->outputs; j++)
+            out[j] = 1.0f / (1.0f + expf(-out[j]));
+    }
+}
+
+/**
+ * @brief         Score one record. Thread safe, the model is never written to.
+ * @param[in]     const float *features - raw (unscaled) values, in the models feature order
+ * @return        Output of the final layer, for the uc01 classifier the probability of on air.
+ */
+static float mlp_predict(const struct mlp_s *m, const float *features)
+{
+    _Alignas(16) float a[MLP_MAX_WIDTH];
+    _Alignas(16) float b[MLP_MAX_WIDTH];
+
+    for (int i = 0; i < m->featureCount; i++)
+        a[i] = (features[i] - m->mean[i]) / m->scale[i];
+
+    float *in = a, *out = b;
+    for (int i = 0; i < m->layerCount; i++) {
+        mlp_dense(&m->layers[i], in, out);
+        float *t = in;
+        in = out;
+        out = t;
+    }
+
+    return in[0];
+}
@@ -0,0 +1,109 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* getopt(), clock_gettime() with --std=c11 */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "mlp.c"
+
+/* Check the native classifier against keras. training/uc01-export-model.py writes the weight
+ * file and a reference file of raw feature vectors with the probability keras predicted for
+ * each, one record per line:
+ *
+ *   <feature 0> ... <feature n-1> <keras probability>
+ *
+ * Every record is scored natively and the worst disagreement is reported. Exits non zero if
+ * any record differs by more than the tolerance.
+ */
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s -m <model file> -r <reference file> [-t tolerance, def 1e-5] [-v]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    char *mname = NULL, *rname = NULL;
+    double tolerance = 1e-5;
+    int verbose = 0;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "?hm:r:t:v")) != -1) {
+        switch(ch) {
+        case 'm':
+            mname = optarg;
+            break;
+        case 'r':
+            rname = optarg;
+            break;
+        case 't':
+            tolerance = atof(optarg);
+            break;
+        case 'v':
+            verbose++;
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (!mname || !rname) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    struct mlp_s *m;
+    if (mlp_load(&m, mname) < 0)
+        exit(1);
+
+    FILE *fh = fopen(rname, "r");
+    if (!fh) {
+        perror("fopen");
+        exit(1);
+    }
+
+    float features[MLP_MAX_FEATURES];
+    float expected;
+    int records = 0, failures = 0;
+    double worst = 0;
+    double elapsed = 0;
+
+    while (1) {
+        int i;
+        for (i = 0; i < m->featureCount; i++) {
+            if (fscanf(fh, "%f", &features[i]) != 1)
+                break;
+        }
+        if (i < m->featureCount || fscanf(fh, "%f", &expected) != 1)
+            break;
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        float p = mlp_predict(m, features);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        elapsed += ((t1.tv_sec - t0.tv_sec) * 1e9) + (t1.tv_nsec - t0.tv_nsec);
+
+        double err = fabs((double)p - (double)expected);
+        if (err > worst)
+            worst = err;
+        if (err > tolerance)
+            failures++;
+        if (verbose || err > tolerance) {
+            printf("record %5d: native %.7f keras %.7f%s\n", records, p, expected, err > tolerance ? " MISMATCH" : "");
+        }
+        records++;
+    }
+    fclose(fh);
+
+    printf("%d records, %d mismatches, worst error %g, %.0f ns per prediction\n",
+        records, failures, worst, records ? elapsed / records : 0);
+
+    mlp_free(m);
+
+    return (records == 0 || failures) ? 1 : 0;
+}
@@ -1,60 +1,147 @@
 #include <libltntstools/ts.h>
 #include "nal_h264.h"
 #include <inttypes.h>
-#include "memmem.h"
+#include "startcode.h"
 
 //#include <libavutil/internal.h>
 //#include <libavcodec/golomb.h>
 
-int ltn_nal_h264_find_headers(const uint8_t *buf, int lengthBytes, struct ltn_nal_headers_s **array, int *arrayLength)
+/* Return the next start code at or after p that begins a legal nal, or NULL. */
+static const uint8_t *ltn_nal_h264_next_header(const uint8_t *p, const uint8_t *end)
+{
+	/* We need the byte after the start code to classify the nal, so never look at the last byte
+	 * as a start code candidate.
+	 */
+	while (end - p > 3 && (p = ltn_startcode_find(p, end - 1)))
+	{
+		/* Check for the forbidden zero bit, it's illegal to be high in a nal (conflicts with PES headers.
+		 * Same rule as ltn_nal_h264_findHeader().
+		 */
+		if ((p[3] & 0x80) == 0)
+			return p;
+
+		p += 3;
+	}
+
+	return NULL;
+}
+
+int ltn_nal_headers_array_reserve(struct ltn_nal_headers_array_s *array, int items)
+{
+	if (items <= array->allocated)
+		return 0; /* Success */
+
+	int allocated = array->allocated ? array->allocated : 64;
+	while (allocated < items)
+		allocated *= 2;
+
+	struct ltn_nal_headers_s *temp = realloc(array->items, sizeof(struct ltn_nal_headers_s) * allocated);
+	if (!temp)
+		return -1;
+
+	array->items = temp;
+	array->allocated = allocated;
+	return 0; /* Success */
+}
+
+void ltn_nal_headers_array_free(struct ltn_nal_headers_array_s *array)
+{
+	free(array->items);
+	array->items = NULL;
+	array->allocated = 0;
+	array->count = 0;
+}
+
+/* Start code scanning is the same for both codecs, only the nal header differs. */
+static int ltn_nal_find_headers_array(const uint8_t *buf, int lengthBytes, struct ltn_nal_headers_array_s *array, int hevc)
 {
+	const uint8_t *end = buf + lengthBytes;
+	const uint8_t *p = buf;
 	int idx = 0;
-	int maxitems = 64;
-	struct ltn_nal_headers_s *a = malloc(sizeof(struct ltn_nal_headers_s) * maxitems);
-	if (!a)
+
+	array->count = 0;
+	if (ltn_nal_headers_array_reserve(array, 64) < 0)
 		return -1;
 
-       const uint8_t start_code[3] = {0, 0, 1};
-       const uint8_t *end = buf + lengthBytes;
-       const uint8_t *p = buf;
-
-       while (p < end - 3)
-       {
-               p = ltn_memmem(p, end - p, start_code, sizeof(start_code));
-               if (!p)
-                       break;
-
-               if (idx >= maxitems)
-               {
-                       maxitems *= 2;
-                       struct ltn_nal_headers_s *temp = realloc(a, sizeof(struct ltn_nal_headers_s) * maxitems);
-                       if (!temp)
-                       {
-                               free(a);
-                               return -1;
-                       }
-                       a = temp;
-               }
-
-               a[idx].ptr = p;
-               a[idx].nalType = p[3] & 0x1f;
-               a[idx].nalName = h264Nals_lookupName(a[idx].nalType);
-               if (idx > 0)
-               {
-                       a[idx - 1].lengthBytes = p - a[idx - 1].ptr;
+	struct ltn_nal_headers_s *a = array->items;
+	while ((p = ltn_nal_h264_next_header(p, end)))
+	{
+		if (idx >= array->allocated)
+		{
+			if (ltn_nal_headers_array_reserve(array, idx + 1) < 0)
+				return -1;
+			a = array->items;
+		}
+
+		a[idx].ptr = p;
+		if (hevc) {
+			a[idx].nalType = (p[3] >> 1) & 0x3f;
+			a[idx].nalName = hevcNals_lookupName(a[idx].nalType);
+		} else {
+			a[idx].nalType = p[3] & 0x1f;
+			a[idx].nalName = h264Nals_lookupName(a[idx].nalType);
+		}
+		if (idx > 0)
+		{
+			a[idx - 1].lengthBytes = p - a[idx - 1].ptr;
 		}
 
 		idx++;
-               p += 3; // Move past start code
-       }
+		p += 3; /* Move past start code */
+	}
+
+	if (idx > 0)
+	{
+		a[idx - 1].lengthBytes = end - a[idx - 1].ptr;
+	}
+
+	array->count = idx;
+	return 0; /* Success */
+}
+
+int ltn_nal_h264_find_headers_array(const uint8_t *buf, int lengthBytes, struct ltn_nal_headers_array_s *array)
+{
+	return ltn_nal_find_headers_array(buf, lengthBytes, array, 0);
+}
+
+int ltn_nal_hevc_find_headers_array(const uint8_t *buf, int lengthBytes, struct ltn_nal_headers_array_s *array)
+{
+	return ltn_nal_find_headers_array(buf, lengthBytes, array, 1);
+}
 
-       if (idx > 0)
-       {
-               a[idx - 1].lengthBytes = end - a[idx - 1].ptr;
+int ltn_nal_h264_find_headers(const uint8_t *buf, int lengthBytes, struct ltn_nal_headers_s **array, int *arrayLength)
+{
+	struct ltn_nal_headers_array_s a = { 0 };
+
+	if (ltn_nal_h264_find_headers_array(buf, lengthBytes, &a) < 0) {
+		ltn_nal_headers_array_free(&a);
+		return -1;
 	}
 
-	*array = a;
-	*arrayLength = idx;
+	*array = a.items;
+	*arrayLength = a.count;
+	return 0; /* Success */
+}
+
+void ltn_nal_h264_headers_iter_init(struct ltn_nal_headers_iter_s *it, const uint8_t *buf, int lengthBytes)
+{
+	it->end = buf + lengthBytes;
+	it->next = ltn_nal_h264_next_header(buf, it->end);
+}
+
+int ltn_nal_h264_headers_iter_next(struct ltn_nal_headers_iter_s *it, struct ltn_nal_headers_s *hdr)
+{
+	const uint8_t *p = it->next;
+	if (!p)
+		return -1; /* No more headers */
+
+	it->next = ltn_nal_h264_next_header(p + 3, it->end);
+
+	hdr->ptr = p;
+	hdr->lengthBytes = (it->next ? it->next : it->end) - p;
+	hdr->nalType = p[3] & 0x1f;
+	hdr->nalName = h264Nals_lookupName(hdr->nalType);
+
 	return 0; /* Success */
 }
 
@@ -62,7 +149,7 @@ int ltn_nal_h264_findHeader(const uint8_t *buffer, int lengthBytes, int *offset)
 {
 	const uint8_t sig[] = { 0, 0, 1 };
 
-	for (int i = (*offset + 1); i < lengthBytes - sizeof(sig); i++) {
+	for (int i = (*offset + 1); i < lengthBytes - (int)sizeof(sig); i++) {
 		if (memcmp(buffer + i, sig, sizeof(sig)) == 0) {
 
 			/* Check for the forbidden zero bit, it's illegal to be high in a nal (conflicts with PES headers. */
@@ -80,7 +167,7 @@ int ltn_nal_h264_findHeader(const uint8_t *buffer, int lengthBytes, int *offset)
 static struct h264Nal_s {
 	const char *name;
 	const char *type;
-} h264Nals[] = {
+} h264Nals[32] = {
 	[ 0] = { "UNSPECIFIED", .type = "AUTO" },
 	[ 1] = { "slice_layer_without_partitioning_rbsp non-IDR", .type = "P" },
 	[ 2] = { "slice_data_partition_a_layer_rbsp(", .type = "P" },
@@ -105,12 +192,73 @@ static struct h264Nal_s {
 
 const char *h264Nals_lookupName(int nalType)
 {
-	return h264Nals[nalType].name;
+	const char *name = h264Nals[nalType & 0x1f].name;
+	return name ? name : "RESERVED";
 }
 
 const char *h264Nals_lookupType(int nalType)
 {
-	return h264Nals[nalType].type;
+	const char *type = h264Nals[nalType & 0x1f].type;
+	return type ? type : "";
+}
+
+static const char *hevcNals[64] = {
+	[ 0] = "TRAIL_N",
+	[ 1] = "TRAIL_R",
+	[ 2] = "TSA_N",
+	[ 3] = "TSA_R",
+	[ 4] = "STSA_N",
+	[ 5] = "STSA_R",
+	[ 6] = "RADL_N",
+	[ 7] = "RADL_R",
+	[ 8] = "RASL_N",
+	[ 9] = "RASL_R",
+	[16] = "BLA_W_LP",
+	[17] = "BLA_W_RADL",
+	[18] = "BLA_N_LP",
+	[19] = "IDR_W_RADL",
+	[20] = "IDR_N_LP",
+	[21] = "CRA_NUT",
+	[32] = "VPS",
+	[33] = "SPS",
+	[34] = "PPS",
+	[35] = "AUD",
+	[36] = "EOS",
+	[37] = "EOB",
+	[38] = "FD",
+	[39] = "SEI_PREFIX",
+	[40] = "SEI_SUFFIX",
+};
+
+const char *hevcNals_lookupName(int nalType)
+{
+	const char *name = hevcNals[nalType & 0x3f];
+	return name ? name : "RESERVED";
+}
+
+char *ltn_nal_hevc_findNalTypes(const uint8_t *buffer, int lengthBytes)
+{
+	struct ltn_nal_headers_array_s a = { 0 };
+	if (ltn_nal_hevc_find_headers_array(buffer, lengthBytes, &a) < 0 || a.count == 0) {
+		ltn_nal_headers_array_free(&a);
+		return NULL;
+	}
+
+	int len = 1;
+	for (int i = 0; i < a.count; i++)
+		len += strlen(a.items[i].nalName) + 2;
+
+	char *arr = calloc(1, len);
+	if (arr) {
+		for (int i = 0; i < a.count; i++) {
+			if (i > 0)
+				strcat(arr, ", ");
+			strcat(arr, a.items[i].nalName);
+		}
+	}
+
+	ltn_nal_headers_array_free(&a);
+	return arr;
 }
 
 char *ltn_nal_h264_findNalTypes(const uint8_t *buffer, int lengthBytes)
@@ -176,6 +324,11 @@ const char *h264_slice_name_ascii(int slice_type)
 	return &slice_defaults[ slice_type % MAX_H264_SLICE_TYPES ].name[0];
 }
 
+/* Bytes of a slice we need to see: the nal header, then enough RBSP for first_mb_in_slice
+ * (up to 31 bits for 4K) and slice_type.
+ */
+#define H264_SLICE_COUNTER_HEADER_BYTES 9
+
 struct h264_slice_counter_s
 {
 	uint16_t pid;
@@ -183,12 +336,38 @@ struct h264_slice_counter_s
 
 	int nextHistoryPos;
 	char sliceHistory[H264_SLICE_COUNTER_HISTORY_LENGTH + 1];
+
+	/* Elementary stream scanner, carried from one packet to the next */
+	uint16_t scanPid;      /* Pid being scanned, with pid 0x2000 the last pid that started a video PES */
+	int pesSkip;           /* PES header bytes still to be skipped, they can straddle packets */
+	int zeros;             /* Zero bytes that ended the previous payload, a start code may complete in this one */
+	int collect;           /* Bytes of the current nal header still wanted, 0 when not collecting */
+	int hdrZeros;          /* Emulation prevention state while collecting */
+	int hdrLen;
+	uint8_t hdr[H264_SLICE_COUNTER_HEADER_BYTES];
+	int inSlice;           /* Boolean. The nal being scanned is a slice */
+	uint64_t nalBytes;     /* Of the nal being scanned so far, start code included */
+	uint64_t sliceBytes;   /* Lifetime total of completed slice nals */
 };
 
+static void h264_slice_counter_scan_reset(struct h264_slice_counter_s *s)
+{
+	s->pesSkip = 0;
+	s->zeros = 0;
+	s->collect = 0;
+	s->hdrLen = 0;
+	s->inSlice = 0;
+	s->nalBytes = 0;
+}
+
 void h264_slice_counter_reset(void *ctx)
 {
 	struct h264_slice_counter_s *s = (struct h264_slice_counter_s *)ctx;
 	memcpy(s->slice, slice_defaults, sizeof(slice_defaults));
+	h264_slice_counter_scan_reset(s);
+	s->scanPid = s->pid;
+	s->sliceBytes = 0;
+	s->nextHistoryPos = 0;
 	for (int i = 0; i < H264_SLICE_COUNTER_HISTORY_LENGTH; i++) {
 		s->sliceHistory[i] = ' ';
 	}
@@ -198,11 +377,26 @@ void h264_slice_counter_reset(void *ctx)
 void *h264_slice_counter_alloc(uint16_t pid)
 {
 	struct h264_slice_counter_s *s = malloc(sizeof(*s));
+	if (!s)
+		return NULL;
 	s->pid = pid;
 	h264_slice_counter_reset(s);
 	return (void *)s;
 }
 
+uint16_t h264_slice_counter_get_pid(void *ctx)
+{
+	struct h264_slice_counter_s *s = (struct h264_slice_counter_s *)ctx;
+	return s->pid;
+}
+
+void h264_slice_counter_reset_pid(void *ctx, uint16_t pid)
+{
+	struct h264_slice_counter_s *s = (struct h264_slice_counter_s *)ctx;
+	s->pid = pid;
+	h264_slice_counter_reset(s);
+}
+
 void h264_slice_counter_free(void *ctx)
 {
 	struct h264_slice_counter_s *s = (struct h264_slice_counter_s *)ctx;
@@ -228,3 +422,180 @@ void h264_slice_counter_dprintf(void *ctx, int fd, int printZeroCounts)
 		dprintf(fd, "%4d  %4s  %" PRIu64 "\n", sl->slice_type, sl->name, sl->count);
 	}
 }
+
+void h264_slice_counter_query(void *ctx, struct h264_slice_counter_results_s *results)
+{
+	struct h264_slice_counter_s *s = (struct h264_slice_counter_s *)ctx;
+
+	results->p = s->slice[0].count + s->slice[5].count;
+	results->b = s->slice[1].count + s->slice[6].count;
+	results->i = s->slice[2].count + s->slice[7].count;
+	results->sp = s->slice[3].count + s->slice[8].count;
+	results->si = s->slice[4].count + s->slice[9].count;
+	results->sliceBytes = s->sliceBytes;
+
+	/* Oldest first */
+	for (int i = 0; i < H264_SLICE_COUNTER_HISTORY_LENGTH; i++) {
+		results->sliceHistory[i] = s->sliceHistory[(s->nextHistoryPos + i) % H264_SLICE_COUNTER_HISTORY_LENGTH];
+	}
+	results->sliceHistory[H264_SLICE_COUNTER_HISTORY_LENGTH] = 0;
+}
+
+/* Unsigned exp-golomb from a few bytes of RBSP, -1 if it runs off the end */
+static int h264_slice_counter_ue(const uint8_t *buf, int lengthBytes, int *bit)
+{
+	int zeros = 0;
+	while (*bit < lengthBytes * 8 && ((buf[*bit / 8] >> (7 - (*bit % 8))) & 1) == 0) {
+		zeros++;
+		(*bit)++;
+	}
+	if (zeros > 31 || *bit + zeros >= lengthBytes * 8)
+		return -1;
+
+	(*bit)++; /* Marker */
+	uint64_t v = 0;
+	for (int i = 0; i < zeros; i++, (*bit)++)
+		v = (v << 1) | ((buf[*bit / 8] >> (7 - (*bit % 8))) & 1);
+
+	v += (1ULL << zeros) - 1;
+	return v > 0x7fffffff ? -1 : (int)v;
+}
+
+/* The collected header of a slice is complete, or its nal ended early */
+static void h264_slice_counter_header(struct h264_slice_counter_s *s)
+{
+	int bit = 0;
+	s->collect = 0;
+
+	if (h264_slice_counter_ue(s->hdr + 1, s->hdrLen - 1, &bit) < 0)
+		return; /* first_mb_in_slice */
+	int slice_type = h264_slice_counter_ue(s->hdr + 1, s->hdrLen - 1, &bit);
+	if (slice_type < 0 || slice_type >= MAX_H264_SLICE_TYPES)
+		return;
+
+	h264_slice_counter_update(s, slice_type);
+}
+
+/* A start code ended at the current byte, close the previous nal and start collecting the next header.
+ * counted is how many bytes of the new start code nalBytes already includes.
+ */
+static void h264_slice_counter_startcode(struct h264_slice_counter_s *s, int counted)
+{
+	if (s->collect && s->hdrLen > 1)
+		h264_slice_counter_header(s);
+	if (s->inSlice)
+		s->sliceBytes += s->nalBytes - counted - 3;
+
+	s->inSlice = 0;
+	s->nalBytes = 3;
+	s->collect = H264_SLICE_COUNTER_HEADER_BYTES;
+	s->hdrLen = 0;
+	s->hdrZeros = 0;
+}
+
+/* Scan elementary stream bytes. Start codes are found with the same SIMD search as
+ * ltn_nal_h264_find_headers_array(), only the few bytes around packet boundaries and the
+ * start of each nal are stepped through one at a time.
+ */
+static void h264_slice_counter_scan(struct h264_slice_counter_s *s, const uint8_t *p, const uint8_t *end)
+{
+	while (p < end) {
+		if (s->collect == 0 && s->zeros == 0) {
+			const uint8_t *sc = ltn_startcode_find(p, end);
+			if (!sc) {
+				/* Up to two trailing zeros could be the start of a code that completes in the next packet */
+				s->zeros = 0;
+				if (end[-1] == 0)
+					s->zeros = (end - p >= 2 && end[-2] == 0) ? 2 : 1;
+				s->nalBytes += end - p;
+				return;
+			}
+			s->nalBytes += sc - p;
+			p = sc + 3;
+			h264_slice_counter_startcode(s, 0);
+			continue;
+		}
+
+		uint8_t b = *(p++);
+		s->nalBytes++;
+		if (s->zeros >= 2 && b == 0x01) {
+			s->zeros = 0;
+			h264_slice_counter_startcode(s, 3);
+			continue;
+		}
+		s->zeros = b ? 0 : s->zeros + 1;
+
+		if (s->collect == 0)
+			continue;
+
+		if (s->hdrLen == 0) {
+			/* nal header byte, only slices are of interest */
+			int nalType = b & 0x1f;
+			if ((b & 0x80) || nalType < 1 || nalType > 5) {
+				s->collect = 0;
+				continue;
+			}
+			s->inSlice = 1;
+			s->hdr[s->hdrLen++] = b;
+		} else
+		if (s->hdrZeros >= 2 && b == 0x03) {
+			s->hdrZeros = 0; /* Emulation prevention */
+			continue;
+		} else {
+			s->hdr[s->hdrLen++] = b;
+			s->hdrZeros = b ? 0 : s->hdrZeros + 1;
+		}
+		if (s->hdrLen == H264_SLICE_COUNTER_HEADER_BYTES)
+			h264_slice_counter_header(s);
+	}
+}
+
+void h264_slice_counter_write(void *ctx, const unsigned char *pkts, int packetCount)
+{
+	struct h264_slice_counter_s *s = (struct h264_slice_counter_s *)ctx;
+
+	for (int i = 0; i < packetCount; i++) {
+		const uint8_t *pkt = pkts + (i * 188);
+		uint16_t pid = ltntstools_pid(pkt);
+		int pusi = pkt[1] & 0x40;
+
+		if (s->pid != 0x2000 && pid != s->pid)
+			continue;
+		if ((pkt[3] & 0x10) == 0)
+			continue; /* No payload */
+
+		const uint8_t *p = pkt + 4;
+		const uint8_t *end = pkt + 188;
+		if (pkt[3] & 0x20)
+			p += 1 + pkt[4];
+		if (p >= end)
+			continue;
+
+		if (pusi) {
+			/* A video PES header, 00 00 01 Ex */
+			if (end - p < 9 || p[0] != 0 || p[1] != 0 || p[2] != 1 || (p[3] & 0xf0) != 0xe0)
+				continue;
+			if (pid != s->scanPid)
+				s->scanPid = pid; /* pid 0x2000, follow whichever pid carries video */
+
+			/* The previous nal ends with its PES, no start code spans two */
+			if (s->collect && s->hdrLen > 1)
+				h264_slice_counter_header(s);
+			if (s->inSlice)
+				s->sliceBytes += s->nalBytes - 3;
+			h264_slice_counter_scan_reset(s);
+			s->pesSkip = 9 + p[8];
+		} else
+		if (pid != s->scanPid) {
+			continue;
+		}
+
+		if (s->pesSkip) {
+			int n = end - p < s->pesSkip ? end - p : s->pesSkip;
+			p += n;
+			s->pesSkip -= n;
+		}
+		if (p < end)
+			h264_slice_counter_scan(s, p, end);
+	}
+}
@@ -25,6 +25,7 @@ struct ltn_nal_headers_s
  * @brief         Search buffer for the byte sequence 000001, a NAL header signature, return an array inside a new
  *                memory allocation for the caller.
  *                CALLER OWNS the array memory allocation, make sure you free it after use.
+ *                Allocates on every call, hot paths should use ltn_nal_h264_find_headers_array() instead.
  * @param[in]     const uint8_t *buf - Buffer of data, possibly containing none or more NAL packets.
  * @param[in]     int lengthBytes - Buffer length in bytes.
  * @param[in,out] struct ltn_nal_headers_s **array - Destination pointer for new array allocation
@@ -34,6 +35,78 @@ struct ltn_nal_headers_s
  */
 int ltn_nal_h264_find_headers(const uint8_t *buf, int lengthBytes, struct ltn_nal_headers_s **array, int *arrayLength);
 
+/**
+ * @brief         A caller owned, reusable collection of nal headers. Zero initialize before first use,
+ *                the allocation only grows, so steady state enumeration performs no heap allocations.
+ *                Release with ltn_nal_headers_array_free().
+ */
+struct ltn_nal_headers_array_s
+{
+    struct ltn_nal_headers_s *items;
+    int                       count;     /* Number of valid entries after the last enumeration */
+    int                       allocated; /* Number of entries the items allocation can hold */
+};
+
+/**
+ * @brief         Search buffer for the byte sequence 000001, a NAL header signature, into a caller owned array.
+ *                Entries point into buf, they're only valid while buf is.
+ * @param[in]     const uint8_t *buf - Buffer of data, possibly containing none or more NAL packets.
+ * @param[in]     int lengthBytes - Buffer length in bytes.
+ * @param[in,out] struct ltn_nal_headers_array_s *array - Reused between calls, grown when required.
+ * @return          0 - Success
+ * @return        < 0 - Error
+ */
+int ltn_nal_h264_find_headers_array(const uint8_t *buf, int lengthBytes, struct ltn_nal_headers_array_s *array);
+
+/**
+ * @brief         As ltn_nal_h264_find_headers_array(), for HEVC. nalType is the 6 bit type from the two byte
+ *                HEVC nal header, ptr still points at the 00 00 01 start code.
+ * @param[in]     const uint8_t *buf - Buffer of data, possibly containing none or more NAL packets.
+ * @param[in]     int lengthBytes - Buffer length in bytes.
+ * @param[in,out] struct ltn_nal_headers_array_s *array - Reused between calls, grown when required.
+ * @return          0 - Success
+ * @return        < 0 - Error
+ */
+int ltn_nal_hevc_find_headers_array(const uint8_t *buf, int lengthBytes, struct ltn_nal_headers_array_s *array);
+
+/**
+ * @brief         Make sure the array can hold at least items entries.
+ * @return          0 - Success
+ * @return        < 0 - Error
+ */
+int ltn_nal_headers_array_reserve(struct ltn_nal_headers_array_s *array, int items);
+
+/**
+ * @brief         Release the array allocation, the array may be reused afterwards.
+ */
+void ltn_nal_headers_array_free(struct ltn_nal_headers_array_s *array);
+
+/**
+ * @brief         Enumerator state for walking nal headers one at a time without any allocation.
+ */
+struct ltn_nal_headers_iter_s
+{
+    const uint8_t *end;
+    const uint8_t *next;
+};
+
+/**
+ * @brief         Prepare an enumerator over buf.
+ * @param[out]    struct ltn_nal_headers_iter_s *it - Enumerator state, typically on the stack.
+ * @param[in]     const uint8_t *buf - Buffer of data, possibly containing none or more NAL packets.
+ * @param[in]     int lengthBytes - Buffer length in bytes.
+ */
+void ltn_nal_h264_headers_iter_init(struct ltn_nal_headers_iter_s *it, const uint8_t *buf, int lengthBytes);
+
+/**
+ * @brief         Return the next nal header. Produces exactly the same headers as ltn_nal_h264_find_headers().
+ * @param[in,out] struct ltn_nal_headers_iter_s *it - Enumerator state from ltn_nal_h264_headers_iter_init().
+ * @param[out]    struct ltn_nal_headers_s *hdr - Next header, including its length.
+ * @return          0 - Success
+ * @return        < 0 - No more headers
+ */
+int ltn_nal_h264_headers_iter_next(struct ltn_nal_headers_iter_s *it, struct ltn_nal_headers_s *hdr);
+
 /**
  * @brief         Search buffer for the byte sequence 000001, a NAL header signature.
  * @param[in]     const uint8_t *buf - Buffer of data, possibly containing none or more NAL packets.
@@ -52,6 +125,8 @@ char *ltn_nal_h264_findNalTypes(const uint8_t *buf, int lengthBytes);
 
 const char *h264Nals_lookupName(int nalType);
 
+const char *hevcNals_lookupName(int nalType);
+
 /**
  * @brief         A machanism to find h264 slices in a bitstream, count the number of respective I/P/B frames.
  * @param[in]     uint16_t pid - Specific video pid to analyze. Use 0x2000 to analyze all pids.
@@ -96,6 +171,8 @@ void h264_slice_counter_dprintf(void *ctx, int fd, int printZeroCounts);
 
 /**
  * @brief         Scan the buffer, update the I/P/B counts based on slices found within the buffer. 
+ *                Works on the packet payloads directly, no PES reassembly or copies. Start codes and
+ *                slice headers that straddle packets are carried over to the next call.
  * @param[in]     void *s - Context returned from the prior h264_slice_counter_alloc() call.
  * @param[in]     const unsigned char *pkts - A fully aligned buffer of transport packets.
  * @param[in]     int packetCount - Number of 188 bytes transport packets in the buffer.
@@ -109,6 +186,7 @@ struct h264_slice_counter_results_s
     uint64_t p;
     uint64_t si;
     uint64_t sp;
+    uint64_t sliceBytes; /* Slice nals, start codes excluded, from h264_slice_counter_write() */
 
 #define H264_SLICE_COUNTER_HISTORY_LENGTH 20
     char sliceHistory[H264_SLICE_COUNTER_HISTORY_LENGTH + 1];
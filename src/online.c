@@ -0,0 +1,123 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* On air classifier learned in the probe, from the operators SIGUSR1/SIGUSR2 labels, so a new
+ * slate is picked up within minutes instead of after an export, a training run and a redeploy
+ * (training/uc01-train-model.py). Logistic regression by stochastic gradient descent, one step
+ * per labelled period, over features standardized with an exponentially weighted mean and
+ * variance that follow the last few minutes of the stream.
+ *
+ * Every period is scored before it is trained on, so the agreement reported is with the
+ * human on periods the model had not yet learned from. Fixed memory, O(features) per period.
+ */
+#define ONLINE_MAX_FEATURES 32
+#define ONLINE_DEFAULT_RATE 0.05f
+#define ONLINE_L2 0.0001f        /* Weight decay per update, lets features that stopped mattering fade */
+#define ONLINE_Z_CLIP 6.0f       /* Standardized values are clipped, one wild period can't swing the weights */
+#define ONLINE_SCALER_MINUTES 5  /* Memory of the running mean and variance */
+
+/* The record fields trained on when -O default, the training/uc01-train-model.py features and
+ * the static picture scores
+ */
+static const char *online_default_features[] = {
+    "avc_ibp_total_slice_count", "avc_ibp_total_slice_size", "transport_bit_count",
+    "i_count", "p_count", "b_count", "static_slice_repeat_ratio", "static_score",
+};
+#define ONLINE_DEFAULT_FEATURE_COUNT (int)(sizeof(online_default_features) / sizeof(online_default_features[0]))
+
+struct online_s
+{
+    int featureCount;
+    float rate;              /* SGD step */
+    float scalerAlpha;       /* Smallest weight of a new period in the mean and variance */
+    float agreementAlpha;    /* Weight of a new labelled period in agreement */
+
+    float mean[ONLINE_MAX_FEATURES];
+    float var[ONLINE_MAX_FEATURES];
+    float weight[ONLINE_MAX_FEATURES];
+    float bias;
+
+    uint64_t periods;        /* Scored */
+    uint64_t updates;        /* Labelled periods trained on */
+    float agreement;         /* Recent fraction of labelled periods predicted as labelled, < 0 before any */
+};
+
+/**
+ * @brief         Start untrained.
+ * @param[in]     int featureCount - At most ONLINE_MAX_FEATURES.
+ * @param[in]     float rate - SGD step, ONLINE_DEFAULT_RATE.
+ * @param[in]     int periodsPerMinute - Reporting periods a minute, scales how quickly the scaler and agreement follow.
+ */
+static void online_reset(struct online_s *o, int featureCount, float rate, int periodsPerMinute)
+{
+    memset(o, 0, sizeof(*o));
+    o->featureCount = featureCount;
+    o->rate = rate;
+    if (periodsPerMinute < 1)
+        periodsPerMinute = 1;
+    o->scalerAlpha = 1.0f / (ONLINE_SCALER_MINUTES * periodsPerMinute);
+    o->agreementAlpha = 1.0f / periodsPerMinute;
+    o->agreement = -1.0f;
+}
+
+/**
+ * @brief         Score one period, then train on it when it carries a label.
+ * @param[in]     const float *x - Raw feature values, featureCount of them. NAN for a feature absent
+ *                this period, it contributes nothing and leaves its mean and variance alone.
+ * @param[in]     int label - 1 on air, 0 off air, < 0 unlabelled (score only).
+ * @return        Probability of on air, from the model as it was before this period.
+ */
+static float online_observe(struct online_s *o, const float *x, int label)
+{
+    float z[ONLINE_MAX_FEATURES];
+
+    /* Running mean and variance, a plain average until the window fills */
+    o->periods++;
+    float a = 1.0f / o->periods;
+    if (a < o->scalerAlpha)
+        a = o->scalerAlpha;
+
+    float logit = o->bias;
+    for (int i = 0; i < o->featureCount; i++) {
+        if (isnan(x[i])) {
+            z[i] = 0.0f;
+            continue;
+        }
+        float diff = x[i] - o->mean[i];
+        float incr = a * diff;
+        o->mean[i] += incr;
+        o->var[i] = (1.0f - a) * (o->var[i] + (diff * incr));
+
+        float sd = sqrtf(o->var[i]);
+        z[i] = sd > 0.0f ? (x[i] - o->mean[i]) / sd : 0.0f;
+        if (z[i] > ONLINE_Z_CLIP) {
+            z[i] = ONLINE_Z_CLIP;
+        } else
+        if (z[i] < -ONLINE_Z_CLIP) {
+            z[i] = -ONLINE_Z_CLIP;
+        }
+        logit += o->weight[i] * z[i];
+    }
+    float p = 1.0f / (1.0f + expf(-logit));
+
+    if (label < 0)
+        return p;
+
+    float agree = (p >= 0.5f) == (label != 0) ? 1.0f : 0.0f;
+    if (o->agreement < 0) {
+        o->agreement = agree;
+    } else {
+        o->agreement += o->agreementAlpha * (agree - o->agreement);
+    }
+
+    /* Log loss gradient, p - y */
+    float g = p - (label ? 1.0f : 0.0f);
+    for (int i = 0; i < o->featureCount; i++) {
+        o->weight[i] -= o->rate * ((g * z[i]) + (ONLINE_L2 * o->weight[i]));
+    }
+    o->bias -= o->rate * g;
+    o->updates++;
+
+    return p;
+}
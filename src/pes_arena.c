@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/* One pool of PES reassembly buffers for every service in the process. Buffers come in power of
+ * two size classes, PES_ARENA_MIN_BYTES up to PES_ARENA_MAX_BYTES, and go back on a per class
+ * free list when the PES has been analyzed, so a service only holds memory for the PES it is
+ * collecting right now, sized by what it has been sending. Everything allocated, in use or
+ * free, counts against a global cap. At the cap free buffers of other classes are given back
+ * to the system to make room, and when that isn't enough the request fails and the caller
+ * drops that PES.
+ *
+ * Shared by all analysis threads, a short mutex hold per PES.
+ */
+#define PES_ARENA_MIN_SHIFT 14                              /* 16 KB */
+#define PES_ARENA_CLASSES 9                                 /* Through 4 MB */
+#define PES_ARENA_MIN_BYTES (1 << PES_ARENA_MIN_SHIFT)
+#define PES_ARENA_MAX_BYTES (1 << (PES_ARENA_MIN_SHIFT + PES_ARENA_CLASSES - 1))
+
+struct pes_arena_buffer_s
+{
+    struct pes_arena_buffer_s *next; /* Free list link, the buffer itself holds it while free */
+};
+
+struct pes_arena_s
+{
+    pthread_mutex_t mutex;
+    size_t capBytes;
+    size_t reservedBytes;        /* Allocated from the system, in use or free */
+    size_t inUseBytes;
+    size_t highWaterBytes;       /* Of inUseBytes */
+    uint64_t acquires;
+    uint64_t failures;           /* Requests refused, at the cap or larger than PES_ARENA_MAX_BYTES */
+
+    struct pes_arena_buffer_s *freeList[PES_ARENA_CLASSES];
+    unsigned int freeCount[PES_ARENA_CLASSES];
+    unsigned int inUseCount[PES_ARENA_CLASSES];
+};
+
+/* A consistent snapshot, for reporting */
+struct pes_arena_stats_s
+{
+    size_t capBytes;
+    size_t reservedBytes;
+    size_t inUseBytes;
+    size_t highWaterBytes;
+    unsigned int buffersInUse;
+    uint64_t acquires;
+    uint64_t failures;
+};
+
+static int pes_arena_class(int bytes)
+{
+    int c = 0;
+    while (c < PES_ARENA_CLASSES && (PES_ARENA_MIN_BYTES << c) < bytes)
+        c++;
+    return c;
+}
+
+static int pes_arena_alloc(struct pes_arena_s **handle, size_t capBytes)
+{
+    struct pes_arena_s *a = calloc(1, sizeof(*a));
+    if (!a)
+        return -1;
+
+    pthread_mutex_init(&a->mutex, NULL);
+    a->capBytes = capBytes;
+
+    *handle = a;
+    return 0; /* Success */
+}
+
+/* Every buffer must have been released */
+static void pes_arena_free(struct pes_arena_s *a)
+{
+    for (int c = 0; c < PES_ARENA_CLASSES; c++) {
+        while (a->freeList[c]) {
+            struct pes_arena_buffer_s *b = a->freeList[c];
+            a->freeList[c] = b->next;
+            free(b);
+        }
+    }
+    pthread_mutex_destroy(&a->mutex);
+    free(a);
+}
+
+/* Give free buffers of other classes back to the system until size more bytes fit under the cap,
+ * largest first. Called with the mutex held.
+ */
+static int pes_arena_make_room(struct pes_arena_s *a, size_t size)
+{
+    for (int c = PES_ARENA_CLASSES - 1; c >= 0 && a->reservedBytes + size > a->capBytes; c--) {
+        while (a->freeList[c] && a->reservedBytes + size > a->capBytes) {
+            struct pes_arena_buffer_s *b = a->freeList[c];
+            a->freeList[c] = b->next;
+            a->freeCount[c]--;
+            a->reservedBytes -= (size_t)PES_ARENA_MIN_BYTES << c;
+            free(b);
+        }
+    }
+    return a->reservedBytes + size <= a->capBytes ? 0 : -1;
+}
+
+static uint8_t *pes_arena_take(struct pes_arena_s *a, int bytes, int *size, int countFailure)
+{
+    int c = pes_arena_class(bytes);
+    if (c == PES_ARENA_CLASSES) {
+        pthread_mutex_lock(&a->mutex);
+        a->failures += countFailure;
+        pthread_mutex_unlock(&a->mutex);
+        return NULL;
+    }
+    size_t classBytes = (size_t)PES_ARENA_MIN_BYTES << c;
+
+    pthread_mutex_lock(&a->mutex);
+    struct pes_arena_buffer_s *b = a->freeList[c];
+    if (b) {
+        a->freeList[c] = b->next;
+        a->freeCount[c]--;
+    } else
+    if (pes_arena_make_room(a, classBytes) == 0) {
+        b = malloc(classBytes);
+        if (b) {
+            a->reservedBytes += classBytes;
+        }
+    }
+    if (!b) {
+        a->failures += countFailure;
+        pthread_mutex_unlock(&a->mutex);
+        return NULL;
+    }
+
+    a->acquires++;
+    a->inUseCount[c]++;
+    a->inUseBytes += classBytes;
+    if (a->inUseBytes > a->highWaterBytes)
+        a->highWaterBytes = a->inUseBytes;
+    pthread_mutex_unlock(&a->mutex);
+
+    *size = classBytes;
+    return (uint8_t *)b;
+}
+
+/**
+ * @brief         Take a buffer of at least bytes.
+ * @param[out]    int *size - The buffer's actual size, pass it back to pes_arena_release().
+ * @return        Buffer, or NULL when the cap is reached or bytes exceeds PES_ARENA_MAX_BYTES.
+ */
+static uint8_t *pes_arena_acquire(struct pes_arena_s *a, int bytes, int *size)
+{
+    return pes_arena_take(a, bytes, size, 1);
+}
+
+/* As pes_arena_acquire(), for a size with headroom the caller can do without. A refusal isn't
+ * counted as a failure, the caller asks again for what it needs.
+ */
+static uint8_t *pes_arena_try(struct pes_arena_s *a, int bytes, int *size)
+{
+    return pes_arena_take(a, bytes, size, 0);
+}
+
+static void pes_arena_release(struct pes_arena_s *a, uint8_t *buf, int size)
+{
+    int c = pes_arena_class(size);
+    struct pes_arena_buffer_s *b = (struct pes_arena_buffer_s *)buf;
+
+    pthread_mutex_lock(&a->mutex);
+    b->next = a->freeList[c];
+    a->freeList[c] = b;
+    a->freeCount[c]++;
+    a->inUseCount[c]--;
+    a->inUseBytes -= (size_t)size;
+    pthread_mutex_unlock(&a->mutex);
+}
+
+/* Snapshot, optionally restarting the high water mark */
+static void pes_arena_query(struct pes_arena_s *a, struct pes_arena_stats_s *s, int resetHighWater)
+{
+    pthread_mutex_lock(&a->mutex);
+    s->capBytes = a->capBytes;
+    s->reservedBytes = a->reservedBytes;
+    s->inUseBytes = a->inUseBytes;
+    s->highWaterBytes = a->highWaterBytes;
+    s->buffersInUse = 0;
+    for (int c = 0; c < PES_ARENA_CLASSES; c++)
+        s->buffersInUse += a->inUseCount[c];
+    s->acquires = a->acquires;
+    s->failures = a->failures;
+    if (resetHighWater)
+        a->highWaterBytes = a->inUseBytes;
+    pthread_mutex_unlock(&a->mutex);
+}
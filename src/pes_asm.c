@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* PES reassembly for one video pid, buffers drawn from the shared arena (pes_arena.c) instead
+ * of the 1 MB + 2 MB the library extractor reserves for every stream. A buffer is taken when a
+ * PES starts, sized from the PES this pid has been sending, grown by moving to a larger class
+ * when a PES outgrows it, and handed back once the callback returns. When the arena refuses,
+ * the PES is dropped and collection restarts at the next PES header. Headroom (the size hint at
+ * the start, half again when growing) is only asked for, so a large PES can't price every later
+ * one out of a tight arena.
+ *
+ * A PES completes when its PES_packet_length is reached or, for unbounded video PES, when the
+ * next one starts.
+ */
+struct pes_asm_packet_s
+{
+    int PTS_DTS_flags;           /* 2 PTS only, 3 PTS and DTS */
+    int64_t PTS;                 /* 90KHz */
+    int64_t DTS;
+    const uint8_t *data;         /* Elementary stream, the PES header is skipped */
+    int dataLengthBytes;
+};
+
+typedef void (*pes_asm_callback)(void *userContext, struct pes_asm_packet_s *pes);
+
+struct pes_asm_s
+{
+    struct pes_arena_s *arena;
+    uint16_t pid;
+    uint8_t streamId;
+    pes_asm_callback cb;
+    void *userContext;
+
+    uint8_t *buf;                /* The PES being collected, from its start code, or NULL */
+    int bufSize;
+    int len;
+    int expected;                /* Whole PES size from PES_packet_length, 0 when unbounded */
+    int sizeHint;                /* Recent PES sizes, decays slowly after a large one */
+
+    /* Lifetime counters, owner thread */
+    uint64_t pesCount;
+    uint64_t drops;              /* PES lost because the arena refused a buffer */
+    uint64_t grows;              /* PES that outgrew the buffer they started in */
+};
+
+static int pes_asm_alloc(struct pes_asm_s **handle, struct pes_arena_s *arena, uint16_t pid, uint8_t streamId,
+    pes_asm_callback cb, void *userContext)
+{
+    struct pes_asm_s *p = calloc(1, sizeof(*p));
+    if (!p)
+        return -1;
+
+    p->arena = arena;
+    p->pid = pid;
+    p->streamId = streamId;
+    p->cb = cb;
+    p->userContext = userContext;
+    p->sizeHint = PES_ARENA_MIN_BYTES;
+
+    *handle = p;
+    return 0; /* Success */
+}
+
+static void pes_asm_drop(struct pes_asm_s *p)
+{
+    if (p->buf) {
+        pes_arena_release(p->arena, p->buf, p->bufSize);
+        p->buf = NULL;
+    }
+    p->len = 0;
+}
+
+static void pes_asm_free(struct pes_asm_s *p)
+{
+    pes_asm_drop(p);
+    free(p);
+}
+
+static int64_t pes_asm_timestamp(const uint8_t *t)
+{
+    return ((int64_t)((t[0] >> 1) & 0x07) << 30) | (t[1] << 22) | ((t[2] >> 1) << 15) | (t[3] << 7) | (t[4] >> 1);
+}
+
+/* Parse the header, call back, give the buffer back */
+static void pes_asm_complete(struct pes_asm_s *p)
+{
+    const uint8_t *b = p->buf;
+    int len = p->expected && p->expected < p->len ? p->expected : p->len;
+
+    if (len >= 9 && b[0] == 0 && b[1] == 0 && b[2] == 1 && b[3] == p->streamId && 9 + b[8] <= len) {
+        struct pes_asm_packet_s pes;
+        pes.PTS_DTS_flags = b[7] >> 6;
+        pes.PTS = 0;
+        pes.DTS = 0;
+        if ((pes.PTS_DTS_flags & 2) && b[8] >= 5) {
+            pes.PTS = pes_asm_timestamp(b + 9);
+        }
+        if (pes.PTS_DTS_flags == 3 && b[8] >= 10) {
+            pes.DTS = pes_asm_timestamp(b + 14);
+        }
+        pes.data = b + 9 + b[8];
+        pes.dataLengthBytes = len - (9 + b[8]);
+
+        p->pesCount++;
+        p->cb(p->userContext, &pes);
+    }
+
+    /* Follow growth at once, shrink by an eighth of the difference per PES */
+    if (len > p->sizeHint) {
+        p->sizeHint = len;
+    } else {
+        p->sizeHint -= (p->sizeHint - len) / 8;
+    }
+    pes_asm_drop(p);
+}
+
+/* Append, moving to a larger buffer when needed. Returns < 0 if the PES had to be dropped. */
+static int pes_asm_append(struct pes_asm_s *p, const uint8_t *data, int n)
+{
+    if (p->len + n > p->bufSize) {
+        int size;
+        uint8_t *buf = pes_arena_try(p->arena, p->len + n + (p->len / 2), &size);
+        if (!buf) {
+            buf = pes_arena_acquire(p->arena, p->len + n, &size);
+        }
+        if (!buf) {
+            p->drops++;
+            pes_asm_drop(p);
+            return -1;
+        }
+        memcpy(buf, p->buf, p->len);
+        pes_arena_release(p->arena, p->buf, p->bufSize);
+        p->buf = buf;
+        p->bufSize = size;
+        p->grows++;
+    }
+    memcpy(p->buf + p->len, data, n);
+    p->len += n;
+    return 0; /* Success */
+}
+
+static void pes_asm_write(struct pes_asm_s *p, const uint8_t *pkts, int packetCount)
+{
+    for (int i = 0; i < packetCount; i++) {
+        const uint8_t *pkt = pkts + (i * 188);
+        if ((((pkt[1] & 0x1f) << 8) | pkt[2]) != p->pid)
+            continue;
+        if ((pkt[3] & 0x10) == 0)
+            continue; /* No payload */
+
+        const uint8_t *d = pkt + 4;
+        if (pkt[3] & 0x20)
+            d += 1 + pkt[4];
+        int n = pkt + 188 - d;
+        if (n <= 0)
+            continue;
+
+        if (pkt[1] & 0x40) {
+            if (p->buf)
+                pes_asm_complete(p);
+
+            /* A new PES, room for what this pid has been sending plus an eighth, or start small */
+            p->buf = pes_arena_try(p->arena, p->sizeHint + (p->sizeHint / 8), &p->bufSize);
+            if (!p->buf) {
+                p->buf = pes_arena_acquire(p->arena, n, &p->bufSize);
+            }
+            if (!p->buf) {
+                p->drops++;
+                continue;
+            }
+            p->len = 0;
+            p->expected = n >= 6 && (d[4] | d[5]) ? 6 + ((d[4] << 8) | d[5]) : 0;
+        } else
+        if (!p->buf) {
+            continue; /* Waiting for a PES header */
+        }
+
+        if (pes_asm_append(p, d, n) < 0)
+            continue;
+        if (p->expected && p->len >= p->expected)
+            pes_asm_complete(p);
+    }
+}
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/* A lock free, single producer / single consumer ring of transport packet batches.
+ * The receive thread is the only producer, the analysis thread the only consumer.
+ * Each slot holds one network read, up to seven 188 byte packets, and when it arrived.
+ */
+#define PKT_RING_SLOT_PACKETS 7
+#define PKT_RING_SLOT_BYTES (PKT_RING_SLOT_PACKETS * 188)
+
+struct pkt_ring_slot_s
+{
+    struct timeval ts;                      /* Walltime the batch was received */
+    int lengthBytes;                        /* Bytes of transport packets in pkts */
+    int marker;                             /* 0, pkts holds packets. Otherwise a control message, its meaning is the consumer's */
+    uint32_t readNs;                        /* How long the read that filled the slot took, 0 when not timed */
+    uint16_t eagains;                       /* EAGAIN returns since the previous read, AVIO only */
+    uint16_t shortRead;                     /* Boolean. The read wasn't whole transport packets, or was truncated */
+    unsigned char pkts[PKT_RING_SLOT_BYTES];
+};
+
+/* What the slots ended up in */
+enum pkt_ring_backing_e
+{
+    PKT_RING_HEAP = 0,
+    PKT_RING_HUGETLB,                       /* Reserved hugepages, MAP_HUGETLB */
+    PKT_RING_THP,                           /* Anonymous mapping, transparent hugepages requested */
+};
+
+#define PKT_RING_HUGEPAGE_BYTES (2 * 1024 * 1024)
+
+struct pkt_ring_s
+{
+    struct pkt_ring_slot_s *slots;
+    uint32_t count;                         /* Number of slots, a power of two */
+    uint32_t mask;
+    enum pkt_ring_backing_e backing;
+    size_t mappedBytes;                     /* Of slots, when mapped */
+
+    /* Free running indexes, each on its own cache line so the threads don't false share. */
+    _Alignas(64) _Atomic uint32_t head;     /* Next slot the producer fills. Written by the producer only. */
+    _Alignas(64) _Atomic uint32_t tail;     /* Next slot the consumer drains. Written by the consumer only. */
+
+    /* Producer side counters, readable from any thread. */
+    _Alignas(64) _Atomic uint64_t overruns; /* Batches dropped because the ring was full */
+    _Atomic uint32_t highWaterMark;         /* Deepest fill level seen, in slots */
+};
+
+static const char *pkt_ring_backing_name(enum pkt_ring_backing_e backing)
+{
+    switch (backing) {
+    case PKT_RING_HEAP: return "normal pages";
+    case PKT_RING_HUGETLB: return "hugepages";
+    case PKT_RING_THP: return "transparent hugepages";
+    }
+    return "unknown";
+}
+
+/* Slots on hugepages, so a deep ring costs a handful of TLB entries instead of thousands.
+ * Reserved hugepages first, then a mapping the kernel may back with transparent hugepages.
+ * Pages are touched here so the receive path never takes a fault. Linux only.
+ */
+static int pkt_ring_map(struct pkt_ring_s *r, size_t bytes)
+{
+#if defined(__linux__)
+    size_t len = (bytes + PKT_RING_HUGEPAGE_BYTES - 1) & ~((size_t)PKT_RING_HUGEPAGE_BYTES - 1);
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+        r->backing = PKT_RING_HUGETLB;
+    } else {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return -1;
+        r->backing = madvise(p, len, MADV_HUGEPAGE) == 0 ? PKT_RING_THP : PKT_RING_HEAP;
+    }
+    memset(p, 0, len);
+    r->slots = p;
+    r->mappedBytes = len;
+    return 0; /* Success */
+#else
+    return -1;
+#endif
+}
+
+/**
+ * @brief         Allocate a ring.
+ * @param[out]    struct pkt_ring_s **ring - new ring
+ * @param[in]     uint32_t slots - Requested depth, rounded up to a power of two.
+ * @param[in]     int hugepages - Boolean. Try to put the slots on hugepages, see ring->backing for the outcome.
+ * @return          0 - Success
+ * @return        < 0 - Error
+ */
+static int pkt_ring_alloc(struct pkt_ring_s **ring, uint32_t slots, int hugepages)
+{
+    uint32_t count = 16;
+    while (count < slots && count < 0x80000000)
+        count <<= 1;
+
+    struct pkt_ring_s *r = aligned_alloc(64, sizeof(*r));
+    if (!r)
+        return -1;
+    memset(r, 0, sizeof(*r));
+
+    if (!hugepages || pkt_ring_map(r, sizeof(struct pkt_ring_slot_s) * count) < 0) {
+        r->slots = malloc(sizeof(struct pkt_ring_slot_s) * count);
+    }
+    if (!r->slots) {
+        free(r);
+        return -1;
+    }
+    r->count = count;
+    r->mask = count - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->overruns, 0);
+    atomic_init(&r->highWaterMark, 0);
+
+    *ring = r;
+    return 0; /* Success */
+}
+
+static void pkt_ring_free(struct pkt_ring_s *ring)
+{
+    if (ring->mappedBytes) {
+#if defined(__linux__)
+        munmap(ring->slots, ring->mappedBytes);
+#endif
+    } else {
+        free(ring->slots);
+    }
+    free(ring);
+}
+
+/* Number of slots waiting for the consumer. */
+static uint32_t pkt_ring_depth(struct pkt_ring_s *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+        atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+/* Producer: the next free slot, or NULL if the ring is full. Nothing is visible to the
+ * consumer until pkt_ring_producer_commit().
+ */
+static struct pkt_ring_slot_s *pkt_ring_producer_slot(struct pkt_ring_s *ring)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= ring->count)
+        return NULL; /* Full */
+
+    return &ring->slots[head & ring->mask];
+}
+
+/* Producer: how many slots can be filled before the ring is full. Used by receivers that
+ * fill several slots per system call, see pkt_ring_producer_slot_at().
+ */
+static uint32_t pkt_ring_producer_available(struct pkt_ring_s *ring)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return ring->count - (head - tail);
+}
+
+/* Producer: the nth free slot, n must be less than pkt_ring_producer_available(). */
+static struct pkt_ring_slot_s *pkt_ring_producer_slot_at(struct pkt_ring_s *ring, uint32_t n)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return &ring->slots[(head + n) & ring->mask];
+}
+
+/* Producer: publish the first count free slots in one go. */
+static void pkt_ring_producer_commit_n(struct pkt_ring_s *ring, uint32_t count)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed) + count;
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+
+    uint32_t depth = head - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (depth > atomic_load_explicit(&ring->highWaterMark, memory_order_relaxed))
+        atomic_store_explicit(&ring->highWaterMark, depth, memory_order_relaxed);
+}
+
+/* Producer: publish the slot from pkt_ring_producer_slot(). */
+static void pkt_ring_producer_commit(struct pkt_ring_s *ring)
+{
+    pkt_ring_producer_commit_n(ring, 1);
+}
+
+/* Producer: count batches that were received but had nowhere to go. */
+static void pkt_ring_producer_overrun_n(struct pkt_ring_s *ring, uint32_t count)
+{
+    atomic_fetch_add_explicit(&ring->overruns, count, memory_order_relaxed);
+}
+
+static void pkt_ring_producer_overrun(struct pkt_ring_s *ring)
+{
+    pkt_ring_producer_overrun_n(ring, 1);
+}
+
+/* Consumer: the oldest filled slot, or NULL if the ring is empty. */
+static struct pkt_ring_slot_s *pkt_ring_consumer_slot(struct pkt_ring_s *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (head == tail)
+        return NULL; /* Empty */
+
+    return &ring->slots[tail & ring->mask];
+}
+
+/* Consumer: hand the slot from pkt_ring_consumer_slot() back to the producer. */
+static void pkt_ring_consumer_release(struct pkt_ring_s *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static uint64_t pkt_ring_overruns(struct pkt_ring_s *ring)
+{
+    return atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+}
+
+static uint32_t pkt_ring_high_water_mark(struct pkt_ring_s *ring)
+{
+    return atomic_load_explicit(&ring->highWaterMark, memory_order_relaxed);
+}
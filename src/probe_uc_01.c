@@ -1,7 +1,13 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* recvmmsg() */
+#endif
+
 #include <stdio.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -13,64 +19,561 @@
 #include "nal_h264.c"
 #include "misc.c"
 #include "bitreader.c"
+#include "h264_params.c"
+#include "hevc_params.c"
+#include "rolling_stats.c"
+#include "latency.c"
+#include "static_detect.c"
+#include "pes_arena.c"
+#include "pes_asm.c"
+#include "keyframe.c"
+#include "pkt_ring.c"
+#include "run_profile.c"
+#include "udp_rx.c"
+#include "stream_clock.c"
+#include "ts_file.c"
+#include "mlp.c"
+#include "online.c"
+#include "record.c"
+#include "segment_store.c"
+#include "publisher.c"
 
 /* Keep the linker happy for some off issue in older */
 const uint8_t ff_golomb_vlc_len[512];
 const uint8_t ff_ue_golomb_vlc_code[512];
 
-static int gRunning = 1;
+static volatile int gRunning = 1;
 
 struct tool_stats_s
 {
     time_t unixtime;                        /* Walltime, when the sample period ended and the stats were announced */
 
+    unsigned int program_number;            /* Service these stats describe */
+    unsigned int video_pid;
+    unsigned int video_stream_type;         /* PMT stream_type, 0x1b H.264, 0x24 HEVC */
+
     unsigned int day_of_week;               /* 0-6, where 0 is sunday */
     unsigned int hrs;                       /* 0-23 */
     unsigned int mins;                      /* 0-59 */
     unsigned int secs;                      /* 0-59 */
     unsigned int avc_ibp_total_slice_count; /* Number of I/B/P slices counted in this reporting period */
     unsigned int avc_ibp_total_slice_size;  /* Size in bits of all summed NAL slices */
-    unsigned int transport_bit_count;       /* Number of bits counted for the entire stream in this reporting period */
+    unsigned int transport_bit_count;       /* Number of bits counted for the entire stream (or with -A the service pids) in this reporting period */
 
     unsigned int slice_i_count;             /* Number of I frames in this reporting period */
     unsigned int slice_b_count;             /* Number of B frames in this reporting period */
     unsigned int slice_p_count;             /* Number of P frames in this reporting period */
 
+    unsigned int slice_qp_slices;           /* Slices whose header parsed completely, so the QP is known, this reporting period */
+    unsigned int slice_qp_sum;
+    unsigned int slice_qp_min;              /* Lowest and highest slice QP, 0 when no slices parsed */
+    unsigned int slice_qp_max;
+    float slice_qp_avg;                     /* Mean slice QP, or < 0 when no slices parsed. Filled when the period completes. */
+    unsigned int poc_reorder_count;         /* Pictures presented ahead of the picture decoded before them (B frame reordering) */
+    unsigned int irap_count;                /* Random access pictures, H.264 IDR or HEVC IDR/CRA/BLA, this reporting period */
+
+    struct rolling_bucket_s frame_bits;     /* Slice bits of each picture presented this period */
+    struct rolling_result_s frame_bits_window[ROLLING_WINDOWS]; /* Trailing 1s, 5s and 60s of frame_bits. Filled when the period completes. */
+
+    unsigned int static_slices;             /* Slices fingerprinted this period, see static_detect.c */
+    unsigned int static_repeats;            /* Of those, identical to the previous picture or to the previous GOP */
+    unsigned int static_size_pictures;      /* Pictures whose size was compared with the previous GOP */
+    float static_size_sum;
+    float static_slice_repeat_ratio;        /* static_repeats / static_slices, or < 0 without slices. Filled when the period completes. */
+    float static_size_similarity;           /* Mean picture size similarity with the previous GOP, 1.0 identical, or < 0 */
+    float static_score;                     /* 0 (moving) to 1 (still image), or < 0 when unknown */
+
     int on_air;                             /* Boolean. Label issued by the probe that is human influence, used for supervised learning. */
 
-    char json[256];                         /* Fully formed json string that announced stats to external mechanisms. */
+    unsigned int ring_high_water;           /* Deepest the ingest ring got (in slots) during this reporting period */
+    unsigned int ring_overruns;             /* Network reads dropped because the ingest ring was full, this reporting period */
+    unsigned int publish_queued;            /* Records waiting for the publisher when the period ended, all services */
+    unsigned int publish_dropped;           /* Records the publisher discarded this reporting period, all services */
+    unsigned int pes_arena_in_use_kb;       /* PES buffers held when the period ended, all services */
+    unsigned int pes_arena_reserved_kb;     /* Allocated by the arena, in use or free */
+    unsigned int pes_arena_high_water_kb;   /* Most held at once this period */
+    unsigned int pes_arena_failures;        /* PES dropped this period because the arena was at its cap */
+
+    int64_t stream_time_ms;                 /* End of the reporting period on the stream clock, ms since the first PCR */
+
+    float on_air_probability;               /* On air prediction of the -M model for this period, or < 0 without one */
+
+    /* -L, hot path instrumentation. Only in the record with -L, see stats_fields_latency[] */
+    struct latency_summary_s latency[LATENCY_STAGES]; /* Per stage, this reporting period */
+    unsigned int read_count;                /* Reads analyzed this period, whole stream */
+    unsigned int read_bytes_min;
+    unsigned int read_bytes_max;
+    unsigned int read_eagain_count;         /* avio_read() returned EAGAIN and the ingest thread slept */
+    unsigned int short_read_count;          /* Reads that weren't whole transport packets, or datagrams truncated */
+    unsigned int cc_error_count;            /* Continuity counter errors this period, whole stream */
+
+    /* -K, keyframe decode. Only in the record with -K, see stats_fields_keyframe[]. Counted as decodes
+     * complete, which trails the period of the picture by the decode time.
+     */
+    unsigned int kf_decoded;                /* Keyframes decoded this period */
+    unsigned int kf_shed_budget;            /* Keyframes skipped, the service was over its CPU budget */
+    unsigned int kf_shed_busy;              /* Keyframes skipped, the decode threads were busy */
+    unsigned int kf_decode_errors;
+    unsigned int kf_cpu_us;                 /* Decode thread CPU time spent on the service */
+    float kf_luma_mean;                     /* 0-255, mean over the keyframes decoded, the floats are < 0 without any */
+    float kf_luma_hist[KEYFRAME_HIST_BINS]; /* Fraction of luma samples in each band of 32 levels */
+    float kf_black_ratio;                   /* Fraction of luma samples at or below KEYFRAME_BLACK_LEVEL */
+    float kf_frame_diff;                    /* Mean absolute luma change from the previous keyframe decoded, 0-1 */
+    float kf_colour_bars;                   /* Fraction of the keyframes decoded that showed colour bars */
+
+    /* -O, the in probe learner. Only in the record with -O, see stats_fields_online[] */
+    float online_on_air_probability;        /* Its prediction for this period, made before training on it */
+    float online_agreement;                 /* Recent fraction of labelled periods it predicted as the human labelled them, < 0 before any */
+    unsigned int online_updates;            /* Labelled periods it has trained on */
+
+    char record[RECORD_MAX_BYTES];          /* Fully formed json string or binary record that announced stats to external mechanisms. */
+    int recordLength;
+};
+
+struct tool_ctx_s;
+
+/* Reporting periods a service can hold open at once. Slices are counted in the period of their
+ * PTS, which is typically a second or so ahead of the PCR they arrive with.
+ */
+#define STATS_WINDOWS 64
+
+enum video_codec_e
+{
+    VIDEO_CODEC_H264 = 0,
+    VIDEO_CODEC_HEVC,
+};
+
+/* One monitored video service. Owned by the analysis thread, or by a single worker when a
+ * worker pool is in use, never both.
+ */
+struct service_ctx_s
+{
+    struct tool_ctx_s *ctx;
+    int programNumber;
+    int pid;                 /* Video pid */
+    int streamId;            /* Video PES stream id, -S or learned from the first PES header, -1 until known */
+    int pcrPid;
+    int worker;              /* Index of the worker that analyzes this service */
+
+    struct pes_asm_s *pe;    /* PES reassembly, buffers from ctx->pesArena */
+    void *counter;           /* Or, with -C, a packet level slice counter */
+    struct h264_slice_counter_results_s counterLast; /* Counter totals when the last period completed */
+    struct ltn_nal_headers_array_s nals; /* Reused for every PES, no per-frame allocations */
+    int streamType;          /* PMT stream_type of the video pid, selects the codec */
+    enum video_codec_e codec;
+    struct h264_params_s h264; /* Parameter sets seen on the video pid, needed for anything past slice_type */
+    struct hevc_params_s hevc;
+    int lastPoc;             /* Picture order count of the last picture decoded, valid when havePoc */
+    int havePoc;             /* Boolean */
+    struct rolling_stats_s frameStats; /* Trailing windows of picture sizes */
+    int64_t lastFrameTs;     /* DTS (or PTS) of the last picture, 90KHz, valid when haveFrameTs */
+    int haveFrameTs;         /* Boolean */
+    struct static_detect_s staticDetect; /* Slice fingerprints of the last picture and GOP */
+    struct keyframe_stream_s *keyframe; /* -K, intra pictures go to the decode pool */
+    struct online_s online;  /* -O, this services on air learner */
+
+    /* -L, the stages that run on the thread owning the service. Per period, and since start. */
+    struct latency_hist_s latency[LATENCY_STAGES];
+    struct latency_hist_s latencyTotal[LATENCY_STAGES];
+
+    /* The services own PCR, relates video PTS values to the stream clock the periods are cut on */
+    struct stream_clock_s clock;
+    int64_t clockMs;         /* Stream clock time of the packets currently being written */
+
+    /* Collections of stats / features this probe will expose */
+    struct tool_stats_s stats_curr;
+    struct tool_stats_s windows[STATS_WINDOWS]; /* Open periods, indexed by period number & (STATS_WINDOWS - 1) */
+    int64_t windowNext;      /* Oldest period not yet completed */
+};
+
+#define MAX_SERVICES 64
+
+/* Everything a service needs to close a reporting period, captured by the analysis thread at the
+ * period boundary and handed to whichever thread owns the service.
+ */
+struct period_s
+{
+    int64_t window;          /* Period number, stream clock ms / collection interval */
+    time_t now;
+    int on_air;
+    int labelled;            /* Boolean. The human has labelled since start, on_air is a label worth training on */
+    unsigned int ring_high_water;
+    unsigned int ring_overruns;
+    unsigned int publish_queued;
+    unsigned int publish_dropped;
+    unsigned int pes_arena_in_use_kb;
+    unsigned int pes_arena_reserved_kb;
+    unsigned int pes_arena_high_water_kb;
+    unsigned int pes_arena_failures;
+
+    /* -L, the analysis thread stages and counters */
+    struct latency_summary_s latency[LATENCY_STAGES];
+    unsigned int read_count;
+    unsigned int read_bytes_min;
+    unsigned int read_bytes_max;
+    unsigned int read_eagain_count;
+    unsigned int short_read_count;
+    unsigned int cc_error_count;
+};
+_Static_assert(sizeof(struct period_s) <= PKT_RING_SLOT_BYTES, "periods are handed to workers in a ring slot");
+
+/* The marker of a worker ring slot */
+enum worker_marker_e
+{
+    WORKER_PACKETS = 0,
+    WORKER_PERIOD,           /* pkts holds a struct period_s, close it on the workers services */
+    WORKER_STOP,             /* Nothing follows, the analysis thread has drained the input */
+};
+
+struct worker_ctx_s
+{
+    struct tool_ctx_s *ctx;
+    int index;
+    pthread_t threadId;
+    struct pkt_ring_s *ring; /* Packets for this workers services and period markers, from the analysis thread */
 };
 
 struct tool_ctx_s
 {
     int verbose;
     int humanOnAir;          /* Boolean. Defaults false. Drives the stats on_air boolean at the end of each collection period. */
+    int humanLabelled;       /* Boolean. SIGUSR1 or SIGUSR2 has been received, humanOnAir is a real label */
 
-    time_t now;              /* last walltime a buffer of transport packets was received. */
-    time_t lastStatsReport;  /* Walltime of the last stats period ending. */
+    time_t now;              /* Walltime the buffer of transport packets being analyzed was received. */
+    int64_t window;          /* Current reporting period on the stream clock, -1 until the first PCR */
+    struct stream_clock_s clock; /* Follows the first PCR in the stream, cuts the reporting periods */
+    unsigned int ringHighWater; /* Deepest ingest ring fill seen this reporting period */
 
     AVIOContext *c;
     char *iname;             /* -i udp://227.1.1.1:4001 */
+    int useNativeUDP;        /* Boolean. Receive udp:// urls with recvmmsg() instead of AVIO, linux only. */
+    int countOnly;           /* Boolean. -C, count H.264 slices straight from the packets, no PES reassembly */
+
+    /* -L, time the hot path stages and count transport damage, adds the instrumentation section to records.
+     * The analysis thread stages (read, model) and read counters for the current period, and since start.
+     */
+    int instrument;          /* Boolean */
+    struct latency_hist_s latency[LATENCY_STAGES];
+    struct latency_hist_s latencyTotal[LATENCY_STAGES];
+    unsigned int readCount;
+    unsigned int readBytesMin;
+    unsigned int readBytesMax;
+    unsigned int readEagains;
+    unsigned int shortReads;
+    uint64_t ccErrorsLast;   /* pid stats CC error count at the end of the last reporting period */
+    struct udp_rx_s *udp;    /* Native receiver, when in use AVIO is not opened */
+
+    struct run_profile_s profile; /* -X, thread placement, scheduling and ring memory */
+
+    /* PES reassembly buffers for every service, see pes_arena.c */
+    struct pes_arena_s *pesArena;
+    int pesArenaMB;          /* -m cap */
+    uint64_t pesFailuresLast; /* Arena failures at the end of the last reporting period */
+
+    /* -K threads[:percent], decode intra pictures for pixel features */
+    int keyframeThreads;
+    int keyframeBudgetPct;   /* Of one core, per service */
+    struct keyframe_pool_s *keyframePool;
+
+    /* File replay. -i names a regular file, which is mapped and analyzed as fast as possible
+     * with time taken from the PCR. No ingest thread, no AVIO.
+     */
+    struct ts_file_s *file;
+    time_t replayEpoch;      /* Walltime of the first PCR. -T, or derived from the file mtime. */
+    char *bname;             /* -B results.json, replay throughput appended in the bench_uc_01 -j format */
+    uint64_t replayPackets;
+    struct timespec replayStart;
 
     char *oname;             /* /tmp/mynamedpipe */
     FILE *ofh;               /* filehandle of oname */
-
-    int collectInterval;     /* Number of seconds in each reporting interval */
+    int outputBinary;        /* Boolean. -F binary, fixed layout records (record.c) instead of json */
+
+    /* Records are written by their own thread, see publisher.c */
+    struct publisher_s *publisher;
+    int publishPolicySet;    /* Boolean. -Q was given, otherwise block for replays and drop-oldest live */
+    enum publisher_policy_e publishPolicy;
+    int publishQueueDepth;   /* Records */
+    uint64_t publishDroppedLast; /* Publisher drop count at the end of the last reporting period */
+
+    /* Optional on disk feature store, binary records whatever -F says. See segment_store.c */
+    char *storeDir;          /* -d /var/lib/uc01 */
+    int storeSeconds;        /* Segment length */
+    struct segment_store_s *store;
+    struct publisher_s *storePublisher;
+
+    int collectIntervalMs;   /* Length of each reporting period, on the stream clock */
     int pid;                 /* Transport packet pid for the video stream, Eg. 0x31 */
     int streamId;            /* PMT estype for the video PES, typically 0xe0 */
+    int streamIdSet;         /* Boolean. -S was given, otherwise services learn their stream id */
+
+    /* PSI tracking. Once the services are known the stream model only sees the PAT and PMT pids,
+     * and services are only rebuilt when something they depend on changes.
+     */
+    int psiLocked;           /* Boolean. Filtering the model input on psiPids */
+    uint64_t psiSignature;   /* Of the last PAT acted on, see psi_signature() */
+    uint8_t psiPids[8192];   /* Boolean per pid, the PMTs of the PAT acted on and of any newer PAT */
+    unsigned char *psiBuf;   /* The PSI packets of the buffer being analyzed */
+    unsigned int psiChanges; /* Models that changed the services */
+
+    /* Monitored video services. By default the first video service in the PAT, with -A all of them. */
+    int allServices;         /* Boolean */
+    int serviceCount;
+    struct service_ctx_s *services[MAX_SERVICES];
+    struct service_ctx_s *pidToService[8192]; /* With -A, every elementary pid of a service. Otherwise unused. */
+
+    /* Optional pool of analysis workers, services are sharded across them. 0 = analyze inline. */
+    int workerCount;
+    struct worker_ctx_s *workers;
+
+    unsigned char *buf;      /* Scratch buffer AVIO reads into when the ingest ring is full, contents are discarded */
+
+    /* Receive thread pushes transport packets into ring, the analysis thread (main) drains it. */
+    struct pkt_ring_s *ring;
+    int ringSlots;           /* Depth of the ring, in network reads */
+    pthread_t ingestThreadId;
+    uint64_t ringOverrunsLast; /* Ring overrun count at the end of the last reporting period */
+
+    /* Optional on air classifier, scores every record. See training/uc01-export-model.py */
+    char *mname;
+    struct mlp_s *model;
+    int modelFeatures[MLP_MAX_FEATURES]; /* Index in fields[] of each model input */
+
+    /* -O features[:rate], on air classifier learned per service from the SIGUSR labels, see online.c */
+    char *onlineSpec;        /* default, or comma separated record field names */
+    float onlineRate;
+    int onlineFeatureCount;  /* 0 without -O */
+    int onlineFeatures[ONLINE_MAX_FEATURES]; /* Index in fields[] of each learner input */
+
+    /* Layout of every record, stats_fields[] and with -L stats_fields_latency[] after it */
+    struct record_field_s *fields;
+    int fieldCount;
 
-    unsigned char *buf;      /* Buffer, typically 4K, where transport packets from AVIO are read into */
-
-    void *pe;                /* PES Extractor handle */
     void *sm;                /* Stream Model handle */
 
     /* Transport stream statistics. Bitrates, CC loss etc. */
     struct ltntstools_stream_statistics_s *stream;
+};
 
-    /* Collections of stats / features this probe will expose */
-    struct tool_stats_s stats_curr;
-    struct tool_stats_s stats_next;
+_Static_assert(sizeof(time_t) == sizeof(int64_t), "unixtime is serialized as RECORD_I64");
+
+/* The published record, in output order. Names are the json keys of training/uc01-schema.json,
+ * keep the two in step.
+ */
+static const struct record_field_s stats_fields[] = {
+    { "program_number",            RECORD_U32,  offsetof(struct tool_stats_s, program_number) },
+    { "video_pid",                 RECORD_U32,  offsetof(struct tool_stats_s, video_pid) },
+    { "video_stream_type",         RECORD_U32,  offsetof(struct tool_stats_s, video_stream_type) },
+    { "day_of_week",               RECORD_U32,  offsetof(struct tool_stats_s, day_of_week) },
+    { "hour",                      RECORD_U32,  offsetof(struct tool_stats_s, hrs) },
+    { "minute",                    RECORD_U32,  offsetof(struct tool_stats_s, mins) },
+    { "second",                    RECORD_U32,  offsetof(struct tool_stats_s, secs) },
+    { "unixtime",                  RECORD_I64,  offsetof(struct tool_stats_s, unixtime) },
+    { "avc_ibp_total_slice_count", RECORD_U32,  offsetof(struct tool_stats_s, avc_ibp_total_slice_count) },
+    { "avc_ibp_total_slice_size",  RECORD_U32,  offsetof(struct tool_stats_s, avc_ibp_total_slice_size) },
+    { "transport_bit_count",       RECORD_U32,  offsetof(struct tool_stats_s, transport_bit_count) },
+    { "i_count",                   RECORD_U32,  offsetof(struct tool_stats_s, slice_i_count) },
+    { "p_count",                   RECORD_U32,  offsetof(struct tool_stats_s, slice_p_count) },
+    { "b_count",                   RECORD_U32,  offsetof(struct tool_stats_s, slice_b_count) },
+    { "slice_qp_avg",              RECORD_F32,  offsetof(struct tool_stats_s, slice_qp_avg), .optional = 1 },
+    { "slice_qp_min",              RECORD_U32,  offsetof(struct tool_stats_s, slice_qp_min) },
+    { "slice_qp_max",              RECORD_U32,  offsetof(struct tool_stats_s, slice_qp_max) },
+    { "poc_reorder_count",         RECORD_U32,  offsetof(struct tool_stats_s, poc_reorder_count) },
+    { "irap_count",                RECORD_U32,  offsetof(struct tool_stats_s, irap_count) },
+    { "frame_bits_ewma_1s",        RECORD_F32,  offsetof(struct tool_stats_s, frame_bits_window[0].ewma), .optional = 1 },
+    { "frame_bits_mean_1s",        RECORD_F32,  offsetof(struct tool_stats_s, frame_bits_window[0].mean) },
+    { "frame_bits_stddev_1s",      RECORD_F32,  offsetof(struct tool_stats_s, frame_bits_window[0].stddev) },
+    { "frame_bits_min_1s",         RECORD_U32,  offsetof(struct tool_stats_s, frame_bits_window[0].min) },
+    { "frame_bits_max_1s",         RECORD_U32,  offsetof(struct tool_stats_s, frame_bits_window[0].max) },
+    { "frame_bits_ewma_5s",        RECORD_F32,  offsetof(struct tool_stats_s, frame_bits_window[1].ewma), .optional = 1 },
+    { "frame_bits_mean_5s",        RECORD_F32,  offsetof(struct tool_stats_s, frame_bits_window[1].mean) },
+    { "frame_bits_stddev_5s",      RECORD_F32,  offsetof(struct tool_stats_s, frame_bits_window[1].stddev) },
+    { "frame_bits_min_5s",         RECORD_U32,  offsetof(struct tool_stats_s, frame_bits_window[1].min) },
+    { "frame_bits_max_5s",         RECORD_U32,  offsetof(struct tool_stats_s, frame_bits_window[1].max) },
+    { "frame_bits_ewma_60s",       RECORD_F32,  offsetof(struct tool_stats_s, frame_bits_window[2].ewma), .optional = 1 },
+    { "frame_bits_mean_60s",       RECORD_F32,  offsetof(struct tool_stats_s, frame_bits_window[2].mean) },
+    { "frame_bits_stddev_60s",     RECORD_F32,  offsetof(struct tool_stats_s, frame_bits_window[2].stddev) },
+    { "frame_bits_min_60s",        RECORD_U32,  offsetof(struct tool_stats_s, frame_bits_window[2].min) },
+    { "frame_bits_max_60s",        RECORD_U32,  offsetof(struct tool_stats_s, frame_bits_window[2].max) },
+    { "static_slice_repeat_ratio", RECORD_F32,  offsetof(struct tool_stats_s, static_slice_repeat_ratio), .optional = 1 },
+    { "static_size_similarity",    RECORD_F32,  offsetof(struct tool_stats_s, static_size_similarity), .optional = 1 },
+    { "static_score",              RECORD_F32,  offsetof(struct tool_stats_s, static_score), .optional = 1 },
+    { "ring_high_water",           RECORD_U32,  offsetof(struct tool_stats_s, ring_high_water) },
+    { "ring_overruns",             RECORD_U32,  offsetof(struct tool_stats_s, ring_overruns) },
+    { "publish_queued",            RECORD_U32,  offsetof(struct tool_stats_s, publish_queued) },
+    { "publish_dropped",           RECORD_U32,  offsetof(struct tool_stats_s, publish_dropped) },
+    { "pes_arena_in_use_kb",       RECORD_U32,  offsetof(struct tool_stats_s, pes_arena_in_use_kb) },
+    { "pes_arena_reserved_kb",     RECORD_U32,  offsetof(struct tool_stats_s, pes_arena_reserved_kb) },
+    { "pes_arena_high_water_kb",   RECORD_U32,  offsetof(struct tool_stats_s, pes_arena_high_water_kb) },
+    { "pes_arena_failures",        RECORD_U32,  offsetof(struct tool_stats_s, pes_arena_failures) },
+    { "stream_time_ms",            RECORD_I64,  offsetof(struct tool_stats_s, stream_time_ms) },
+    { "on_air_probability",        RECORD_F32,  offsetof(struct tool_stats_s, on_air_probability), .optional = 1 },
+    { "on_air",                    RECORD_BOOL, offsetof(struct tool_stats_s, on_air) },
+};
+#define STATS_FIELD_COUNT (int)(sizeof(stats_fields) / sizeof(stats_fields[0]))
+
+#define STATS_LATENCY_FIELDS(n, stage) \
+    { "lat_" n "_count",           RECORD_U32,  offsetof(struct tool_stats_s, latency[stage].count) }, \
+    { "lat_" n "_p50_ns",          RECORD_U32,  offsetof(struct tool_stats_s, latency[stage].p50) }, \
+    { "lat_" n "_p99_ns",          RECORD_U32,  offsetof(struct tool_stats_s, latency[stage].p99) }, \
+    { "lat_" n "_max_ns",          RECORD_U32,  offsetof(struct tool_stats_s, latency[stage].max) }
+
+/* The optional instrumentation section, -L */
+static const struct record_field_s stats_fields_latency[] = {
+    STATS_LATENCY_FIELDS("read", LATENCY_READ),
+    STATS_LATENCY_FIELDS("model", LATENCY_MODEL),
+    STATS_LATENCY_FIELDS("pes", LATENCY_PES),
+    STATS_LATENCY_FIELDS("nal", LATENCY_NAL),
+    STATS_LATENCY_FIELDS("publish", LATENCY_PUBLISH),
+    { "read_count",                RECORD_U32,  offsetof(struct tool_stats_s, read_count) },
+    { "read_bytes_min",            RECORD_U32,  offsetof(struct tool_stats_s, read_bytes_min) },
+    { "read_bytes_max",            RECORD_U32,  offsetof(struct tool_stats_s, read_bytes_max) },
+    { "read_eagain_count",         RECORD_U32,  offsetof(struct tool_stats_s, read_eagain_count) },
+    { "short_read_count",          RECORD_U32,  offsetof(struct tool_stats_s, short_read_count) },
+    { "cc_error_count",            RECORD_U32,  offsetof(struct tool_stats_s, cc_error_count) },
 };
+#define STATS_LATENCY_FIELD_COUNT (int)(sizeof(stats_fields_latency) / sizeof(stats_fields_latency[0]))
+
+/* The optional keyframe decode section, -K */
+static const struct record_field_s stats_fields_keyframe[] = {
+    { "kf_decoded",                RECORD_U32,  offsetof(struct tool_stats_s, kf_decoded) },
+    { "kf_shed_budget",            RECORD_U32,  offsetof(struct tool_stats_s, kf_shed_budget) },
+    { "kf_shed_busy",              RECORD_U32,  offsetof(struct tool_stats_s, kf_shed_busy) },
+    { "kf_decode_errors",          RECORD_U32,  offsetof(struct tool_stats_s, kf_decode_errors) },
+    { "kf_cpu_us",                 RECORD_U32,  offsetof(struct tool_stats_s, kf_cpu_us) },
+    { "kf_luma_mean",              RECORD_F32,  offsetof(struct tool_stats_s, kf_luma_mean), .optional = 1 },
+    { "kf_luma_hist_0",           RECORD_F32,  offsetof(struct tool_stats_s, kf_luma_hist[0]), .optional = 1 },
+    { "kf_luma_hist_1",           RECORD_F32,  offsetof(struct tool_stats_s, kf_luma_hist[1]), .optional = 1 },
+    { "kf_luma_hist_2",           RECORD_F32,  offsetof(struct tool_stats_s, kf_luma_hist[2]), .optional = 1 },
+    { "kf_luma_hist_3",           RECORD_F32,  offsetof(struct tool_stats_s, kf_luma_hist[3]), .optional = 1 },
+    { "kf_luma_hist_4",           RECORD_F32,  offsetof(struct tool_stats_s, kf_luma_hist[4]), .optional = 1 },
+    { "kf_luma_hist_5",           RECORD_F32,  offsetof(struct tool_stats_s, kf_luma_hist[5]), .optional = 1 },
+    { "kf_luma_hist_6",           RECORD_F32,  offsetof(struct tool_stats_s, kf_luma_hist[6]), .optional = 1 },
+    { "kf_luma_hist_7",           RECORD_F32,  offsetof(struct tool_stats_s, kf_luma_hist[7]), .optional = 1 },
+    { "kf_black_ratio",            RECORD_F32,  offsetof(struct tool_stats_s, kf_black_ratio), .optional = 1 },
+    { "kf_frame_diff",             RECORD_F32,  offsetof(struct tool_stats_s, kf_frame_diff), .optional = 1 },
+    { "kf_colour_bars",            RECORD_F32,  offsetof(struct tool_stats_s, kf_colour_bars), .optional = 1 },
+};
+#define STATS_KEYFRAME_FIELD_COUNT (int)(sizeof(stats_fields_keyframe) / sizeof(stats_fields_keyframe[0]))
+
+/* The optional in probe learner section, -O */
+static const struct record_field_s stats_fields_online[] = {
+    { "online_on_air_probability", RECORD_F32,  offsetof(struct tool_stats_s, online_on_air_probability) },
+    { "online_agreement",          RECORD_F32,  offsetof(struct tool_stats_s, online_agreement), .optional = 1 },
+    { "online_updates",            RECORD_U32,  offsetof(struct tool_stats_s, online_updates) },
+};
+#define STATS_ONLINE_FIELD_COUNT (int)(sizeof(stats_fields_online) / sizeof(stats_fields_online[0]))
+
+_Static_assert(STATS_FIELD_COUNT + STATS_LATENCY_FIELD_COUNT + STATS_KEYFRAME_FIELD_COUNT + STATS_ONLINE_FIELD_COUNT <=
+    RECORD_MAX_FIELDS, "the widest record must stay readable by store_uc_01");
+
+/* The record layout, fixed once options are parsed */
+static int stats_fields_init(struct tool_ctx_s *ctx)
+{
+    ctx->fieldCount = STATS_FIELD_COUNT + (ctx->instrument ? STATS_LATENCY_FIELD_COUNT : 0) +
+        (ctx->keyframeThreads ? STATS_KEYFRAME_FIELD_COUNT : 0) + (ctx->onlineSpec ? STATS_ONLINE_FIELD_COUNT : 0);
+    ctx->fields = malloc(ctx->fieldCount * sizeof(struct record_field_s));
+    if (!ctx->fields)
+        return -1;
+
+    int n = STATS_FIELD_COUNT;
+    memcpy(ctx->fields, stats_fields, sizeof(stats_fields));
+    if (ctx->instrument) {
+        memcpy(ctx->fields + n, stats_fields_latency, sizeof(stats_fields_latency));
+        n += STATS_LATENCY_FIELD_COUNT;
+    }
+    if (ctx->keyframeThreads) {
+        memcpy(ctx->fields + n, stats_fields_keyframe, sizeof(stats_fields_keyframe));
+        n += STATS_KEYFRAME_FIELD_COUNT;
+    }
+    if (ctx->onlineSpec) {
+        memcpy(ctx->fields + n, stats_fields_online, sizeof(stats_fields_online));
+    }
+    return 0; /* Success */
+}
+
+static int stats_field_find(struct tool_ctx_s *ctx, const char *name)
+{
+    for (int j = 0; j < ctx->fieldCount; j++) {
+        if (strcmp(name, ctx->fields[j].name) == 0)
+            return j;
+    }
+    return -1;
+}
+
+/* Resolve the models feature names against the record, once, at startup */
+static int stats_features_bind(struct tool_ctx_s *ctx)
+{
+    for (int i = 0; i < ctx->model->featureCount; i++) {
+        ctx->modelFeatures[i] = stats_field_find(ctx, ctx->model->featureNames[i]);
+        if (ctx->modelFeatures[i] < 0) {
+            fprintf(stderr, "Model feature %s is not produced by this probe\n", ctx->model->featureNames[i]);
+            return -1;
+        }
+    }
+    return 0; /* Success */
+}
+
+static float stats_predict(struct tool_ctx_s *ctx, struct tool_stats_s *stats)
+{
+    float features[MLP_MAX_FEATURES];
+    for (int i = 0; i < ctx->model->featureCount; i++) {
+        features[i] = record_field_value(&ctx->fields[ctx->modelFeatures[i]], stats);
+    }
+    return mlp_predict(ctx->model, features);
+}
+
+/* Resolve the -O feature names against the record, once, at startup. The label and the
+ * learners own outputs are refused, it would be learning from the answer.
+ */
+static int online_features_bind(struct tool_ctx_s *ctx)
+{
+    char *names = strdup(ctx->onlineSpec);
+    if (!names)
+        return -1;
+
+    int ret = 0;
+    ctx->onlineFeatureCount = 0;
+    if (strcmp(names, "default") == 0) {
+        for (int i = 0; i < ONLINE_DEFAULT_FEATURE_COUNT; i++) {
+            ctx->onlineFeatures[ctx->onlineFeatureCount++] = stats_field_find(ctx, online_default_features[i]);
+        }
+    } else {
+        char *save = NULL;
+        for (char *name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+            int j = stats_field_find(ctx, name);
+            if (j < 0 || strcmp(name, "on_air") == 0 || strncmp(name, "online_", 7) == 0) {
+                fprintf(stderr, "Online feature %s is not produced by this probe or can't be learned from\n", name);
+                ret = -1;
+                break;
+            }
+            if (ctx->onlineFeatureCount == ONLINE_MAX_FEATURES) {
+                fprintf(stderr, "Online learner takes at most %d features\n", ONLINE_MAX_FEATURES);
+                ret = -1;
+                break;
+            }
+            ctx->onlineFeatures[ctx->onlineFeatureCount++] = j;
+        }
+    }
+
+    free(names);
+    return ctx->onlineFeatureCount ? ret : -1;
+}
+
+/* Score the period with the services learner, then train it on the label if there is one */
+static void stats_online(struct tool_ctx_s *ctx, struct service_ctx_s *svc, struct period_s *period)
+{
+    float features[ONLINE_MAX_FEATURES];
+    for (int i = 0; i < ctx->onlineFeatureCount; i++) {
+        const struct record_field_s *f = &ctx->fields[ctx->onlineFeatures[i]];
+        features[i] = record_field_value(f, &svc->stats_curr);
+        if (f->optional && features[i] < 0)
+            features[i] = NAN; /* Absent this period, not a value to learn from */
+    }
+    svc->stats_curr.online_on_air_probability = online_observe(&svc->online, features,
+        period->labelled ? period->on_air : -1);
+    svc->stats_curr.online_agreement = svc->online.agreement;
+    svc->stats_curr.online_updates = svc->online.updates;
+}
 
 const char *slice_type_name(int slice_type)
 {
@@ -93,10 +596,12 @@ static void signal_handler(int signum)
     case SIGUSR1: /* Human says - Off air */
         printf("Supervision: We're OFF AIR\n");
         ctx->humanOnAir = 0;
+        ctx->humanLabelled = 1;
         break;
     case SIGUSR2: /* Human says - On air */
         printf("Supervision: We're ON AIR\n");
         ctx->humanOnAir = 1;
+        ctx->humanLabelled = 1;
         break;
     case SIGINT:
     case SIGTERM:
@@ -112,109 +617,258 @@ static void stats_reset(struct tool_stats_s *stats)
     memset(stats, 0, sizeof(*stats));
 }
 
-static int stats_to_json(struct tool_ctx_s *ctx, struct tool_stats_s *stats)
-{
-    sprintf(stats->json, "{ \"day_of_week\": %d, \"hour\": %d, \"minute\": %2d, \"second\": %2d, "
-        "\"unixtime\": %lu, \"avc_ibp_total_slice_count\": %3d, \"avc_ibp_total_slice_size\": %9d, "
-        "\"transport_bit_count\": %9d, "
-        "\"i_count\": %3d, "
-        "\"p_count\": %3d, "
-        "\"b_count\": %3d, "
-        "\"on_air\": %s }\n",
-        stats->day_of_week,
-        stats->hrs,
-        stats->mins,
-        stats->secs,
-        stats->unixtime,
-        stats->avc_ibp_total_slice_count,
-        stats->avc_ibp_total_slice_size,
-        stats->transport_bit_count,
-        stats->slice_i_count,
-        stats->slice_p_count,
-        stats->slice_b_count,
-        stats->on_air ? "true" : "false");
+static int stats_format(struct tool_ctx_s *ctx, struct tool_stats_s *stats)
+{
+    if (ctx->outputBinary) {
+        stats->recordLength = record_to_binary(ctx->fields, ctx->fieldCount, stats, (uint8_t *)stats->record, sizeof(stats->record));
+    } else {
+        stats->recordLength = record_to_json(ctx->fields, ctx->fieldCount, stats, stats->record, sizeof(stats->record));
+    }
+    if (stats->recordLength < 0) {
+        fprintf(stderr, "Stats record truncated, not published\n");
+        return -1;
+    }
 
-    return 0;
+    return 0; /* Success */
 }
 
+/* Hand the record to the publisher thread, never blocks unless -Q block was asked for */
 static int stats_publish(struct tool_ctx_s *ctx, struct tool_stats_s *stats)
 {
-    if (ctx->ofh) {
-        fwrite(stats->json, 1, strlen(stats->json), ctx->ofh);
-        fflush(ctx->ofh);
-    } else {
-        printf("%s", stats->json);
-    }
-
-    return -1;
+    return publisher_write(ctx->publisher, stats->record, stats->recordLength);
 }
 
-static void stats_complete(struct tool_ctx_s *ctx)
+/* Binary streams start with a description of the record layout. Only ever to -o. */
+static int stats_publish_header(struct tool_ctx_s *ctx)
 {
-    ctx->stats_next.unixtime = ctx->now;
-    ctx->stats_curr = ctx->stats_next;
+    uint8_t hdr[RECORD_MAX_BYTES];
+    int len = record_binary_header(ctx->fields, ctx->fieldCount, hdr, sizeof(hdr));
+    if (len < 0)
+        return -1;
 
-    struct tm *t = localtime(&ctx->now);
-    ctx->stats_curr.day_of_week = t->tm_wday;
-    ctx->stats_curr.hrs = t->tm_hour;
-    ctx->stats_curr.mins = t->tm_min;
-    ctx->stats_curr.secs = t->tm_sec;
-    ctx->stats_curr.on_air = ctx->humanOnAir;
+    fwrite(hdr, 1, len, ctx->ofh);
+    fflush(ctx->ofh);
 
-    stats_reset(&ctx->stats_next);
-    stats_to_json(ctx, &ctx->stats_curr);
-    stats_publish(ctx, &ctx->stats_curr);
+    return 0; /* Success */
 }
 
-static void *callback(void *userContext, struct ltn_pes_packet_s *pes)
+/* The open period that counts belong in. Late arrivals land in the oldest open period, and
+ * anything implausibly far ahead in the newest.
+ */
+static struct tool_stats_s *stats_window(struct service_ctx_s *svc, int64_t window)
 {
-    struct tool_ctx_s *ctx = (struct tool_ctx_s *)userContext;
-    BitReader br;
+    if (window < svc->windowNext) {
+        window = svc->windowNext;
+    } else
+    if (window >= svc->windowNext + STATS_WINDOWS) {
+        window = svc->windowNext + STATS_WINDOWS - 1;
+    }
+    return &svc->windows[window & (STATS_WINDOWS - 1)];
+}
 
-    if (ctx->verbose > 1) {
-        ltn_pes_packet_dump(pes, "");
+static void stats_complete(struct service_ctx_s *svc, struct period_s *period)
+{
+    struct tool_ctx_s *ctx = svc->ctx;
+
+    if (period->window < svc->windowNext)
+        return; /* Service was created after this period ended */
+
+    struct tool_stats_s *stats = &svc->windows[period->window & (STATS_WINDOWS - 1)];
+    stats->unixtime = period->now;
+    svc->stats_curr = *stats;
+    stats_reset(stats);
+    svc->windowNext = period->window + 1;
+
+    struct tm t;
+    localtime_r(&period->now, &t);
+    svc->stats_curr.program_number = svc->programNumber;
+    svc->stats_curr.video_pid = svc->pid;
+    svc->stats_curr.video_stream_type = svc->streamType;
+    svc->stats_curr.day_of_week = t.tm_wday;
+    svc->stats_curr.hrs = t.tm_hour;
+    svc->stats_curr.mins = t.tm_min;
+    svc->stats_curr.secs = t.tm_sec;
+    svc->stats_curr.on_air = period->on_air;
+    svc->stats_curr.ring_high_water = period->ring_high_water;
+    svc->stats_curr.ring_overruns = period->ring_overruns;
+    svc->stats_curr.publish_queued = period->publish_queued;
+    svc->stats_curr.publish_dropped = period->publish_dropped;
+    svc->stats_curr.pes_arena_in_use_kb = period->pes_arena_in_use_kb;
+    svc->stats_curr.pes_arena_reserved_kb = period->pes_arena_reserved_kb;
+    svc->stats_curr.pes_arena_high_water_kb = period->pes_arena_high_water_kb;
+    svc->stats_curr.pes_arena_failures = period->pes_arena_failures;
+    svc->stats_curr.stream_time_ms = (period->window + 1) * ctx->collectIntervalMs;
+    if (svc->counter) {
+        /* Counted as the packets arrived, there's no PTS to place them by */
+        struct h264_slice_counter_results_s r;
+        h264_slice_counter_query(svc->counter, &r);
+        svc->stats_curr.slice_i_count = r.i - svc->counterLast.i;
+        svc->stats_curr.slice_p_count = r.p - svc->counterLast.p;
+        svc->stats_curr.slice_b_count = r.b - svc->counterLast.b;
+        svc->stats_curr.avc_ibp_total_slice_count = (r.i + r.p + r.b + r.si + r.sp) -
+            (svc->counterLast.i + svc->counterLast.p + svc->counterLast.b + svc->counterLast.si + svc->counterLast.sp);
+        svc->stats_curr.avc_ibp_total_slice_size = (r.sliceBytes - svc->counterLast.sliceBytes) * 8;
+        svc->counterLast = r;
+    }
+    svc->stats_curr.slice_qp_avg = svc->stats_curr.slice_qp_slices ?
+        (float)svc->stats_curr.slice_qp_sum / svc->stats_curr.slice_qp_slices : -1.0f;
+
+    /* Repeated slices are the evidence of a still picture. Picture sizes tracking the last GOP
+     * alone are common in live video, so they only discount the score, by up to half.
+     */
+    svc->stats_curr.static_slice_repeat_ratio = svc->stats_curr.static_slices ?
+        (float)svc->stats_curr.static_repeats / svc->stats_curr.static_slices : -1.0f;
+    svc->stats_curr.static_size_similarity = svc->stats_curr.static_size_pictures ?
+        svc->stats_curr.static_size_sum / svc->stats_curr.static_size_pictures : -1.0f;
+    svc->stats_curr.static_score = svc->stats_curr.static_slice_repeat_ratio;
+    if (svc->stats_curr.static_score >= 0 && svc->stats_curr.static_size_similarity >= 0)
+        svc->stats_curr.static_score *= 0.5f + (0.5f * svc->stats_curr.static_size_similarity);
+    rolling_stats_push(&svc->frameStats, &svc->stats_curr.frame_bits);
+    for (int i = 0; i < ROLLING_WINDOWS; i++) {
+        rolling_stats_query(&svc->frameStats, i, &svc->stats_curr.frame_bits_window[i]);
+    }
+    if (ctx->keyframeThreads) {
+        struct keyframe_features_s f;
+        memset(&f, 0, sizeof(f));
+        if (svc->keyframe) {
+            keyframe_take(svc->keyframe, &f);
+        }
+        svc->stats_curr.kf_decoded = f.decoded;
+        svc->stats_curr.kf_shed_budget = f.shedBudget;
+        svc->stats_curr.kf_shed_busy = f.shedBusy;
+        svc->stats_curr.kf_decode_errors = f.errors;
+        svc->stats_curr.kf_cpu_us = f.cpuNs / 1000;
+        svc->stats_curr.kf_luma_mean = f.decoded ? f.lumaSum / f.decoded : -1.0f;
+        for (int i = 0; i < KEYFRAME_HIST_BINS; i++) {
+            svc->stats_curr.kf_luma_hist[i] = f.decoded ? f.histSum[i] / f.decoded : -1.0f;
+        }
+        svc->stats_curr.kf_black_ratio = f.decoded ? f.blackSum / f.decoded : -1.0f;
+        svc->stats_curr.kf_frame_diff = f.diffCount ? f.diffSum / f.diffCount : -1.0f;
+        svc->stats_curr.kf_colour_bars = f.decoded ? (float)f.bars / f.decoded : -1.0f;
+    }
+    svc->stats_curr.on_air_probability = ctx->model ? stats_predict(ctx, &svc->stats_curr) : -1.0f;
+    if (ctx->onlineFeatureCount) {
+        stats_online(ctx, svc, period);
+    }
+
+    if (ctx->instrument) {
+        memcpy(svc->stats_curr.latency, period->latency, sizeof(period->latency));
+        for (int i = LATENCY_PES; i < LATENCY_STAGES; i++) {
+            latency_summarize(&svc->latency[i], &svc->stats_curr.latency[i]);
+            latency_merge(&svc->latencyTotal[i], &svc->latency[i]);
+            latency_reset(&svc->latency[i]);
+        }
+        svc->stats_curr.read_count = period->read_count;
+        svc->stats_curr.read_bytes_min = period->read_bytes_min;
+        svc->stats_curr.read_bytes_max = period->read_bytes_max;
+        svc->stats_curr.read_eagain_count = period->read_eagain_count;
+        svc->stats_curr.short_read_count = period->short_read_count;
+        svc->stats_curr.cc_error_count = period->cc_error_count;
+    }
+
+    uint64_t t0 = ctx->instrument ? latency_now_ns() : 0;
+    if (stats_format(ctx, &svc->stats_curr) == 0) {
+        stats_publish(ctx, &svc->stats_curr);
     }
+    if (ctx->instrument) {
+        latency_add(&svc->latency[LATENCY_PUBLISH], latency_now_ns() - t0);
+    }
+
+    if (ctx->storePublisher) {
+        uint8_t rec[RECORD_MAX_BYTES];
+        int len = record_to_binary(ctx->fields, ctx->fieldCount, &svc->stats_curr, rec, sizeof(rec));
+        if (len > 0) {
+            publisher_write_record(ctx->storePublisher, rec, len, svc->stats_curr.unixtime, svc->stats_curr.on_air);
+        }
+    }
+}
+
+/* Count the slices of one H.264 PES, returns the picture size in bits */
+static uint32_t analyze_h264(struct service_ctx_s *svc, struct tool_stats_s *stats, struct pes_asm_packet_s *pes)
+{
+    struct tool_ctx_s *ctx = svc->ctx;
+    struct h264_slice_header_s sh;
+    uint32_t frameBits = 0;
 
-    int arrayLength = 0;
-    struct ltn_nal_headers_s *array = NULL;
-    if (ltn_nal_h264_find_headers(pes->data, pes->dataLengthBytes, &array, &arrayLength) == 0) {
+    if (ltn_nal_h264_find_headers_array(pes->data, pes->dataLengthBytes, &svc->nals) == 0) {
 
-        for (int i = 0; i < arrayLength; i++) {
-            struct ltn_nal_headers_s *e = array + i;
+        for (int i = 0; i < svc->nals.count; i++) {
+            struct ltn_nal_headers_s *e = &svc->nals.items[i];
 
             switch(e->nalType) {
             case 1:
             case 2:
             case 3:
             case 4:
-            case 5:  /* slice_layer_without_partitioning_rbsp */
-
-                ltn_nal_h264_strip_emulation_prevention(e);
+            case 5: { /* slice_layer_without_partitioning_rbsp */
 
-                init_bitreader(&br, e->ptr + 4, 4);
-                int first_mb_in_slice = read_ue(&br);
-                int slice_type = read_ue(&br);
+                /* Emulation prevention bytes are skipped lazily, only the header bytes we read are touched.
+                 * Without the parameter sets (start up) only first_mb_in_slice and slice_type are known.
+                 */
+                int parsed = h264_params_slice_header(&svc->h264, e->ptr + 4, e->lengthBytes - 4,
+                    e->nalType, (e->ptr[3] >> 5) & 3, &sh) == 0;
+                int slice_type = sh.slice_type;
 
                 if (ctx->verbose) {
-                    printf("slice_type %s (%d), first_mb_in_slice %d\n", slice_type_name(slice_type), slice_type, first_mb_in_slice);
+                    printf("program %d: slice_type %s (%d), first_mb_in_slice %d", svc->programNumber,
+                        slice_type_name(slice_type), slice_type, sh.first_mb_in_slice);
+                    if (parsed)
+                        printf(", frame_num %d, qp %d", sh.frame_num, sh.qp);
+                    if (parsed && sh.pic_order_cnt != INT_MIN)
+                        printf(", poc %d", sh.pic_order_cnt);
+                    printf("\n");
                 }
 
-                ctx->stats_next.avc_ibp_total_slice_count++;
-                ctx->stats_next.avc_ibp_total_slice_size += (e->lengthBytes * 8);
+                if (e->nalType == 5 && sh.first_mb_in_slice == 0) {
+                    stats->irap_count++;
+                }
+
+                if (parsed) {
+                    unsigned int qp = sh.qp < 0 ? 0 : sh.qp;
+                    if (stats->slice_qp_slices == 0 || qp < stats->slice_qp_min)
+                        stats->slice_qp_min = qp;
+                    if (stats->slice_qp_slices == 0 || qp > stats->slice_qp_max)
+                        stats->slice_qp_max = qp;
+                    stats->slice_qp_sum += qp;
+                    stats->slice_qp_slices++;
+
+                    if (sh.pic_order_cnt != INT_MIN) {
+                        if (svc->havePoc && !sh.idr && sh.pic_order_cnt < svc->lastPoc)
+                            stats->poc_reorder_count++;
+                        svc->lastPoc = sh.pic_order_cnt;
+                        svc->havePoc = 1;
+                    }
+
+                    int r = static_detect_slice(&svc->staticDetect, sh.idr, slice_type % 5,
+                        e->ptr + 4 + sh.header_bytes, e->lengthBytes - 4 - sh.header_bytes);
+                    if (r >= 0) {
+                        stats->static_slices++;
+                        stats->static_repeats += r;
+                    }
+                }
+
+                stats->avc_ibp_total_slice_count++;
+                stats->avc_ibp_total_slice_size += (e->lengthBytes * 8);
+                frameBits += (e->lengthBytes * 8);
                 if (slice_type % 5 == 0) {
-                    ctx->stats_next.slice_p_count++;
+                    stats->slice_p_count++;
                 } else
                 if (slice_type % 5 == 1) {
-                    ctx->stats_next.slice_b_count++;
+                    stats->slice_b_count++;
                 } else
                 if (slice_type % 5 == 2) {
-                    ctx->stats_next.slice_i_count++;
+                    stats->slice_i_count++;
                 }
 
                 break;
-            case 6:  /* SEI */
+            }
             case 7:  /* SPS */
+                h264_params_sps(&svc->h264, e->ptr + 4, e->lengthBytes - 4);
+                break;
             case 8:  /* PPS */
+                h264_params_pps(&svc->h264, e->ptr + 4, e->lengthBytes - 4);
+                break;
+            case 6:  /* SEI */
             case 9:  /* AUD */
             case 12: /* FILLER */
             case 19: /* ACP */
@@ -249,20 +903,897 @@ static void *callback(void *userContext, struct ltn_pes_packet_s *pes)
 
     }
 
-    ltn_pes_packet_free(pes);
+    return frameBits;
+}
 
-    return NULL;
+/* Count the slice segments of one HEVC PES, returns the picture size in bits. Same record fields
+ * as H.264; QP and POC need the reference picture sets and aren't reported for HEVC.
+ */
+static uint32_t analyze_hevc(struct service_ctx_s *svc, struct tool_stats_s *stats, struct pes_asm_packet_s *pes)
+{
+    struct tool_ctx_s *ctx = svc->ctx;
+    struct hevc_slice_header_s sh;
+    uint32_t frameBits = 0;
+
+    if (ltn_nal_hevc_find_headers_array(pes->data, pes->dataLengthBytes, &svc->nals) < 0)
+        return 0;
+
+    for (int i = 0; i < svc->nals.count; i++) {
+        struct ltn_nal_headers_s *e = &svc->nals.items[i];
+        if (e->lengthBytes < 5)
+            continue;
+
+        /* Two byte nal header, the payload starts after it */
+        const uint8_t *payload = e->ptr + 5;
+        int payloadLength = e->lengthBytes - 5;
+
+        if (HEVC_NAL_IS_VCL(e->nalType)) {
+            int parsed = hevc_params_slice_header(&svc->hevc, payload, payloadLength, e->nalType, &sh) == 0;
+
+            if (ctx->verbose) {
+                printf("program %d: %s, slice_type %d%s\n", svc->programNumber, e->nalName, sh.slice_type,
+                    sh.dependent_slice_segment_flag ? " (dependent)" : "");
+            }
+
+            stats->avc_ibp_total_slice_count++;
+            stats->avc_ibp_total_slice_size += (e->lengthBytes * 8);
+            frameBits += (e->lengthBytes * 8);
+            if (sh.irap && sh.first_slice_segment_in_pic_flag == 1) {
+                stats->irap_count++;
+            }
+            if (!parsed)
+                continue;
+
+            int r = static_detect_slice(&svc->staticDetect, sh.irap, sh.slice_type,
+                payload + sh.header_bytes, payloadLength - sh.header_bytes);
+            if (r >= 0) {
+                stats->static_slices++;
+                stats->static_repeats += r;
+            }
+
+            if (sh.slice_type == HEVC_SLICE_P) {
+                stats->slice_p_count++;
+            } else
+            if (sh.slice_type == HEVC_SLICE_B) {
+                stats->slice_b_count++;
+            } else
+            if (sh.slice_type == HEVC_SLICE_I) {
+                stats->slice_i_count++;
+            }
+        } else
+        if (e->nalType == HEVC_NAL_SPS) {
+            hevc_params_sps(&svc->hevc, payload, payloadLength);
+        } else
+        if (e->nalType == HEVC_NAL_PPS) {
+            hevc_params_pps(&svc->hevc, payload, payloadLength);
+        }
+    }
+
+    return frameBits;
+}
+
+static void callback(void *userContext, struct pes_asm_packet_s *pes)
+{
+    struct service_ctx_s *svc = (struct service_ctx_s *)userContext;
+    struct tool_ctx_s *ctx = svc->ctx;
+
+    if (ctx->verbose > 1) {
+        printf("program %d: PES %d bytes, PTS %" PRId64 ", DTS %" PRId64 "\n", svc->programNumber,
+            pes->dataLengthBytes, (pes->PTS_DTS_flags & 2) ? pes->PTS : -1, pes->PTS_DTS_flags == 3 ? pes->DTS : -1);
+    }
+
+    /* Count the slices in the period they're presented in, not the one they arrived in. The PTS
+     * is related to the stream clock through the PCR of this service.
+     */
+    int64_t ms = svc->clockMs;
+    if ((pes->PTS_DTS_flags & 2) && svc->clock.locked) {
+        int64_t lead = (int64_t)(pes->PTS * 300) - (int64_t)svc->clock.lastPCR;
+        if (lead > STREAM_CLOCK_WRAP / 2) {
+            lead -= STREAM_CLOCK_WRAP;
+        } else
+        if (lead < -(STREAM_CLOCK_WRAP / 2)) {
+            lead += STREAM_CLOCK_WRAP;
+        }
+        ms += lead / (STREAM_CLOCK_HZ / 1000);
+    }
+    struct tool_stats_s *stats = stats_window(svc, ms / ctx->collectIntervalMs);
+    unsigned int slices = stats->avc_ibp_total_slice_count;
+    unsigned int intraSlices = stats->slice_i_count;
+
+    uint64_t t0 = ctx->instrument ? latency_now_ns() : 0;
+    uint32_t frameBits;
+    if (svc->codec == VIDEO_CODEC_HEVC) {
+        frameBits = analyze_hevc(svc, stats, pes);
+    } else {
+        frameBits = analyze_h264(svc, stats, pes);
+    }
+    if (ctx->instrument) {
+        latency_add(&svc->latency[LATENCY_NAL], latency_now_ns() - t0);
+    }
+
+    /* Pictures made only of I slices are worth decoding, the pool decides if there's time */
+    slices = stats->avc_ibp_total_slice_count - slices;
+    intraSlices = stats->slice_i_count - intraSlices;
+    if (svc->keyframe && slices && slices == intraSlices) {
+        keyframe_submit(svc->keyframe, pes->data, pes->dataLengthBytes);
+    }
+
+    /* A video PES carries one picture, feed its size to the rolling windows */
+    if (frameBits) {
+        int64_t dtMs = 0;
+        if (pes->PTS_DTS_flags & 2) {
+            int64_t ts = pes->PTS_DTS_flags == 3 ? pes->DTS : pes->PTS;
+            if (svc->haveFrameTs) {
+                dtMs = ((ts - svc->lastFrameTs) & ((1LL << 33) - 1)) / 90;
+                if (dtMs > 1000)
+                    dtMs = 0; /* Discontinuity */
+            }
+            svc->lastFrameTs = ts;
+            svc->haveFrameTs = 1;
+        }
+        rolling_bucket_add(&stats->frame_bits, frameBits);
+        rolling_stats_ewma(&svc->frameStats, frameBits, dtMs);
+
+        float similarity = static_detect_picture(&svc->staticDetect, frameBits / 8);
+        if (similarity >= 0) {
+            stats->static_size_sum += similarity;
+            stats->static_size_pictures++;
+        }
+    }
 }
 
 static void usage(const char *prog)
 {
-    printf("Usage: %s -i <url> -v -P 0xnn (video pid) -S 0xe0 (estype) -I secs (collect_interval)\n", prog);
+    printf("Usage: %s -i <url> -v -P 0xnn (video pid) -S 0xe0 (estype) -I secs (collect_interval) -R slots (ingest ring depth, def 8192)\n", prog);
+    printf("  -I periods are cut on the stream clock (PCR), 0.1 to 15 seconds, eg. -I 0.25 (def 1)\n");
+    printf("  -S the video PES stream id is normally taken from the first PES header of each service, -S forces it\n");
+    printf("  -N use the native recvmmsg() receiver for udp:// urls, kernel receive timestamps (linux)\n");
+    printf("  -C count H.264 slices straight from the transport packets, no PES reassembly. Slice counts and sizes only,\n");
+    printf("     by arrival rather than PTS, no QP/POC/picture size features\n");
+    printf("  -A monitor every video service in the PAT, one record per service per interval\n");
+    printf("  -W n analysis worker threads, services are sharded across them (def 0, analyze inline)\n");
+    printf("  -F json|binary record format (def json), binary is described in record.c and requires -o\n");
+    printf("  -Q policy[:depth] when the record consumer falls behind, drop-oldest, drop-newest or block (def drop-oldest:4096, replays block)\n");
+    printf("  -d dir[:secs] also store every record in rotating segment files, read with store_uc_01 (def 3600 secs per segment)\n");
+    printf("  -M model.txt score every record with an exported on air classifier, adds on_air_probability\n");
+    printf("  -O features[:rate] learn on air in the probe from the SIGUSR1 (off) / SIGUSR2 (on) labels, per service,\n");
+    printf("     logistic regression updated every labelled period. features is default or comma separated record\n");
+    printf("     fields, rate the SGD step (def %.2f). Adds online_on_air_probability, online_agreement, online_updates\n",
+        ONLINE_DEFAULT_RATE);
+    printf("  -T unixtime walltime of the first PCR when -i is a .ts file (def file mtime minus capture duration)\n");
+    printf("  -B results.json when -i is a .ts file, append the end to end packets/s and ns/packet as json lines\n");
+    printf("  -L instrument the hot path, per stage latency (p50/p99/max) and read, EAGAIN, short read and CC error\n");
+    printf("     counts are added to every record. With -v the full latency histograms are printed at exit\n");
+    printf("  -X profile, comma separated: ingest=cpu analysis=cpu publish=cpu workers=first[-last] pin threads,\n");
+    printf("     fifo=prio SCHED_FIFO receive thread, hugepages packet rings, lock mlockall(). What was granted is\n");
+    printf("     reported at startup, eg. -X ingest=2,analysis=3,publish=4,fifo=50,hugepages,lock\n");
+    printf("  -m mb cap on PES reassembly memory shared by all services, PES that don't fit are dropped (def 256)\n");
+    printf("  -K threads[:percent] decode I pictures with libavcodec on a pool of idle priority threads, adds luma\n");
+    printf("     histogram, black, keyframe difference and colour bar features. Each service may use percent of\n");
+    printf("     one core (def 5), keyframes over budget or while the pool is busy are skipped. Which ones depends\n");
+    printf("     on timing, so live kf_ features don't repeat. A .ts replay decodes every I picture instead, no\n");
+    printf("     budget, analysis waits for the pool, and repeats exactly except kf_cpu_us\n");
 }
 
-int main(int argc, char *argv[])
+/* Receive thread. Do as little as possible here, pull data from the network and push it into
+ * the ring, so analysis spikes (large IDRs, a blocked named pipe) never back up into the socket.
+ */
+static void *ingest_thread_func(void *p)
+{
+    struct tool_ctx_s *ctx = (struct tool_ctx_s *)p;
+
+    while (gRunning && ctx->udp) {
+        /* Short timeout so we notice shutdown, no sleeping while data is waiting */
+        if (udp_rx_read(ctx->udp, ctx->ring, 100) < 0) {
+            perror("udp_rx");
+            break;
+        }
+    }
+
+    uint16_t eagains = 0;
+    while (gRunning && ctx->c) {
+        struct pkt_ring_slot_s *slot = pkt_ring_producer_slot(ctx->ring);
+
+        /* Keep draining the network even when the ring is full, count what we throw away. */
+        unsigned char *buf = slot ? slot->pkts : ctx->buf;
+
+        uint64_t t0 = ctx->instrument ? latency_now_ns() : 0;
+        int rlen = avio_read(ctx->c, buf, PKT_RING_SLOT_BYTES);
+        if (rlen == -EAGAIN) {
+            if (eagains < UINT16_MAX)
+                eagains++;
+            usleep(20 * 1000);
+            continue;
+        }
+        if (rlen < 0) {
+            break;
+        }
+
+        if (!slot) {
+            pkt_ring_producer_overrun(ctx->ring);
+            continue;
+        }
+
+        gettimeofday(&slot->ts, NULL);
+        slot->lengthBytes = rlen;
+        slot->marker = 0;
+        slot->readNs = ctx->instrument ? latency_now_ns() - t0 : 0;
+        slot->eagains = eagains;
+        slot->shortRead = rlen % 188 != 0;
+        eagains = 0;
+        pkt_ring_producer_commit(ctx->ring);
+    }
+
+    /* End of input, let the analysis thread drain and exit */
+    gRunning = 0;
+
+    return NULL;
+}
+
+static void service_free(struct service_ctx_s *svc)
+{
+    if (svc->pe) {
+        pes_asm_free(svc->pe);
+    }
+    if (svc->counter) {
+        h264_slice_counter_free(svc->counter);
+    }
+    if (svc->keyframe) {
+        keyframe_stream_free(svc->keyframe);
+    }
+    ltn_nal_headers_array_free(&svc->nals);
+    free(svc);
+}
+
+static struct service_ctx_s *service_find(struct tool_ctx_s *ctx, int programNumber)
+{
+    for (int i = 0; i < ctx->serviceCount; i++) {
+        if (ctx->services[i]->programNumber == programNumber)
+            return ctx->services[i];
+    }
+    return NULL;
+}
+
+/* PES reassembly of the video pid, into the shared arena */
+static void service_pes_alloc(struct service_ctx_s *svc)
+{
+    if (pes_asm_alloc(&svc->pe, svc->ctx->pesArena, svc->pid, svc->streamId, callback, svc) < 0) {
+        fprintf(stderr, "\nUnable to allocate PES reassembly.\n\n");
+        exit(1);
+    }
+}
+
+/* Find the first PES header on the video pid and take its stream id. Returns the index of that
+ * packet, where reassembly starts, or -1.
+ */
+static int service_stream_id(struct service_ctx_s *svc, const unsigned char *pkts, int packetCount)
+{
+    for (int i = 0; i < packetCount; i++) {
+        const unsigned char *pkt = &pkts[i * 188];
+        if (ltntstools_pid(pkt) != svc->pid || (pkt[1] & 0x40) == 0 || (pkt[3] & 0x10) == 0)
+            continue;
+
+        const unsigned char *p = pkt + 4;
+        if (pkt[3] & 0x20)
+            p += 1 + pkt[4];
+        if (pkt + 188 - p < 4 || p[0] != 0 || p[1] != 0 || p[2] != 1)
+            continue;
+
+        svc->streamId = p[3];
+        return i;
+    }
+    return -1;
+}
+
+/* Feed a service the transport packets routed to it, clockMs is the stream clock time they
+ * were analyzed at. Runs on the thread that owns the service.
+ */
+static void service_write(struct service_ctx_s *svc, const unsigned char *pkts, int packetCount, int64_t clockMs)
+{
+    svc->clockMs = clockMs;
+    stream_clock_write(&svc->clock, pkts, packetCount);
+    stats_window(svc, clockMs / svc->ctx->collectIntervalMs)->transport_bit_count += (packetCount * 188 * 8);
+
+    if (!svc->pe && !svc->counter && svc->streamId < 0) {
+        int i = service_stream_id(svc, pkts, packetCount);
+        if (i < 0)
+            return;
+        service_pes_alloc(svc);
+        pkts += i * 188;
+        packetCount -= i;
+    }
+
+    uint64_t t0 = svc->ctx->instrument ? latency_now_ns() : 0;
+    if (svc->pe) {
+        pes_asm_write(svc->pe, pkts, packetCount);
+    } else
+    if (svc->counter) {
+        h264_slice_counter_write(svc->counter, pkts, packetCount);
+    }
+    if (svc->ctx->instrument) {
+        latency_add(&svc->latency[LATENCY_PES], latency_now_ns() - t0);
+    }
+}
+
+/* Block until every worker has drained its ring, after which no worker touches any service
+ * until we push more work. Used before the service set is changed.
+ */
+static void workers_quiesce(struct tool_ctx_s *ctx)
+{
+    for (int i = 0; i < ctx->workerCount; i++) {
+        while (pkt_ring_depth(ctx->workers[i].ring)) {
+            usleep(100);
+        }
+    }
+}
+
+/* Queue a slot for a worker, waiting if it's behind. Any backlog ends up in the ingest ring,
+ * which is where overruns are counted.
+ */
+static struct pkt_ring_slot_s *worker_slot(struct worker_ctx_s *w)
+{
+    struct pkt_ring_slot_s *slot;
+    while ((slot = pkt_ring_producer_slot(w->ring)) == NULL) {
+        usleep(100);
+    }
+    return slot;
+}
+
+static void *worker_thread_func(void *p)
+{
+    struct worker_ctx_s *w = (struct worker_ctx_s *)p;
+    struct tool_ctx_s *ctx = w->ctx;
+
+    /* Runs until told to stop, not on gRunning. The analysis thread keeps pushing packets and
+     * periods after a SIGINT while it drains the ingest ring, and waits on this ring to do so.
+     */
+    while (1) {
+        struct pkt_ring_slot_s *slot = pkt_ring_consumer_slot(w->ring);
+        if (!slot) {
+            usleep(1000);
+            continue;
+        }
+
+        if (slot->marker == WORKER_STOP) {
+            pkt_ring_consumer_release(w->ring);
+            break;
+        } else
+        if (slot->marker == WORKER_PERIOD) {
+            /* End of a reporting period */
+            struct period_s period;
+            memcpy(&period, slot->pkts, sizeof(period));
+            for (int i = 0; i < ctx->serviceCount; i++) {
+                if (ctx->services[i]->worker == w->index) {
+                    stats_complete(ctx->services[i], &period);
+                }
+            }
+        } else {
+            /* Data slots carry the stream clock time, not walltime */
+            int64_t clockMs = ((int64_t)slot->ts.tv_sec * 1000) + (slot->ts.tv_usec / 1000);
+            if (!ctx->allServices) {
+                /* Single service mode, the slot is the whole stream and pidToService is unused */
+                if (ctx->serviceCount) {
+                    service_write(ctx->services[0], slot->pkts, slot->lengthBytes / 188, clockMs);
+                }
+            } else {
+                for (int i = 0; i < slot->lengthBytes; i += 188) {
+                    struct service_ctx_s *svc = ctx->pidToService[ltntstools_pid(&slot->pkts[i])];
+                    if (svc) {
+                        service_write(svc, &slot->pkts[i], 1, clockMs);
+                    }
+                }
+            }
+        }
+
+        pkt_ring_consumer_release(w->ring);
+    }
+
+    return NULL;
+}
+
+static void psi_mix(uint64_t *h, uint32_t v)
+{
+    *h = (*h ^ v) * 0x100000001b3ULL; /* FNV-1a, a word at a time */
+}
+
+/* Everything services_update() acts on. Versions alone aren't trusted, some muxes change a PMT
+ * without bumping it.
+ */
+static uint64_t psi_signature(struct ltntstools_pat_s *pat)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    psi_mix(&h, pat->transport_stream_id);
+    psi_mix(&h, pat->version);
+    psi_mix(&h, pat->program_count);
+    for (int i = 0; i < (int)pat->program_count; i++) {
+        struct ltntstools_pmt_s *pmt = &pat->programs[i].pmt;
+        uint16_t videopid = 0;
+        uint8_t estype = 0;
+        ltntstools_pmt_query_video_pid(pmt, &videopid, &estype);
+        psi_mix(&h, pat->programs[i].program_number);
+        psi_mix(&h, pat->programs[i].program_map_PID);
+        psi_mix(&h, pmt->version_number);
+        psi_mix(&h, pmt->PCR_PID);
+        psi_mix(&h, pmt->stream_count);
+        psi_mix(&h, (videopid << 8) | estype);
+        for (unsigned int j = 0; j < pmt->stream_count; j++) {
+            psi_mix(&h, pmt->streams[j].elementary_PID);
+        }
+    }
+    return h;
+}
+
+/* A PAT packet arrived while locked. Let the PMTs it lists through to the stream model straight
+ * away, a program added or a PMT moved by a new PAT could otherwise never complete the model. A PAT
+ * longer than one packet unlocks instead, the model sees the whole stream until it completes again.
+ */
+static void psi_pat_pids(struct tool_ctx_s *ctx, const unsigned char *pkt)
+{
+    if ((pkt[1] & 0x40) == 0 || (pkt[3] & 0x10) == 0)
+        return;
+
+    const unsigned char *p = pkt + 4;
+    if (pkt[3] & 0x20)
+        p += 1 + pkt[4];
+    if (p >= pkt + 188)
+        return;
+    p += 1 + p[0]; /* pointer_field */
+    if (pkt + 188 - p < 3 || p[0] != 0x00) /* table_id, program_association_section */
+        return;
+
+    int sectionLength = ((p[1] & 0x0f) << 8) | p[2];
+    const unsigned char *end = p + 3 + sectionLength - 4; /* CRC_32 */
+    if (sectionLength < 9 || end + 4 > pkt + 188) {
+        ctx->psiLocked = 0;
+        return;
+    }
+
+    for (p += 8; p + 4 <= end; p += 4) {
+        if ((p[0] << 8 | p[1]) != 0) /* 0 is the NIT */
+            ctx->psiPids[((p[2] & 0x1f) << 8) | p[3]] = 1;
+    }
+}
+
+/* The stream model completed, bring the set of monitored services in line with the PAT.
+ * A model identical to the last one acted on is ignored, so services keep their PES reassembly
+ * and any PES in flight.
+ */
+static void services_update(struct tool_ctx_s *ctx, struct ltntstools_pat_s *pat)
+{
+    struct service_ctx_s *found[MAX_SERVICES];
+    int foundCount = 0;
+
+    uint64_t signature = psi_signature(pat);
+    if (ctx->psiChanges && signature == ctx->psiSignature) {
+        ctx->psiLocked = 1; /* Nothing changed, eg. after a PAT too long for psi_pat_pids() */
+        return;
+    }
+    ctx->psiSignature = signature;
+    ctx->psiLocked = 1;
+    ctx->psiChanges++;
+
+    memset(ctx->psiPids, 0, sizeof(ctx->psiPids));
+    ctx->psiPids[0] = 1;
+    for (int i = 0; i < (int)pat->program_count; i++) {
+        if (pat->programs[i].program_number) /* 0 is the NIT */
+            ctx->psiPids[pat->programs[i].program_map_PID & 0x1fff] = 1;
+    }
+
+    workers_quiesce(ctx);
+
+    int e = 0;
+    struct ltntstools_pmt_s *pmt;
+    while (foundCount < MAX_SERVICES && ltntstools_pat_enum_services_video(pat, &e, &pmt) == 0) {
+        uint8_t estype;
+        uint16_t videopid;
+        if (ltntstools_pmt_query_video_pid(pmt, &videopid, &estype) < 0)
+            continue;
+
+        struct service_ctx_s *svc = service_find(ctx, pmt->program_number);
+        if (!svc) {
+            printf("Discovered program %5d, video pid 0x%04x, %s\n", pmt->program_number, videopid,
+                estype == 0x24 ? "HEVC" : "H.264");
+            svc = calloc(1, sizeof(*svc));
+            if (!svc) {
+                fprintf(stderr, "\nUnable to allocate service.\n\n");
+                exit(1);
+            }
+            svc->ctx = ctx;
+            svc->programNumber = pmt->program_number;
+            svc->pid = -1;
+            svc->pcrPid = -1;
+            svc->windowNext = ctx->window < 0 ? 0 : ctx->window;
+            rolling_stats_init(&svc->frameStats, ctx->collectIntervalMs);
+            static_detect_reset(&svc->staticDetect);
+            online_reset(&svc->online, ctx->onlineFeatureCount, ctx->onlineRate, 60000 / ctx->collectIntervalMs);
+        }
+        if (svc->pcrPid != pmt->PCR_PID) {
+            svc->pcrPid = pmt->PCR_PID;
+            stream_clock_init(&svc->clock, svc->pcrPid);
+        }
+        if (svc->pid != videopid || svc->streamType != estype) {
+            h264_params_reset(&svc->h264);
+            hevc_params_reset(&svc->hevc);
+            static_detect_reset(&svc->staticDetect);
+            svc->havePoc = 0;
+            if (svc->keyframe) {
+                keyframe_stream_free(svc->keyframe);
+                svc->keyframe = NULL;
+            }
+            if (svc->pe) {
+                pes_asm_free(svc->pe);
+                svc->pe = NULL;
+            }
+            if (svc->counter) {
+                h264_slice_counter_free(svc->counter);
+                svc->counter = NULL;
+            }
+            svc->streamId = ctx->streamIdSet ? ctx->streamId : -1;
+        }
+        svc->pid = videopid;
+        svc->streamType = estype;
+        svc->codec = estype == 0x24 ? VIDEO_CODEC_HEVC : VIDEO_CODEC_H264;
+        found[foundCount++] = svc;
+
+        int counting = ctx->countOnly && svc->codec == VIDEO_CODEC_H264;
+        if (counting && !svc->counter) {
+            /* A few hundred bytes of scanner state instead of megabytes of PES buffers */
+            svc->counter = h264_slice_counter_alloc(svc->pid);
+            memset(&svc->counterLast, 0, sizeof(svc->counterLast));
+            if (!svc->counter) {
+                fprintf(stderr, "\nUnable to allocate slice counter.\n\n");
+                exit(1);
+            }
+        } else
+        if (!counting && !svc->pe && svc->streamId >= 0) {
+            service_pes_alloc(svc);
+        }
+
+        if (ctx->keyframePool && !counting && !svc->keyframe &&
+            keyframe_stream_alloc(ctx->keyframePool, &svc->keyframe,
+                svc->codec == VIDEO_CODEC_HEVC ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264) < 0) {
+            fprintf(stderr, "Program %d: no %s decoder, keyframe features disabled\n", svc->programNumber,
+                svc->codec == VIDEO_CODEC_HEVC ? "HEVC" : "H.264");
+        }
+
+        if (!ctx->allServices) {
+            ctx->pid = svc->pid;
+            break;
+        }
+    }
+
+    /* Services that left the PAT */
+    for (int i = 0; i < ctx->serviceCount; i++) {
+        int keep = 0;
+        for (int j = 0; j < foundCount; j++) {
+            if (found[j] == ctx->services[i])
+                keep = 1;
+        }
+        if (!keep) {
+            printf("Program %5d removed\n", ctx->services[i]->programNumber);
+            service_free(ctx->services[i]);
+        }
+    }
+
+    memset(ctx->pidToService, 0, sizeof(ctx->pidToService));
+    for (int i = 0; i < foundCount; i++) {
+        found[i]->worker = ctx->workerCount ? (i % ctx->workerCount) : 0;
+        ctx->services[i] = found[i];
+    }
+    ctx->serviceCount = foundCount;
+
+    if (ctx->allServices) {
+        /* Every elementary stream of the service counts towards its transport bits */
+        e = 0;
+        while (ltntstools_pat_enum_services_video(pat, &e, &pmt) == 0) {
+            struct service_ctx_s *svc = service_find(ctx, pmt->program_number);
+            if (!svc)
+                continue;
+            for (unsigned int i = 0; i < pmt->stream_count; i++) {
+                ctx->pidToService[pmt->streams[i].elementary_PID & 0x1fff] = svc;
+            }
+            ctx->pidToService[pmt->PCR_PID & 0x1fff] = svc;
+        }
+    }
+}
+
+/* Close the reporting period for every service, on whichever thread owns it. */
+static void services_period_complete(struct tool_ctx_s *ctx, int64_t window)
+{
+    struct period_s period;
+    memset(&period, 0, sizeof(period));
+    period.window = window;
+    period.now = ctx->now;
+    period.on_air = ctx->humanOnAir;
+    period.labelled = ctx->humanLabelled;
+    period.ring_high_water = ctx->ringHighWater;
+
+    uint64_t overruns = pkt_ring_overruns(ctx->ring);
+    period.ring_overruns = overruns - ctx->ringOverrunsLast;
+    ctx->ringOverrunsLast = overruns;
+
+    uint64_t dropped = publisher_dropped(ctx->publisher);
+    period.publish_dropped = dropped - ctx->publishDroppedLast;
+    period.publish_queued = publisher_depth(ctx->publisher);
+    ctx->publishDroppedLast = dropped;
+    ctx->ringHighWater = 0;
+
+    struct pes_arena_stats_s arena;
+    pes_arena_query(ctx->pesArena, &arena, 1);
+    period.pes_arena_in_use_kb = arena.inUseBytes / 1024;
+    period.pes_arena_reserved_kb = arena.reservedBytes / 1024;
+    period.pes_arena_high_water_kb = arena.highWaterBytes / 1024;
+    period.pes_arena_failures = arena.failures - ctx->pesFailuresLast;
+    ctx->pesFailuresLast = arena.failures;
+
+    if (ctx->instrument) {
+        for (int i = LATENCY_READ; i <= LATENCY_MODEL; i++) {
+            latency_summarize(&ctx->latency[i], &period.latency[i]);
+            latency_merge(&ctx->latencyTotal[i], &ctx->latency[i]);
+            latency_reset(&ctx->latency[i]);
+        }
+        period.read_count = ctx->readCount;
+        period.read_bytes_min = ctx->readBytesMin;
+        period.read_bytes_max = ctx->readBytesMax;
+        period.read_eagain_count = ctx->readEagains;
+        period.short_read_count = ctx->shortReads;
+        ctx->readCount = 0;
+        ctx->readBytesMin = 0;
+        ctx->readBytesMax = 0;
+        ctx->readEagains = 0;
+        ctx->shortReads = 0;
+
+        uint64_t cc = ltntstools_pid_stats_stream_get_cc_errors(ctx->stream);
+        period.cc_error_count = cc - ctx->ccErrorsLast;
+        ctx->ccErrorsLast = cc;
+    }
+
+    if (ctx->workerCount == 0) {
+        for (int i = 0; i < ctx->serviceCount; i++) {
+            stats_complete(ctx->services[i], &period);
+        }
+        return;
+    }
+
+    for (int i = 0; i < ctx->workerCount; i++) {
+        struct pkt_ring_slot_s *slot = worker_slot(&ctx->workers[i]);
+        slot->marker = WORKER_PERIOD;
+        slot->lengthBytes = 0;
+        slot->ts.tv_sec = ctx->now;
+        slot->ts.tv_usec = 0;
+        memcpy(slot->pkts, &period, sizeof(period));
+        pkt_ring_producer_commit(ctx->workers[i].ring);
+    }
+}
+
+/* Once the input is drained, everything queued for the workers is analyzed and they exit */
+static void workers_stop(struct tool_ctx_s *ctx)
 {
-    int bsize = 4096, blen = 7 * 188;
+    for (int i = 0; i < ctx->workerCount; i++) {
+        struct pkt_ring_slot_s *slot = worker_slot(&ctx->workers[i]);
+        slot->marker = WORKER_STOP;
+        slot->lengthBytes = 0;
+        pkt_ring_producer_commit(ctx->workers[i].ring);
+    }
+    for (int i = 0; i < ctx->workerCount; i++) {
+        pthread_join(ctx->workers[i].threadId, NULL);
+    }
+}
 
+/* Route a buffer of transport packets to the services, inline or via their workers. */
+static void services_write(struct tool_ctx_s *ctx, const unsigned char *buf, int packetCount, int64_t clockMs)
+{
+    if (!ctx->allServices) {
+        /* Single service mode, the service sees the whole stream */
+        if (ctx->serviceCount == 0)
+            return;
+
+        if (ctx->workerCount == 0) {
+            service_write(ctx->services[0], buf, packetCount, clockMs);
+            return;
+        }
+    }
+
+    if (ctx->workerCount == 0) {
+        for (int i = 0; i < packetCount; i++) {
+            struct service_ctx_s *svc = ctx->pidToService[ltntstools_pid(&buf[i * 188])];
+            if (svc) {
+                service_write(svc, &buf[i * 188], 1, clockMs);
+            }
+        }
+        return;
+    }
+
+    /* Each worker gets one slot holding just the packets of its services */
+    struct pkt_ring_slot_s *slots[ctx->workerCount];
+    memset(slots, 0, sizeof(slots));
+
+    for (int i = 0; i < packetCount; i++) {
+        const unsigned char *pkt = &buf[i * 188];
+        struct service_ctx_s *svc = ctx->allServices ? ctx->pidToService[ltntstools_pid(pkt)] : ctx->services[0];
+        if (!svc)
+            continue;
+
+        struct worker_ctx_s *w = &ctx->workers[svc->worker];
+        if (!slots[w->index]) {
+            slots[w->index] = worker_slot(w);
+            slots[w->index]->marker = WORKER_PACKETS;
+            slots[w->index]->lengthBytes = 0;
+            slots[w->index]->ts.tv_sec = clockMs / 1000;
+            slots[w->index]->ts.tv_usec = (clockMs % 1000) * 1000;
+        }
+        memcpy(&slots[w->index]->pkts[slots[w->index]->lengthBytes], pkt, 188);
+        slots[w->index]->lengthBytes += 188;
+    }
+
+    for (int i = 0; i < ctx->workerCount; i++) {
+        if (slots[i]) {
+            pkt_ring_producer_commit(ctx->workers[i].ring);
+        }
+    }
+}
+
+/* -L, account for one read of the input. Analysis thread. */
+static void ingest_account(struct tool_ctx_s *ctx, int lengthBytes, uint32_t readNs, int eagains, int shortRead)
+{
+    if (ctx->readCount == 0 || (unsigned int)lengthBytes < ctx->readBytesMin)
+        ctx->readBytesMin = lengthBytes;
+    if ((unsigned int)lengthBytes > ctx->readBytesMax)
+        ctx->readBytesMax = lengthBytes;
+    ctx->readCount++;
+    ctx->readEagains += eagains;
+    ctx->shortReads += shortRead ? 1 : 0;
+    if (readNs)
+        latency_add(&ctx->latency[LATENCY_READ], readNs);
+}
+
+/* ts is when the buffer was received, or NULL to derive walltime from the stream clock (replay) */
+static void analyze_buffer(struct tool_ctx_s *ctx, const unsigned char *buf, int rlen, struct timeval *ts)
+{
+    stream_clock_write(&ctx->clock, buf, rlen / 188);
+    int64_t clockMs = stream_clock_ms(&ctx->clock);
+
+    struct timeval replayts;
+    if (!ts) {
+        replayts.tv_sec = ctx->replayEpoch + (clockMs / 1000);
+        replayts.tv_usec = (clockMs % 1000) * 1000;
+        ts = &replayts;
+    }
+    ctx->now = ts->tv_sec;
+
+    if (ctx->verbose > 2) {
+        printf("avio %4d : ", rlen);
+        for (int i = 0; i < 16; i++) {
+            printf("%02x ", buf[i]);
+        }
+        printf("\n");
+    }
+
+    /* Periods are cut on the stream clock, nothing is reported until the first PCR */
+    if (ctx->clock.locked) {
+        int64_t window = clockMs / ctx->collectIntervalMs;
+        if (ctx->window < 0) {
+            ctx->window = window;
+        }
+        while (ctx->window < window) {
+            if (ctx->verbose > 1) {
+                printf("%d: Creating report\n", (unsigned int)ctx->now);
+            }
+            services_period_complete(ctx, ctx->window++);
+        }
+    }
+
+    ltntstools_pid_stats_update(ctx->stream, buf, rlen / 188);
+
+    int complete = 0;
+    uint64_t t0 = ctx->instrument ? latency_now_ns() : 0;
+    if (ctx->psiLocked) {
+        /* Only the PAT and PMTs can change the services now */
+        int n = 0;
+        for (int i = 0; i < rlen / 188; i++) {
+            uint16_t pid = ltntstools_pid(&buf[i * 188]);
+            if (pid == 0) {
+                psi_pat_pids(ctx, &buf[i * 188]);
+            }
+            if (ctx->psiPids[pid]) {
+                memcpy(&ctx->psiBuf[n * 188], &buf[i * 188], 188);
+                n++;
+            }
+        }
+        if (n) {
+            ltntstools_streammodel_write(ctx->sm, ctx->psiBuf, n, &complete, ts);
+        }
+    } else {
+        ltntstools_streammodel_write(ctx->sm, buf, rlen / 188, &complete, ts);
+    }
+    if (ctx->instrument) {
+        latency_add(&ctx->latency[LATENCY_MODEL], latency_now_ns() - t0);
+    }
+
+    if (complete) {
+
+        struct ltntstools_pat_s *pat;
+        int r = ltntstools_streammodel_query_model(ctx->sm, &pat);
+        if (r == 0) {
+            unsigned int changes = ctx->psiChanges;
+            services_update(ctx, pat);
+            ltntstools_pat_free(pat);
+
+            /* The pids were just rebuilt from the model, keep those of any newer PAT in this buffer */
+            for (int i = 0; ctx->psiChanges != changes && i < rlen / 188; i++) {
+                if (ltntstools_pid(&buf[i * 188]) == 0) {
+                    psi_pat_pids(ctx, &buf[i * 188]);
+                }
+            }
+        }
+    }
+
+    services_write(ctx, buf, rlen / 188, clockMs);
+}
+
+/* Push a mapped capture through the pipeline as fast as the cpu allows. Time comes from the
+ * first PCR carrying pid, so the reporting periods and records match what a live probe would
+ * have produced, and repeated runs of the same file produce identical output.
+ */
+static void replay_file(struct tool_ctx_s *ctx)
+{
+    if (ctx->replayEpoch == 0) {
+        int64_t ms = ts_file_pcr_span_ms(ctx->file);
+        ctx->replayEpoch = ctx->file->mtime - (ms > 0 ? ms / 1000 : 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ctx->replayStart);
+
+    const uint8_t *pkts;
+    int count;
+    while (1) {
+        uint64_t t0 = ctx->instrument ? latency_now_ns() : 0;
+        uint64_t resyncs = ctx->file->resyncs;
+        if (!gRunning || (count = ts_file_read(ctx->file, &pkts, PKT_RING_SLOT_PACKETS)) <= 0)
+            break;
+        if (ctx->instrument) {
+            /* Lost alignment in the capture is the replay equivalent of a short read */
+            ingest_account(ctx, count * 188, latency_now_ns() - t0, 0, ctx->file->resyncs != resyncs);
+        }
+        analyze_buffer(ctx, pkts, count * 188, NULL);
+        ctx->replayPackets += count;
+    }
+}
+
+/* End to end throughput of a replay, once the workers have drained. Returns < 0 if -B can't be written. */
+static int replay_report(struct tool_ctx_s *ctx)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - ctx->replayStart.tv_sec) + ((now.tv_nsec - ctx->replayStart.tv_nsec) / 1e9);
+    if (ctx->replayPackets == 0 || elapsed <= 0)
+        return 0;
+
+    double pps = ctx->replayPackets / elapsed;
+    double ns = (elapsed * 1e9) / ctx->replayPackets;
+    const char *impl = ctx->countOnly ? "probe-counter" : "probe";
+
+    if (ctx->verbose) {
+        printf("Replay: %" PRIu64 " packets in %.3fs, %.2f Mpackets/s, %.1f ns/packet\n",
+            ctx->replayPackets, elapsed, pps / 1e6, ns);
+    }
+    if (!ctx->bname)
+        return 0;
+
+    FILE *fh = fopen(ctx->bname, "a");
+    if (!fh) {
+        perror(ctx->bname);
+        return -1;
+    }
+    fprintf(fh, "{\"bench\":\"pipeline\",\"impl\":\"%s\",\"metric\":\"packets/s\",\"value\":%.6g}\n", impl, pps);
+    fprintf(fh, "{\"bench\":\"pipeline\",\"impl\":\"%s\",\"metric\":\"ns/packet\",\"value\":%.6g}\n", impl, ns);
+    fclose(fh);
+
+    return 0; /* Success */
+}
+
+int main(int argc, char *argv[])
+{
     if (argc == 1) {
         usage(argv[0]);
         exit(1);
@@ -275,31 +1806,65 @@ int main(int argc, char *argv[])
     }
     gCtx = ctx;
 
-    ctx->buf = malloc(bsize);
+    ctx->buf = malloc(PKT_RING_SLOT_BYTES);
+    ctx->psiBuf = malloc(PKT_RING_SLOT_BYTES);
     ctx->iname = strdup("udp://239.255.0.1:1234?fifo_size=1000000&overrun_nonfatal=1");
     ctx->verbose = 0;
-    ctx->collectInterval = 1;
+    ctx->collectIntervalMs = 1000;
+    ctx->onlineRate = ONLINE_DEFAULT_RATE;
+    ctx->window = -1;
+    stream_clock_init(&ctx->clock, 0x2000);
     ctx->pid = 0x31;
     ctx->streamId = 0xe0;
+    ctx->ringSlots = 8192;
+    ctx->publishPolicy = PUBLISHER_DROP_OLDEST;
+    ctx->publishQueueDepth = 4096;
+    ctx->keyframeBudgetPct = 5;
+    ctx->pesArenaMB = 256;
+    run_profile_defaults(&ctx->profile);
 
     ltntstools_pid_stats_alloc(&ctx->stream);
 
     ltntstools_streammodel_alloc(&ctx->sm, ctx);
 
     int ch;
-    while ((ch = getopt(argc, argv, "?hi:o:I:P:S:v")) != -1) {
+    while ((ch = getopt(argc, argv, "?hAB:Cd:F:i:o:I:K:Lm:M:NO:P:Q:R:S:T:vW:X:")) != -1) {
         switch(ch) {
+        case 'A':
+            ctx->allServices = 1;
+            break;
+        case 'd': {
+            free(ctx->storeDir);
+            ctx->storeDir = strdup(optarg);
+            char *secs = strchr(ctx->storeDir, ':');
+            if (secs) {
+                *(secs++) = 0;
+                ctx->storeSeconds = atoi(secs);
+            }
+            break;
+        }
+        case 'F':
+            if (strcmp(optarg, "binary") == 0) {
+                ctx->outputBinary = 1;
+            } else
+            if (strcmp(optarg, "json") == 0) {
+                ctx->outputBinary = 0;
+            } else {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
         case 'i':
             free(ctx->iname);
             ctx->iname = strdup(optarg);
             break;
         case 'I':
-            ctx->collectInterval = atoi(optarg);
-            if (ctx->collectInterval < 1) {
-                ctx->collectInterval = 1;
+            ctx->collectIntervalMs = atof(optarg) * 1000;
+            if (ctx->collectIntervalMs < 100) {
+                ctx->collectIntervalMs = 100;
             } else
-            if (ctx->collectInterval > 15) {
-                ctx->collectInterval = 15;
+            if (ctx->collectIntervalMs > 15000) {
+                ctx->collectIntervalMs = 15000;
             }
             break;
         case '?':
@@ -324,21 +1889,126 @@ int main(int argc, char *argv[])
                 }
             }
             break;
+        case 'M':
+            free(ctx->mname);
+            ctx->mname = strdup(optarg);
+            break;
+        case 'O': {
+            free(ctx->onlineSpec);
+            ctx->onlineSpec = strdup(optarg);
+            char *rate = strchr(ctx->onlineSpec, ':');
+            if (rate) {
+                *(rate++) = 0;
+                ctx->onlineRate = atof(rate);
+                if (ctx->onlineRate <= 0.0f || ctx->onlineRate > 1.0f) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+            }
+            break;
+        }
+        case 'N':
+            ctx->useNativeUDP = 1;
+            break;
+        case 'C':
+            ctx->countOnly = 1;
+            break;
+        case 'Q': {
+            char *depth = strchr(optarg, ':');
+            if (depth) {
+                *(depth++) = 0;
+                ctx->publishQueueDepth = atoi(depth);
+                if (ctx->publishQueueDepth < 1) {
+                    ctx->publishQueueDepth = 1;
+                }
+            }
+            if (publisher_policy_parse(optarg, &ctx->publishPolicy) < 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            ctx->publishPolicySet = 1;
+            break;
+        }
+        case 'R':
+            ctx->ringSlots = atoi(optarg);
+            if (ctx->ringSlots < 16) {
+                ctx->ringSlots = 16;
+            }
+            break;
         case 'S':
             if ((sscanf(optarg, "0x%x", &ctx->streamId) != 1) || (ctx->streamId > 0xff)) {
                 usage(argv[0]);
                 exit(1);
             }
+            ctx->streamIdSet = 1;
+            break;
+        case 'T':
+            ctx->replayEpoch = atol(optarg);
+            break;
+        case 'B':
+            ctx->bname = optarg;
+            break;
+        case 'K': {
+            ctx->keyframeThreads = atoi(optarg);
+            char *pct = strchr(optarg, ':');
+            if (pct) {
+                ctx->keyframeBudgetPct = atoi(pct + 1);
+            }
+            if (ctx->keyframeThreads < 0) {
+                ctx->keyframeThreads = 0;
+            } else
+            if (ctx->keyframeThreads > MAX_SERVICES) {
+                ctx->keyframeThreads = MAX_SERVICES;
+            }
+            if (ctx->keyframeBudgetPct < 1) {
+                ctx->keyframeBudgetPct = 1;
+            } else
+            if (ctx->keyframeBudgetPct > 100) {
+                ctx->keyframeBudgetPct = 100;
+            }
+            break;
+        }
+        case 'X':
+            if (run_profile_parse(&ctx->profile, optarg) < 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'm':
+            ctx->pesArenaMB = atoi(optarg);
+            if (ctx->pesArenaMB < 4) {
+                ctx->pesArenaMB = 4;
+            }
+            break;
+        case 'L':
+            ctx->instrument = 1;
             break;
         case 'v':
             ctx->verbose++;
             break;
+        case 'W':
+            ctx->workerCount = atoi(optarg);
+            if (ctx->workerCount < 0) {
+                ctx->workerCount = 0;
+            } else
+            if (ctx->workerCount > MAX_SERVICES) {
+                ctx->workerCount = MAX_SERVICES;
+            }
+            break;
         default:
             usage(argv[0]);
             exit(1);
         }
     }
 
+    /* stdout also carries discovery, profile, supervision and -v messages, any of them would
+     * corrupt a binary stream
+     */
+    if (ctx->outputBinary && !ctx->oname) {
+        fprintf(stderr, "-F binary needs -o, stdout isn't reserved for records\n");
+        exit(1);
+    }
+
     if (ctx->oname) {
         ctx->ofh = fopen(ctx->oname, "wb");
         if (!ctx->ofh) {
@@ -347,100 +2017,242 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (stats_fields_init(ctx) < 0) {
+        fprintf(stderr, "Unable to allocate the record layout\n");
+        exit(1);
+    }
+
+    if (ctx->outputBinary && stats_publish_header(ctx) < 0) {
+        fprintf(stderr, "Unable to describe the binary record\n");
+        exit(1);
+    }
+
+    if (ctx->mname) {
+        if (mlp_load(&ctx->model, ctx->mname) < 0 || stats_features_bind(ctx) < 0) {
+            exit(1);
+        }
+    }
+    if (ctx->onlineSpec && online_features_bind(ctx) < 0) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    /* Pick the start code scanner once, before any analysis runs */
+    ltn_startcode_select(NULL);
+    if (ctx->verbose) {
+        printf("Start code scanner: %s\n", ltn_startcode_find_name);
+    }
+
     av_log_set_level(AV_LOG_INFO);
     avformat_network_init();
 
-    int ret = avio_open2(&ctx->c, ctx->iname, AVIO_FLAG_READ | AVIO_FLAG_NONBLOCK | AVIO_FLAG_DIRECT, NULL, NULL);
-    if (ret < 0) {
-        fprintf(stderr, "Unabled to open url\n");
+    struct stat st;
+    if (stat(ctx->iname, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (ts_file_open(&ctx->file, ctx->iname) < 0) {
+            exit(1);
+        }
+        if (ctx->verbose) {
+            printf("Replaying %s, %zu bytes\n", ctx->iname, ctx->file->lengthBytes);
+        }
+    } else
+    if (ctx->useNativeUDP && strncmp(ctx->iname, "udp://", 6) == 0) {
+        if (udp_rx_alloc(&ctx->udp, ctx->iname) == 0 && ctx->verbose) {
+            printf("Receiving %s with the native udp receiver\n", ctx->iname);
+        }
+    }
+
+    if (!ctx->udp && !ctx->file) {
+        int ret = avio_open2(&ctx->c, ctx->iname, AVIO_FLAG_READ | AVIO_FLAG_NONBLOCK | AVIO_FLAG_DIRECT, NULL, NULL);
+        if (ret < 0) {
+            fprintf(stderr, "Unabled to open url\n");
+            exit(1);
+        }
+    }
+
+    /* Replays must not lose records, their output is expected to be repeatable */
+    if (!ctx->publishPolicySet && ctx->file) {
+        ctx->publishPolicy = PUBLISHER_BLOCK;
+    }
+    /* Queue slots sized for the layout, not RECORD_MAX_BYTES */
+    int recordBytes = ctx->outputBinary ? record_binary_length(ctx->fields, ctx->fieldCount) :
+        record_json_max_length(ctx->fields, ctx->fieldCount);
+    if (recordBytes > RECORD_MAX_BYTES) {
+        recordBytes = RECORD_MAX_BYTES; /* stats_format() refuses anything longer */
+    }
+    if (publisher_alloc(&ctx->publisher, ctx->ofh ? ctx->ofh : stdout, NULL, ctx->publishQueueDepth, recordBytes,
+        ctx->publishPolicy) < 0) {
+        fprintf(stderr, "Unable to start record publisher\n");
         exit(1);
     }
 
+    if (ctx->storeDir) {
+        uint8_t hdr[RECORD_MAX_BYTES];
+        int len = record_binary_header(ctx->fields, ctx->fieldCount, hdr, sizeof(hdr));
+        if (len < 0 ||
+            segment_store_alloc(&ctx->store, ctx->storeDir, ctx->storeSeconds, hdr, len) < 0 ||
+            publisher_alloc(&ctx->storePublisher, NULL, ctx->store, ctx->publishQueueDepth,
+                record_binary_length(ctx->fields, ctx->fieldCount), ctx->publishPolicy) < 0)
+        {
+            fprintf(stderr, "Unable to open the feature store %s\n", ctx->storeDir);
+            exit(1);
+        }
+    }
+
     signal(SIGINT, signal_handler);
     signal(SIGUSR1, signal_handler);
     signal(SIGUSR2, signal_handler);
 
-    while (gRunning) {
-        time(&ctx->now);
-        if (ctx->lastStatsReport == 0) {
-            ctx->lastStatsReport = ctx->now;
-        }
+    if (pkt_ring_alloc(&ctx->ring, ctx->ringSlots, ctx->profile.hugepages) < 0) {
+        fprintf(stderr, "Unable to allocate ingest ring\n");
+        exit(1);
+    }
+    run_profile_ring(&ctx->profile, ctx->ring, "ingest");
 
-        int rlen = avio_read(ctx->c, ctx->buf, blen);
-        if (rlen == -EAGAIN) {
-            usleep(20 * 1000);
-            continue;
-        }
-        if (rlen < 0) {
-            break;
-        }
+    if (pes_arena_alloc(&ctx->pesArena, (size_t)ctx->pesArenaMB * 1024 * 1024) < 0) {
+        fprintf(stderr, "Unable to allocate the PES arena\n");
+        exit(1);
+    }
 
-	/* TODO: The more processing we do here, the more we're likely to overflow the AVIO fifo. */
+    if (ctx->keyframeThreads && keyframe_pool_alloc(&ctx->keyframePool, ctx->keyframeThreads, ctx->keyframeBudgetPct,
+        ctx->file != NULL) < 0) {
+        fprintf(stderr, "Unable to start keyframe decode threads\n");
+        exit(1);
+    }
 
-        if (ctx->verbose > 2) {
-            printf("avio %4d : ", rlen);
-            for (int i = 0; i < 16; i++) {
-                printf("%02x ", ctx->buf[i]);
+    if (ctx->workerCount) {
+        ctx->workers = calloc(ctx->workerCount, sizeof(struct worker_ctx_s));
+        for (int i = 0; i < ctx->workerCount; i++) {
+            struct worker_ctx_s *w = &ctx->workers[i];
+            w->ctx = ctx;
+            w->index = i;
+            if (pkt_ring_alloc(&w->ring, ctx->ringSlots, ctx->profile.hugepages) < 0 ||
+                pthread_create(&w->threadId, NULL, worker_thread_func, w) != 0)
+            {
+                fprintf(stderr, "Unable to start analysis worker\n");
+                exit(1);
             }
-            printf("\n");
+            char name[32];
+            snprintf(name, sizeof(name), "worker %d", i);
+            run_profile_ring(&ctx->profile, w->ring, name);
+            run_profile_pin(w->threadId, run_profile_worker_cpu(&ctx->profile, i), name);
         }
+    }
 
-        if (ctx->lastStatsReport + ctx->collectInterval <= ctx->now) {
-            if (ctx->verbose > 1) {
-                printf("%d: Creating report\n", (unsigned int)ctx->now);
-            }
-            ctx->lastStatsReport = ctx->now;
-            stats_complete(ctx);
+    /* The ingest thread starts before this thread is pinned, threads inherit the affinity of
+     * their creator and without ingest= it must not end up sharing the analysis cpu.
+     */
+    if (!ctx->file) {
+        if (pthread_create(&ctx->ingestThreadId, NULL, ingest_thread_func, ctx) != 0) {
+            fprintf(stderr, "Unable to start ingest thread\n");
+            exit(1);
         }
+        run_profile_pin(ctx->ingestThreadId, ctx->profile.ingestCpu, "ingest");
+        run_profile_fifo(ctx->ingestThreadId, ctx->profile.fifoPriority, "ingest");
+    }
 
-        ctx->stats_next.transport_bit_count += (rlen * 8);
-
-        ltntstools_pid_stats_update(ctx->stream, ctx->buf, rlen / 188);
-
-        int complete;
-        struct timeval ts;
-        gettimeofday(&ts, NULL);
-        ltntstools_streammodel_write(ctx->sm, ctx->buf, rlen / 188, &complete, &ts);
+    run_profile_pin(pthread_self(), ctx->profile.analysisCpu, "analysis");
+    run_profile_pin(ctx->publisher->threadId, ctx->profile.publishCpu, "publish");
+    if (ctx->storePublisher) {
+        run_profile_pin(ctx->storePublisher->threadId, ctx->profile.publishCpu, "store publish");
+    }
+    run_profile_lock(&ctx->profile);
 
-        if (complete) {
+    if (ctx->file) {
+        replay_file(ctx);
+    }
 
-            struct ltntstools_pat_s *pat;
-            int r = ltntstools_streammodel_query_model(ctx->sm, &pat);
-            if (r == 0) {
+    /* Analysis thread. Once stopped, the ingest thread is joined so that nothing it committed
+     * on the way out is left in the ring.
+     */
+    int ingestJoined = ctx->file != NULL;
+    while (!ctx->file) {
+        struct pkt_ring_slot_s *slot = pkt_ring_consumer_slot(ctx->ring);
+        if (!slot) {
+            if (!gRunning && ingestJoined)
+                break;
+            if (!gRunning) {
+                pthread_join(ctx->ingestThreadId, NULL);
+                ingestJoined = 1;
+                continue;
+            }
+            usleep(1000);
+            continue;
+        }
 
-                int e = 0;
-                struct ltntstools_pmt_s *pmt;
-                while (ltntstools_pat_enum_services_video(pat, &e, &pmt) == 0) {
-                    uint8_t estype;
-                    uint16_t videopid;
-                    if (ltntstools_pmt_query_video_pid(pmt, &videopid, &estype) < 0)
-                        continue;
+        uint32_t depth = pkt_ring_depth(ctx->ring);
+        if (depth > ctx->ringHighWater) {
+            ctx->ringHighWater = depth;
+        }
 
-                    printf("Discovered program %5d, video pid 0x%04x\n", pmt->program_number, videopid);
-                    ctx->pid = videopid;
-                    ctx->streamId = 0xe0;
-                    break;
-                }
+        if (ctx->instrument) {
+            ingest_account(ctx, slot->lengthBytes, slot->readNs, slot->eagains, slot->shortRead);
+        }
+        analyze_buffer(ctx, slot->pkts, slot->lengthBytes, &slot->ts);
+        pkt_ring_consumer_release(ctx->ring);
+    }
 
-                if (ctx->pe) {
-                    ltntstools_pes_extractor_free(ctx->pe);
-                    ctx->pe = NULL;
-                }
+    workers_stop(ctx);
+    if (ctx->file && replay_report(ctx) < 0) {
+        exit(1);
+    }
 
-                if (ltntstools_pes_extractor_alloc(&ctx->pe, ctx->pid, ctx->streamId, (pes_extractor_callback)callback, ctx, (1024 * 1024), (2 * 1024 * 1024)) < 0) {
-                    fprintf(stderr, "\nUnable to allocate pes_extractor object.\n\n");
-                    exit(1);
+    if (ctx->verbose) {
+        printf("Ingest ring: %d slots, high water mark %d, %" PRIu64 " overruns\n",
+            ctx->ring->count, pkt_ring_high_water_mark(ctx->ring), pkt_ring_overruns(ctx->ring));
+        if (ctx->udp) {
+            printf("Native udp: %" PRIu64 " datagrams in %" PRIu64 " recvmmsg calls, %" PRIu64 " truncated\n",
+                ctx->udp->datagrams, ctx->udp->syscalls, ctx->udp->truncated);
+        }
+        printf("PSI: %u changes acted on\n", ctx->psiChanges);
+        for (int i = 0; ctx->onlineFeatureCount && i < ctx->serviceCount; i++) {
+            const struct online_s *o = &ctx->services[i]->online;
+            printf("Online: program %d, %" PRIu64 " labelled periods trained on, agreement %.3f\n",
+                ctx->services[i]->programNumber, o->updates, o->agreement);
+        }
+        if (ctx->pesArena) {
+            struct pes_arena_stats_s arena;
+            pes_arena_query(ctx->pesArena, &arena, 0);
+            printf("PES arena: %zu KB reserved of %zu KB, %" PRIu64 " buffers taken, %" PRIu64 " refused\n",
+                arena.reservedBytes / 1024, arena.capBytes / 1024, arena.acquires, arena.failures);
+        }
+        if (ctx->file) {
+            printf("Replay: %" PRIu64 " resyncs, %" PRIu64 " PCR discontinuities\n",
+                ctx->file->resyncs, ctx->clock.discontinuities);
+        }
+        if (ctx->instrument) {
+            /* Periods still open never merged their counts, fold them in too */
+            for (int i = 0; i < LATENCY_STAGES; i++) {
+                latency_merge(&ctx->latencyTotal[i], &ctx->latency[i]);
+                for (int j = 0; j < ctx->serviceCount; j++) {
+                    latency_merge(&ctx->latencyTotal[i], &ctx->services[j]->latencyTotal[i]);
+                    latency_merge(&ctx->latencyTotal[i], &ctx->services[j]->latency[i]);
                 }
-
-                ltntstools_pat_free(pat);
+                latency_print(stdout, latency_stage_names[i], &ctx->latencyTotal[i]);
             }
         }
+    }
 
-        if (ctx->pe) {
-            ltntstools_pes_extractor_write(ctx->pe, ctx->buf, rlen / 188);
+    /* Drains anything still queued */
+    if (ctx->publisher) {
+        publisher_stop(ctx->publisher);
+        if (ctx->verbose) {
+            printf("Publisher: %s, %" PRIu64 " records queued, %" PRIu64 " written in %" PRIu64 " batches, %" PRIu64 " dropped\n",
+                publisher_policy_name(ctx->publisher->policy), ctx->publisher->queued, ctx->publisher->written,
+                ctx->publisher->batches, publisher_dropped(ctx->publisher));
         }
-
+        publisher_free(ctx->publisher);
+    }
+    if (ctx->storePublisher) {
+        publisher_stop(ctx->storePublisher);
+        if (ctx->verbose) {
+            printf("Store: %s, %" PRIu64 " records in %" PRIu64 " segments, %" PRIu64 " dropped, %" PRIu64 " write errors\n",
+                ctx->storeDir, ctx->store->records, ctx->store->segments,
+                publisher_dropped(ctx->storePublisher), ctx->store->errors);
+        }
+        publisher_free(ctx->storePublisher);
+        segment_store_free(ctx->store);
     }
+    free(ctx->storeDir);
 
     /* Teardown */
     if (ctx->sm) {
@@ -449,15 +2261,41 @@ int main(int argc, char *argv[])
     if (ctx->ofh) {
         fclose(ctx->ofh);
     }
-    if (ctx->pe) {
-        ltntstools_pes_extractor_free(ctx->pe);
+    for (int i = 0; i < ctx->serviceCount; i++) {
+        service_free(ctx->services[i]);
+    }
+    if (ctx->keyframePool) {
+        keyframe_pool_free(ctx->keyframePool);
+    }
+    if (ctx->pesArena) {
+        pes_arena_free(ctx->pesArena);
+    }
+    for (int i = 0; i < ctx->workerCount; i++) {
+        pkt_ring_free(ctx->workers[i].ring);
+    }
+    free(ctx->workers);
+    if (ctx->ring) {
+        pkt_ring_free(ctx->ring);
     }
     if (ctx->buf) {
         free(ctx->buf);
     }
+    free(ctx->psiBuf);
     if (ctx->c) {
         avio_close(ctx->c);
     }
+    if (ctx->udp) {
+        udp_rx_free(ctx->udp);
+    }
+    if (ctx->file) {
+        ts_file_close(ctx->file);
+    }
+    if (ctx->model) {
+        mlp_free(ctx->model);
+    }
+    free(ctx->mname);
+    free(ctx->onlineSpec);
+    free(ctx->fields);
     if (ctx->stream) {
         ltntstools_pid_stats_free(ctx->stream);
     }
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Asynchronous record publisher. Analysis threads queue finished records and return
+ * immediately, a dedicated thread writes them out in batches, one write and one flush per
+ * batch. A stalled consumer (a named pipe nobody is reading) fills the bounded queue and
+ * then the overflow policy decides what gives, instead of blocking packet analysis.
+ * The sink is either a stdio stream or a segment store (segment_store.c).
+ *
+ * Queue slots are sized for the longest record of the layout in use rather than
+ * RECORD_MAX_BYTES, and the writer thread takes at most PUBLISHER_BATCH_RECORDS at a time, so
+ * a deep queue costs little more than the records it can actually hold.
+ */
+#define PUBLISHER_BATCH_RECORDS 256
+
+enum publisher_policy_e
+{
+    PUBLISHER_DROP_OLDEST = 0,   /* Make room by discarding the oldest queued record */
+    PUBLISHER_DROP_NEWEST,       /* Discard the record being queued */
+    PUBLISHER_BLOCK,             /* Wait for room, back pressure reaches the analysis threads */
+};
+
+struct publisher_entry_s
+{
+    int64_t unixtime;            /* Segment store sinks only */
+    int on_air;                  /* Segment store sinks only */
+    int lengthBytes;
+};
+
+struct publisher_s
+{
+    FILE *fh;                    /* Sink, one or the other */
+    struct segment_store_s *store;
+    enum publisher_policy_e policy;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    pthread_t threadId;
+    int running;                 /* Protected by mutex */
+    int joined;                  /* Boolean. The thread has exited */
+
+    struct publisher_entry_s *entries;
+    char *data;                  /* entryBytes per entry */
+    int entryBytes;              /* Longest record accepted */
+    int capacity;
+    int head;                    /* Oldest queued entry */
+    int count;
+
+    /* Publisher thread only. Up to PUBLISHER_BATCH_RECORDS entries are copied here, back to back,
+     * and written in one go, or appended one by one to a store.
+     */
+    char *batch;
+    struct publisher_entry_s *drain;
+
+    /* Lifetime counters, readable from any thread */
+    _Atomic uint64_t queued;
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t written;
+    _Atomic uint64_t batches;
+    _Atomic uint32_t depth;      /* Records waiting right now */
+};
+
+static const char *publisher_policy_name(enum publisher_policy_e policy)
+{
+    switch (policy) {
+    case PUBLISHER_DROP_OLDEST: return "drop-oldest";
+    case PUBLISHER_DROP_NEWEST: return "drop-newest";
+    case PUBLISHER_BLOCK: return "block";
+    }
+    return "unknown";
+}
+
+static int publisher_policy_parse(const char *name, enum publisher_policy_e *policy)
+{
+    for (int i = PUBLISHER_DROP_OLDEST; i <= PUBLISHER_BLOCK; i++) {
+        if (strcmp(name, publisher_policy_name(i)) == 0) {
+            *policy = i;
+            return 0; /* Success */
+        }
+    }
+    return -1;
+}
+
+static void *publisher_thread_func(void *p)
+{
+    struct publisher_s *pub = (struct publisher_s *)p;
+
+    pthread_mutex_lock(&pub->mutex);
+    while (1) {
+        while (pub->count == 0 && pub->running)
+            pthread_cond_wait(&pub->notEmpty, &pub->mutex);
+        if (pub->count == 0)
+            break; /* Stopped and drained */
+
+        /* Take a batch of what's queued, write it without holding the lock */
+        int len = 0, records = 0;
+        while (pub->count && records < PUBLISHER_BATCH_RECORDS) {
+            struct publisher_entry_s *e = &pub->entries[pub->head];
+            memcpy(pub->batch + len, pub->data + ((size_t)pub->head * pub->entryBytes), e->lengthBytes);
+            len += e->lengthBytes;
+            pub->drain[records] = *e;
+            pub->head = (pub->head + 1) % pub->capacity;
+            pub->count--;
+            records++;
+        }
+        atomic_store_explicit(&pub->depth, pub->count, memory_order_relaxed);
+        pthread_cond_broadcast(&pub->notFull);
+        pthread_mutex_unlock(&pub->mutex);
+
+        if (pub->store) {
+            const char *data = pub->batch;
+            for (int i = 0; i < records; i++) {
+                struct publisher_entry_s *e = &pub->drain[i];
+                segment_store_append(pub->store, data, e->lengthBytes, e->unixtime, e->on_air);
+                data += e->lengthBytes;
+            }
+            segment_store_flush(pub->store);
+        } else {
+            fwrite(pub->batch, 1, len, pub->fh);
+            fflush(pub->fh);
+        }
+        atomic_fetch_add_explicit(&pub->written, records, memory_order_relaxed);
+        atomic_fetch_add_explicit(&pub->batches, 1, memory_order_relaxed);
+
+        pthread_mutex_lock(&pub->mutex);
+    }
+    pthread_mutex_unlock(&pub->mutex);
+
+    return NULL;
+}
+
+/**
+ * @brief         Start a publisher thread writing to fh, or appending to store.
+ * @param[out]    struct publisher_s **handle - new publisher
+ * @param[in]     FILE *fh - Destination, owned by the caller, not closed. NULL when store is used.
+ * @param[in]     struct segment_store_s *store - Destination, owned by the caller, not freed.
+ * @param[in]     int capacity - Records that can be queued before the policy applies.
+ * @param[in]     int entryBytes - Longest record that will be queued, eg. record_binary_length() or
+ *                                 record_json_max_length() of the layout. At most RECORD_MAX_BYTES.
+ * @return          0 - Success
+ * @return        < 0 - Error
+ */
+static int publisher_alloc(struct publisher_s **handle, FILE *fh, struct segment_store_s *store, int capacity,
+    int entryBytes, enum publisher_policy_e policy)
+{
+    if (entryBytes < 1 || entryBytes > RECORD_MAX_BYTES)
+        return -1;
+
+    struct publisher_s *pub = calloc(1, sizeof(*pub));
+    if (!pub)
+        return -1;
+
+    pub->fh = fh;
+    pub->store = store;
+    pub->policy = policy;
+    pub->capacity = capacity < 1 ? 1 : capacity;
+    pub->entryBytes = entryBytes;
+    int batchRecords = pub->capacity < PUBLISHER_BATCH_RECORDS ? pub->capacity : PUBLISHER_BATCH_RECORDS;
+    pub->entries = malloc(sizeof(struct publisher_entry_s) * pub->capacity);
+    pub->data = malloc((size_t)entryBytes * pub->capacity);
+    pub->drain = malloc(sizeof(struct publisher_entry_s) * batchRecords);
+    pub->batch = malloc((size_t)entryBytes * batchRecords);
+    if (!pub->entries || !pub->data || !pub->batch || !pub->drain) {
+        free(pub->entries);
+        free(pub->data);
+        free(pub->batch);
+        free(pub->drain);
+        free(pub);
+        return -1;
+    }
+
+    pthread_mutex_init(&pub->mutex, NULL);
+    pthread_cond_init(&pub->notEmpty, NULL);
+    pthread_cond_init(&pub->notFull, NULL);
+    pub->running = 1;
+
+    if (pthread_create(&pub->threadId, NULL, publisher_thread_func, pub) != 0) {
+        pthread_mutex_destroy(&pub->mutex);
+        pthread_cond_destroy(&pub->notEmpty);
+        pthread_cond_destroy(&pub->notFull);
+        free(pub->entries);
+        free(pub->data);
+        free(pub->batch);
+        free(pub->drain);
+        free(pub);
+        return -1;
+    }
+
+    *handle = pub;
+    return 0; /* Success */
+}
+
+/* Stop accepting records and wait until everything still queued has been written. */
+static void publisher_stop(struct publisher_s *pub)
+{
+    if (pub->joined)
+        return;
+
+    pthread_mutex_lock(&pub->mutex);
+    pub->running = 0;
+    pthread_cond_broadcast(&pub->notEmpty);
+    pthread_cond_broadcast(&pub->notFull);
+    pthread_mutex_unlock(&pub->mutex);
+
+    pthread_join(pub->threadId, NULL);
+    pub->joined = 1;
+}
+
+static void publisher_free(struct publisher_s *pub)
+{
+    publisher_stop(pub);
+
+    pthread_mutex_destroy(&pub->mutex);
+    pthread_cond_destroy(&pub->notEmpty);
+    pthread_cond_destroy(&pub->notFull);
+    free(pub->entries);
+    free(pub->data);
+    free(pub->batch);
+    free(pub->drain);
+    free(pub);
+}
+
+/**
+ * @brief         Queue a record for writing. Safe to call from any number of threads.
+ * @param[in]     int64_t unixtime, int on_air - Where a store sink files the record, ignored by stream sinks.
+ * @return          0 - Queued
+ * @return        < 0 - Dropped, by the drop-newest policy, because the publisher is stopping or
+ *                      because the record is longer than the publisher was sized for
+ */
+static int publisher_write_record(struct publisher_s *pub, const void *data, int lengthBytes, int64_t unixtime, int on_air)
+{
+    if (lengthBytes <= 0 || lengthBytes > pub->entryBytes)
+        return -1;
+
+    pthread_mutex_lock(&pub->mutex);
+
+    if (pub->count == pub->capacity) {
+        if (pub->policy == PUBLISHER_DROP_NEWEST) {
+            pthread_mutex_unlock(&pub->mutex);
+            atomic_fetch_add_explicit(&pub->dropped, 1, memory_order_relaxed);
+            return -1;
+        } else
+        if (pub->policy == PUBLISHER_DROP_OLDEST) {
+            pub->head = (pub->head + 1) % pub->capacity;
+            pub->count--;
+            atomic_fetch_add_explicit(&pub->dropped, 1, memory_order_relaxed);
+        } else {
+            while (pub->count == pub->capacity && pub->running)
+                pthread_cond_wait(&pub->notFull, &pub->mutex);
+        }
+    }
+    if (!pub->running) {
+        pthread_mutex_unlock(&pub->mutex);
+        atomic_fetch_add_explicit(&pub->dropped, 1, memory_order_relaxed);
+        return -1;
+    }
+
+    int idx = (pub->head + pub->count) % pub->capacity;
+    struct publisher_entry_s *e = &pub->entries[idx];
+    memcpy(pub->data + ((size_t)idx * pub->entryBytes), data, lengthBytes);
+    e->lengthBytes = lengthBytes;
+    e->unixtime = unixtime;
+    e->on_air = on_air;
+    pub->count++;
+    atomic_store_explicit(&pub->depth, pub->count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pub->queued, 1, memory_order_relaxed);
+
+    pthread_cond_signal(&pub->notEmpty);
+    pthread_mutex_unlock(&pub->mutex);
+
+    return 0; /* Success */
+}
+
+static int publisher_write(struct publisher_s *pub, const void *data, int lengthBytes)
+{
+    return publisher_write_record(pub, data, lengthBytes, 0, 0);
+}
+
+static uint64_t publisher_dropped(struct publisher_s *pub)
+{
+    return atomic_load_explicit(&pub->dropped, memory_order_relaxed);
+}
+
+static uint32_t publisher_depth(struct publisher_s *pub)
+{
+    return atomic_load_explicit(&pub->depth, memory_order_relaxed);
+}
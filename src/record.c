@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* Feature record serialization. A producer describes its record once, as a table of fields
+ * pointing into its own struct, and gets either a bounded json object or a fixed layout binary
+ * record from the same table, so the two formats can never disagree.
+ *
+ * Binary stream, all integers little endian:
+ *
+ *   Header, once at the start of the stream
+ *     char[4]  "UC01"
+ *     u16      RECORD_BINARY_VERSION
+ *     u16      field count
+ *     u16      record length in bytes, including the record magic
+ *     per field: u8 type (enum record_type_e), u8 name length, name (no terminator)
+ *
+ *   Records, back to back
+ *     char[4]  "UC1R"
+ *     fields in table order, packed, each in the width of its type
+ *
+ * Field names are the json keys of training/uc01-schema.json, so a reader can map a binary
+ * stream onto the schema without knowing this version of the probe.
+ */
+#define RECORD_BINARY_VERSION 1
+#define RECORD_MAX_BYTES 4096
+#define RECORD_MAX_FIELDS 256    /* Most a reader (record_reader.c) accepts, producers are held under it */
+
+enum record_type_e
+{
+    RECORD_U32 = 1,          /* unsigned int */
+    RECORD_I64 = 2,          /* int64_t or time_t */
+    RECORD_F32 = 3,          /* float */
+    RECORD_BOOL = 4,         /* int, zero or not, one byte in binary */
+};
+
+struct record_field_s
+{
+    const char *name;        /* json key */
+    enum record_type_e type;
+    size_t offset;           /* Of the value, in the producers struct */
+    int optional;            /* Boolean. A negative value means absent. Omitted from json, NaN in binary (F32 only). */
+};
+
+static int record_type_width(enum record_type_e type)
+{
+    switch (type) {
+    case RECORD_U32: return 4;
+    case RECORD_I64: return 8;
+    case RECORD_F32: return 4;
+    case RECORD_BOOL: return 1;
+    }
+    return 0;
+}
+
+/* Numeric value of a field, for consumers that don't care about the type (eg. model inputs) */
+static double record_field_value(const struct record_field_s *f, const void *src)
+{
+    const char *p = (const char *)src + f->offset;
+    switch (f->type) {
+    case RECORD_U32: return *(const unsigned int *)p;
+    case RECORD_I64: return *(const int64_t *)p;
+    case RECORD_F32: return *(const float *)p;
+    case RECORD_BOOL: return *(const int *)p ? 1 : 0;
+    }
+    return 0;
+}
+
+static int record_binary_length(const struct record_field_s *fields, int count)
+{
+    int len = 4;
+    for (int i = 0; i < count; i++)
+        len += record_type_width(fields[i].type);
+    return len;
+}
+
+static inline uint8_t *record_put_le(uint8_t *p, uint64_t v, int width)
+{
+    for (int i = 0; i < width; i++) {
+        *(p++) = v & 0xff;
+        v >>= 8;
+    }
+    return p;
+}
+
+/**
+ * @brief         Write the stream header that describes the binary records which follow.
+ * @return        > 0 - Bytes written
+ * @return        < 0 - dst too small
+ */
+static int record_binary_header(const struct record_field_s *fields, int count, uint8_t *dst, int size)
+{
+    if (count > RECORD_MAX_FIELDS)
+        return -1;
+
+    int len = 10;
+    for (int i = 0; i < count; i++)
+        len += 2 + strlen(fields[i].name);
+    if (len > size)
+        return -1;
+
+    uint8_t *p = dst;
+    memcpy(p, "UC01", 4);
+    p = record_put_le(p + 4, RECORD_BINARY_VERSION, 2);
+    p = record_put_le(p, count, 2);
+    p = record_put_le(p, record_binary_length(fields, count), 2);
+    for (int i = 0; i < count; i++) {
+        int n = strlen(fields[i].name);
+        *(p++) = fields[i].type;
+        *(p++) = n;
+        memcpy(p, fields[i].name, n);
+        p += n;
+    }
+
+    return len;
+}
+
+/**
+ * @brief         Serialize src as one fixed layout binary record.
+ * @return        > 0 - Bytes written, always record_binary_length()
+ * @return        < 0 - dst too small
+ */
+static int record_to_binary(const struct record_field_s *fields, int count, const void *src, uint8_t *dst, int size)
+{
+    if (record_binary_length(fields, count) > size)
+        return -1;
+
+    uint8_t *p = dst;
+    memcpy(p, "UC1R", 4);
+    p += 4;
+    for (int i = 0; i < count; i++) {
+        const struct record_field_s *f = &fields[i];
+        const char *v = (const char *)src + f->offset;
+        switch (f->type) {
+        case RECORD_U32:
+            p = record_put_le(p, *(const unsigned int *)v, 4);
+            break;
+        case RECORD_I64:
+            p = record_put_le(p, (uint64_t)*(const int64_t *)v, 8);
+            break;
+        case RECORD_F32: {
+            float fv = *(const float *)v;
+            if (f->optional && fv < 0)
+                fv = NAN;
+            uint32_t bits;
+            memcpy(&bits, &fv, sizeof(bits));
+            p = record_put_le(p, bits, 4);
+            break;
+        }
+        case RECORD_BOOL:
+            *(p++) = *(const int *)v ? 1 : 0;
+            break;
+        }
+    }
+
+    return p - dst;
+}
+
+/* Bounded appends for the json writer. Once full, everything else is dropped and the writer
+ * reports the record as truncated.
+ */
+struct record_json_s
+{
+    char *buf;
+    int size;
+    int len;
+    int overflow;
+};
+
+static inline void record_json_str(struct record_json_s *w, const char *s, int n)
+{
+    if (w->len + n >= w->size) {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static inline void record_json_u64(struct record_json_s *w, uint64_t v)
+{
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[sizeof(tmp) - 1 - n++] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    record_json_str(w, &tmp[sizeof(tmp) - n], n);
+}
+
+static inline void record_json_i64(struct record_json_s *w, int64_t v)
+{
+    if (v < 0) {
+        record_json_str(w, "-", 1);
+        record_json_u64(w, -(uint64_t)v);
+    } else {
+        record_json_u64(w, v);
+    }
+}
+
+/* Six decimal places, the precision the probability was announced with */
+static inline void record_json_f32(struct record_json_s *w, float v)
+{
+    if (!isfinite(v) || fabsf(v) > 1e12f) {
+        record_json_str(w, "null", 4);
+        return;
+    }
+    if (v < 0) {
+        record_json_str(w, "-", 1);
+        v = -v;
+    }
+    uint64_t scaled = (uint64_t)((double)v * 1000000.0 + 0.5);
+    record_json_u64(w, scaled / 1000000);
+
+    char frac[7];
+    uint64_t f = scaled % 1000000;
+    frac[0] = '.';
+    for (int i = 6; i >= 1; i--) {
+        frac[i] = '0' + (f % 10);
+        f /= 10;
+    }
+    record_json_str(w, frac, sizeof(frac));
+}
+
+/* Longest json record_to_json() can produce for this layout, every field present at its widest,
+ * including the terminator. For sizing buffers once the layout is known.
+ */
+static int record_json_max_length(const struct record_field_s *fields, int count)
+{
+    int len = 2 + 3 + 1; /* "{ ", " }\n", NUL */
+    for (int i = 0; i < count; i++) {
+        len += 2 + 1 + strlen(fields[i].name) + 3; /* ", ", quotes and ": " */
+        switch (fields[i].type) {
+        case RECORD_U32: len += 10; break;
+        case RECORD_I64: len += 20; break;
+        case RECORD_F32: len += 1 + 13 + 7; break; /* Sign, up to 1e12, six decimals */
+        case RECORD_BOOL: len += 5; break;
+        }
+    }
+    return len;
+}
+
+/**
+ * @brief         Serialize src as a single line json object, terminated with a newline.
+ *                Never writes more than size bytes, dst is always NUL terminated.
+ * @return        > 0 - Length of the string written
+ * @return        < 0 - dst too small, the record was truncated
+ */
+static int record_to_json(const struct record_field_s *fields, int count, const void *src, char *dst, int size)
+{
+    struct record_json_s w = { .buf = dst, .size = size };
+
+    int first = 1;
+    record_json_str(&w, "{ ", 2);
+    for (int i = 0; i < count; i++) {
+        const struct record_field_s *f = &fields[i];
+        const char *v = (const char *)src + f->offset;
+
+        if (f->optional && record_field_value(f, src) < 0)
+            continue;
+
+        if (!first)
+            record_json_str(&w, ", ", 2);
+        first = 0;
+        record_json_str(&w, "\"", 1);
+        record_json_str(&w, f->name, strlen(f->name));
+        record_json_str(&w, "\": ", 3);
+
+        switch (f->type) {
+        case RECORD_U32:
+            record_json_u64(&w, *(const unsigned int *)v);
+            break;
+        case RECORD_I64:
+            record_json_i64(&w, *(const int64_t *)v);
+            break;
+        case RECORD_F32:
+            record_json_f32(&w, *(const float *)v);
+            break;
+        case RECORD_BOOL:
+            if (*(const int *)v)
+                record_json_str(&w, "true", 4);
+            else
+                record_json_str(&w, "false", 5);
+            break;
+        }
+    }
+    record_json_str(&w, " }\n", 3);
+
+    if (size > 0)
+        dst[w.len < size ? w.len : size - 1] = 0;
+
+    return w.overflow ? -1 : w.len;
+}
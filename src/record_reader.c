@@ -0,0 +1,125 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* Decoding side of record.c, for tools that read binary record streams back. Include after
+ * record.c, the probe itself only ever writes records and doesn't need this.
+ * The layout of a stream is recovered from its header, so records written by any version of
+ * the producer can be read, up to RECORD_MAX_FIELDS fields.
+ */
+
+struct record_layout_s
+{
+    int headerLength;
+    int recordLength;
+    int count;
+    struct {
+        char name[256];
+        enum record_type_e type;
+        int offset;          /* In the record, after the magic */
+    } fields[RECORD_MAX_FIELDS];
+};
+
+static inline uint64_t record_get_le(const uint8_t *p, int width)
+{
+    uint64_t v = 0;
+    for (int i = width - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/**
+ * @brief         Parse the header at the start of a binary record stream.
+ * @return          0 - Success
+ * @return        < 0 - Not a stream this code understands
+ */
+static int record_binary_parse_header(const uint8_t *buf, int len, struct record_layout_s *layout)
+{
+    if (len < 10 || memcmp(buf, "UC01", 4) != 0)
+        return -1;
+    if (record_get_le(buf + 4, 2) != RECORD_BINARY_VERSION)
+        return -1;
+
+    layout->count = record_get_le(buf + 6, 2);
+    layout->recordLength = record_get_le(buf + 8, 2);
+    if (layout->count > RECORD_MAX_FIELDS)
+        return -1;
+
+    int pos = 10, offset = 4;
+    for (int i = 0; i < layout->count; i++) {
+        if (pos + 2 > len || pos + 2 + buf[pos + 1] > len)
+            return -1;
+        layout->fields[i].type = buf[pos];
+        layout->fields[i].offset = offset;
+        memcpy(layout->fields[i].name, buf + pos + 2, buf[pos + 1]);
+        layout->fields[i].name[buf[pos + 1]] = 0;
+        if (record_type_width(layout->fields[i].type) == 0)
+            return -1;
+        offset += record_type_width(layout->fields[i].type);
+        pos += 2 + buf[pos + 1];
+    }
+    if (offset != layout->recordLength)
+        return -1;
+
+    layout->headerLength = pos;
+    return 0; /* Success */
+}
+
+/**
+ * @brief         Convert one binary record back to the json the producer would have written.
+ * @return        > 0 - Length of the string written
+ * @return        < 0 - Not a record, or dst too small
+ */
+static int record_binary_to_json(const struct record_layout_s *layout, const uint8_t *rec, char *dst, int size)
+{
+    if (memcmp(rec, "UC1R", 4) != 0)
+        return -1;
+
+    struct record_json_s w = { .buf = dst, .size = size };
+    int first = 1;
+
+    record_json_str(&w, "{ ", 2);
+    for (int i = 0; i < layout->count; i++) {
+        const uint8_t *v = rec + layout->fields[i].offset;
+        float fv;
+        uint32_t bits;
+
+        if (layout->fields[i].type == RECORD_F32) {
+            bits = record_get_le(v, 4);
+            memcpy(&fv, &bits, sizeof(fv));
+            if (isnan(fv))
+                continue; /* Optional, absent */
+        }
+
+        if (!first)
+            record_json_str(&w, ", ", 2);
+        first = 0;
+        record_json_str(&w, "\"", 1);
+        record_json_str(&w, layout->fields[i].name, strlen(layout->fields[i].name));
+        record_json_str(&w, "\": ", 3);
+
+        switch (layout->fields[i].type) {
+        case RECORD_U32:
+            record_json_u64(&w, record_get_le(v, 4));
+            break;
+        case RECORD_I64:
+            record_json_i64(&w, (int64_t)record_get_le(v, 8));
+            break;
+        case RECORD_F32:
+            record_json_f32(&w, fv);
+            break;
+        case RECORD_BOOL:
+            if (*v)
+                record_json_str(&w, "true", 4);
+            else
+                record_json_str(&w, "false", 5);
+            break;
+        }
+    }
+    record_json_str(&w, " }\n", 3);
+
+    if (size > 0)
+        dst[w.len < size ? w.len : size - 1] = 0;
+
+    return w.overflow ? -1 : w.len;
+}
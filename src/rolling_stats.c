@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* Rolling statistics of a per-frame value (eg. the bits in each picture) over several trailing
+ * windows at once, in fixed memory and constant time per update, with no raw history kept.
+ *
+ * Frames are summarized into a bucket per reporting period (count, sum, sum of squares, min,
+ * max). When a period completes its bucket joins a ring shared by every window. Each window
+ * keeps running totals over its last k buckets, adding the new bucket and subtracting the one
+ * that just fell out, and a monotonic queue of bucket numbers for its min and max. Both are
+ * O(1) per period (amortized for the queues). The EWMA is updated per frame, with a time
+ * constant equal to the window length.
+ *
+ * Windows shorter than a reporting period cover exactly one period.
+ */
+#define ROLLING_WINDOWS 3
+#define ROLLING_MAX_BUCKETS 600  /* 60 seconds of the shortest (100ms) reporting period */
+
+static const int rolling_window_ms[ROLLING_WINDOWS] = { 1000, 5000, 60000 };
+
+/* One reporting period of frames */
+struct rolling_bucket_s
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    double sum;
+    double sumsq;
+};
+
+/* What a record carries for each window */
+struct rolling_result_s
+{
+    float ewma;              /* < 0 until the first frame */
+    float mean;              /* Of the frames in the window, 0 when empty */
+    float stddev;
+    unsigned int min;
+    unsigned int max;
+};
+
+struct rolling_window_s
+{
+    int buckets;             /* Periods in the window */
+    double tauMs;
+
+    /* Running totals over the last 'buckets' periods */
+    uint64_t count;
+    double sum;
+    double sumsq;
+
+    /* Bucket numbers, oldest first, whose min (max) is lower (higher) than every later bucket */
+    int64_t minq[ROLLING_MAX_BUCKETS];
+    int minHead, minCount;
+    int64_t maxq[ROLLING_MAX_BUCKETS];
+    int maxHead, maxCount;
+
+    double ewma;
+    int ewmaValid;           /* Boolean */
+    double alpha;            /* Of the last frame interval, cached as it rarely changes */
+    int64_t alphaDtMs;
+};
+
+struct rolling_stats_s
+{
+    struct rolling_bucket_s ring[ROLLING_MAX_BUCKETS + 1]; /* + 1, the bucket leaving a full window is read after the new one is stored */
+    int64_t next;            /* Number of the next bucket pushed */
+    struct rolling_window_s windows[ROLLING_WINDOWS];
+};
+
+static void rolling_stats_init(struct rolling_stats_s *rs, int periodMs)
+{
+    memset(rs, 0, sizeof(*rs));
+    for (int i = 0; i < ROLLING_WINDOWS; i++) {
+        struct rolling_window_s *w = &rs->windows[i];
+        w->buckets = (rolling_window_ms[i] + (periodMs / 2)) / periodMs;
+        if (w->buckets < 1)
+            w->buckets = 1;
+        if (w->buckets > ROLLING_MAX_BUCKETS)
+            w->buckets = ROLLING_MAX_BUCKETS;
+        w->tauMs = rolling_window_ms[i];
+        w->alphaDtMs = -1;
+    }
+}
+
+/* Add one frame to the bucket of the period it belongs to */
+static inline void rolling_bucket_add(struct rolling_bucket_s *b, uint32_t value)
+{
+    if (b->count == 0 || value < b->min)
+        b->min = value;
+    if (b->count == 0 || value > b->max)
+        b->max = value;
+    b->count++;
+    b->sum += value;
+    b->sumsq += (double)value * value;
+}
+
+/* Per frame. dtMs is the time since the previous frame, in decode order. */
+static void rolling_stats_ewma(struct rolling_stats_s *rs, uint32_t value, int64_t dtMs)
+{
+    for (int i = 0; i < ROLLING_WINDOWS; i++) {
+        struct rolling_window_s *w = &rs->windows[i];
+        if (!w->ewmaValid) {
+            w->ewma = value;
+            w->ewmaValid = 1;
+            continue;
+        }
+        if (dtMs != w->alphaDtMs) {
+            w->alpha = 1.0 - exp(-(double)(dtMs > 0 ? dtMs : 0) / w->tauMs);
+            w->alphaDtMs = dtMs;
+        }
+        w->ewma += w->alpha * (value - w->ewma);
+    }
+}
+
+static inline struct rolling_bucket_s *rolling_stats_bucket(struct rolling_stats_s *rs, int64_t n)
+{
+    return &rs->ring[n % (ROLLING_MAX_BUCKETS + 1)];
+}
+
+/* A period completed, its bucket enters every window and the oldest bucket of each leaves */
+static void rolling_stats_push(struct rolling_stats_s *rs, const struct rolling_bucket_s *b)
+{
+    int64_t n = rs->next++;
+    *rolling_stats_bucket(rs, n) = *b;
+
+    for (int i = 0; i < ROLLING_WINDOWS; i++) {
+        struct rolling_window_s *w = &rs->windows[i];
+
+        w->count += b->count;
+        w->sum += b->sum;
+        w->sumsq += b->sumsq;
+        if (n >= w->buckets) {
+            const struct rolling_bucket_s *old = rolling_stats_bucket(rs, n - w->buckets);
+            w->count -= old->count;
+            w->sum -= old->sum;
+            w->sumsq -= old->sumsq;
+        }
+        if (w->count == 0) {
+            w->sum = 0; /* Drop accumulated rounding error whenever the window empties */
+            w->sumsq = 0;
+        }
+
+        /* Retire buckets that left the window, then those the new bucket supersedes */
+        while (w->minCount && w->minq[w->minHead] <= n - w->buckets) {
+            w->minHead = (w->minHead + 1) % ROLLING_MAX_BUCKETS;
+            w->minCount--;
+        }
+        while (w->maxCount && w->maxq[w->maxHead] <= n - w->buckets) {
+            w->maxHead = (w->maxHead + 1) % ROLLING_MAX_BUCKETS;
+            w->maxCount--;
+        }
+        if (b->count == 0)
+            continue; /* Empty periods have no min or max to offer */
+
+        while (w->minCount &&
+            rolling_stats_bucket(rs, w->minq[(w->minHead + w->minCount - 1) % ROLLING_MAX_BUCKETS])->min >= b->min)
+        {
+            w->minCount--;
+        }
+        w->minq[(w->minHead + w->minCount++) % ROLLING_MAX_BUCKETS] = n;
+
+        while (w->maxCount &&
+            rolling_stats_bucket(rs, w->maxq[(w->maxHead + w->maxCount - 1) % ROLLING_MAX_BUCKETS])->max <= b->max)
+        {
+            w->maxCount--;
+        }
+        w->maxq[(w->maxHead + w->maxCount++) % ROLLING_MAX_BUCKETS] = n;
+    }
+}
+
+static void rolling_stats_query(struct rolling_stats_s *rs, int window, struct rolling_result_s *r)
+{
+    struct rolling_window_s *w = &rs->windows[window];
+
+    r->ewma = w->ewmaValid ? w->ewma : -1.0f;
+    r->mean = 0;
+    r->stddev = 0;
+    r->min = 0;
+    r->max = 0;
+    if (w->count == 0)
+        return;
+
+    double mean = w->sum / w->count;
+    double var = (w->sumsq / w->count) - (mean * mean);
+    r->mean = mean;
+    r->stddev = var > 0 ? sqrt(var) : 0;
+    if (w->minCount)
+        r->min = rolling_stats_bucket(rs, w->minq[w->minHead])->min;
+    if (w->maxCount)
+        r->max = rolling_stats_bucket(rs, w->maxq[w->maxHead])->max;
+}
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+/* Run profile, -X. Where the probes threads run and how, for hosts packing many probes where
+ * a preempted receive thread loses datagrams and the records then look like an outage:
+ *
+ *   ingest=cpu            Receive thread
+ *   analysis=cpu          Analysis thread (the main loop)
+ *   publish=cpu           Record publisher threads
+ *   workers=first[-last]  Analysis workers, one cpu each in turn
+ *   fifo=priority         SCHED_FIFO for the receive thread, 1-99
+ *   hugepages             Packet rings on hugepages
+ *   lock                  mlockall(), no page faults once running
+ *
+ * Eg. -X ingest=2,analysis=3,publish=4,workers=5-8,fifo=50,hugepages,lock
+ * Pick cpus on the NUMA node of the NIC. Nothing here is fatal: every request is applied, read
+ * back and reported, a refused request leaves the thread as the scheduler had it. Linux only,
+ * elsewhere each request is reported as unsupported.
+ */
+struct run_profile_s
+{
+    int ingestCpu;           /* -1 leaves the thread alone */
+    int analysisCpu;
+    int publishCpu;
+    int workerCpuFirst;
+    int workerCpuLast;
+    int fifoPriority;        /* 0 for normal scheduling */
+    int hugepages;           /* Boolean */
+    int lock;                /* Boolean */
+};
+
+static void run_profile_defaults(struct run_profile_s *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->ingestCpu = -1;
+    p->analysisCpu = -1;
+    p->publishCpu = -1;
+    p->workerCpuFirst = -1;
+    p->workerCpuLast = -1;
+}
+
+/**
+ * @brief         Parse a comma separated -X spec into p, on top of what's there.
+ * @return          0 - Success
+ * @return        < 0 - Unknown key or bad value
+ */
+static int run_profile_parse(struct run_profile_s *p, const char *spec)
+{
+    char *s = strdup(spec);
+    if (!s)
+        return -1;
+
+    int ret = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(s, ",", &save); tok && ret == 0; tok = strtok_r(NULL, ",", &save)) {
+        char *val = strchr(tok, '=');
+        if (val)
+            *(val++) = 0;
+
+        if (strcmp(tok, "hugepages") == 0 && !val) {
+            p->hugepages = 1;
+        } else
+        if (strcmp(tok, "lock") == 0 && !val) {
+            p->lock = 1;
+        } else
+        if (!val || *val < '0' || *val > '9') {
+            ret = -1;
+        } else
+        if (strcmp(tok, "ingest") == 0) {
+            p->ingestCpu = atoi(val);
+        } else
+        if (strcmp(tok, "analysis") == 0) {
+            p->analysisCpu = atoi(val);
+        } else
+        if (strcmp(tok, "publish") == 0) {
+            p->publishCpu = atoi(val);
+        } else
+        if (strcmp(tok, "workers") == 0) {
+            char *last = strchr(val, '-');
+            p->workerCpuFirst = atoi(val);
+            p->workerCpuLast = last ? atoi(last + 1) : p->workerCpuFirst;
+            if (p->workerCpuLast < p->workerCpuFirst)
+                ret = -1;
+        } else
+        if (strcmp(tok, "fifo") == 0) {
+            p->fifoPriority = atoi(val);
+            if (p->fifoPriority < 1 || p->fifoPriority > 99)
+                ret = -1;
+        } else {
+            ret = -1;
+        }
+    }
+
+    free(s);
+    return ret;
+}
+
+/* The cpu a worker is pinned to, or -1 */
+static int run_profile_worker_cpu(const struct run_profile_s *p, int index)
+{
+    if (p->workerCpuFirst < 0)
+        return -1;
+    return p->workerCpuFirst + (index % (p->workerCpuLast - p->workerCpuFirst + 1));
+}
+
+/* Pin a thread to one cpu and report what it's allowed on afterwards */
+static void run_profile_pin(pthread_t thread, int cpu, const char *name)
+{
+    if (cpu < 0)
+        return;
+
+#if defined(__linux__)
+    if (cpu >= CPU_SETSIZE) {
+        printf("Profile: %s thread, cpu %d refused, beyond CPU_SETSIZE\n", name, cpu);
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int ret = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (ret != 0) {
+        printf("Profile: %s thread, cpu %d refused, %s\n", name, cpu, strerror(ret));
+        return;
+    }
+
+    CPU_ZERO(&set);
+    pthread_getaffinity_np(thread, sizeof(set), &set);
+    if (CPU_COUNT(&set) == 1 && CPU_ISSET(cpu, &set)) {
+        printf("Profile: %s thread pinned to cpu %d\n", name, cpu);
+    } else {
+        printf("Profile: %s thread, cpu %d requested, runs on %d cpus\n", name, cpu, CPU_COUNT(&set));
+    }
+#else
+    printf("Profile: %s thread, cpu pinning unsupported on this platform\n", name);
+#endif
+}
+
+/* SCHED_FIFO, reports the policy and priority the thread actually has */
+static void run_profile_fifo(pthread_t thread, int priority, const char *name)
+{
+    if (priority <= 0)
+        return;
+
+#if defined(__linux__)
+    struct sched_param sp = { .sched_priority = priority };
+    int ret = pthread_setschedparam(thread, SCHED_FIFO, &sp);
+
+    int policy;
+    pthread_getschedparam(thread, &policy, &sp);
+    if (ret != 0) {
+        printf("Profile: %s thread, SCHED_FIFO %d refused, %s (needs CAP_SYS_NICE or an rtprio limit), running %s\n",
+            name, priority, strerror(ret), policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER");
+    } else {
+        printf("Profile: %s thread %s priority %d\n", name, policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER",
+            sp.sched_priority);
+    }
+#else
+    printf("Profile: %s thread, SCHED_FIFO unsupported on this platform\n", name);
+#endif
+}
+
+/* Lock everything mapped now and later into memory */
+static void run_profile_lock(const struct run_profile_s *p)
+{
+    if (!p->lock)
+        return;
+
+#if defined(__linux__)
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+        printf("Profile: memory locked\n");
+    } else {
+        printf("Profile: mlockall refused, %s (needs CAP_IPC_LOCK or a memlock limit)\n", strerror(errno));
+    }
+#else
+    printf("Profile: memory locking unsupported on this platform\n");
+#endif
+}
+
+static void run_profile_ring(const struct run_profile_s *p, const struct pkt_ring_s *ring, const char *name)
+{
+    if (!p->hugepages)
+        return;
+
+    printf("Profile: %s ring, %zu KB on %s\n", name,
+        (ring->count * sizeof(struct pkt_ring_slot_s)) / 1024, pkt_ring_backing_name(ring->backing));
+}
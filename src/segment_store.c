@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "segment_store.h"
+
+/* Append only, on disk feature store. Records go into segment files that rotate on unixtime
+ * boundaries, each with a sidecar index so a time range or a labelled span can be located
+ * without reading the records themselves.
+ *
+ *   <dir>/uc01-<segment start unixtime>.seg   binary record stream, see record.c
+ *   <dir>/uc01-<segment start unixtime>.idx   one struct segment_index_s per record
+ *
+ * Segments are named for the start of their slot (unixtime rounded down to the segment
+ * length), so a reader can pick the files for a range from the names alone. A probe that
+ * restarts inside a slot appends to the existing segment when the record layout is the same,
+ * otherwise (restarted with other options) it starts another one for the slot:
+ *
+ *   <dir>/uc01-<segment start unixtime>.<n>.seg   n = 1, 2 ... in the order they were started
+ */
+#define SEGMENT_STORE_MAX_SUFFIX 99
+
+
+struct segment_store_s
+{
+    char *dir;
+    int segmentSeconds;
+
+    /* Header every segment starts with, see record_binary_header() */
+    uint8_t *header;
+    int headerLength;
+
+    /* Current segment */
+    time_t segmentStart;
+    FILE *seg;
+    FILE *idx;
+    uint32_t segOffset;
+
+    /* Lifetime counters */
+    uint64_t records;
+    uint64_t segments;
+    uint64_t errors;
+};
+
+static void segment_store_close_segment(struct segment_store_s *s)
+{
+    if (s->seg)
+        fclose(s->seg);
+    if (s->idx)
+        fclose(s->idx);
+    s->seg = NULL;
+    s->idx = NULL;
+}
+
+static void segment_store_name(struct segment_store_s *s, char *fn, size_t size, time_t start, int suffix,
+    const char *ext)
+{
+    if (suffix) {
+        snprintf(fn, size, "%s/" SEGMENT_STORE_PREFIX "%" PRId64 ".%d.%s", s->dir, (int64_t)start, suffix, ext);
+    } else {
+        snprintf(fn, size, "%s/" SEGMENT_STORE_PREFIX "%" PRId64 ".%s", s->dir, (int64_t)start, ext);
+    }
+}
+
+/* Can our records be appended to segment fn? Yes if it's missing, empty or starts with our header. */
+static int segment_store_can_append(struct segment_store_s *s, const char *fn)
+{
+    FILE *fh = fopen(fn, "rb");
+    if (!fh)
+        return 1;
+
+    uint8_t *hdr = malloc(s->headerLength);
+    size_t len = hdr ? fread(hdr, 1, s->headerLength, fh) : 0;
+    int ok = hdr && (len == 0 || (len == (size_t)s->headerLength && memcmp(hdr, s->header, len) == 0));
+
+    free(hdr);
+    fclose(fh);
+    return ok;
+}
+
+static int segment_store_open_segment(struct segment_store_s *s, time_t start)
+{
+    char fn[1024];
+
+    segment_store_close_segment(s);
+
+    int suffix = 0;
+    segment_store_name(s, fn, sizeof(fn), start, suffix, "seg");
+    while (!segment_store_can_append(s, fn)) {
+        if (++suffix > SEGMENT_STORE_MAX_SUFFIX) {
+            fprintf(stderr, "segment_store: no segment for %" PRId64 " with this record layout\n", (int64_t)start);
+            return -1;
+        }
+        segment_store_name(s, fn, sizeof(fn), start, suffix, "seg");
+    }
+    if (suffix) {
+        fprintf(stderr, "segment_store: record layout differs from the segment already in this slot, starting %s\n", fn);
+    }
+
+    s->seg = fopen(fn, "ab");
+    if (!s->seg) {
+        fprintf(stderr, "segment_store: unable to open %s, %s\n", fn, strerror(errno));
+        return -1;
+    }
+
+    segment_store_name(s, fn, sizeof(fn), start, suffix, "idx");
+    s->idx = fopen(fn, "ab");
+    if (!s->idx) {
+        fprintf(stderr, "segment_store: unable to open %s, %s\n", fn, strerror(errno));
+        segment_store_close_segment(s);
+        return -1;
+    }
+
+    fseek(s->seg, 0, SEEK_END);
+    long pos = ftell(s->seg);
+    if (pos == 0) {
+        fwrite(s->header, 1, s->headerLength, s->seg);
+        pos = s->headerLength;
+    }
+    s->segOffset = pos;
+    s->segmentStart = start;
+    s->segments++;
+
+    return 0; /* Success */
+}
+
+/**
+ * @brief         Open a store, creating the directory if needed.
+ * @param[out]    struct segment_store_s **handle - new store
+ * @param[in]     const char *dir
+ * @param[in]     int segmentSeconds - Length of each segment, in seconds of record unixtime.
+ * @param[in]     const uint8_t *header, int headerLength - Binary stream header from record_binary_header()
+ * @return          0 - Success
+ * @return        < 0 - Error
+ */
+static int segment_store_alloc(struct segment_store_s **handle, const char *dir, int segmentSeconds,
+    const uint8_t *header, int headerLength)
+{
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "segment_store: unable to create %s, %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    struct segment_store_s *s = calloc(1, sizeof(*s));
+    if (!s)
+        return -1;
+
+    s->dir = strdup(dir);
+    s->segmentSeconds = segmentSeconds > 0 ? segmentSeconds : SEGMENT_STORE_DEFAULT_SECONDS;
+    s->header = malloc(headerLength);
+    if (!s->dir || !s->header) {
+        free(s->dir);
+        free(s->header);
+        free(s);
+        return -1;
+    }
+    memcpy(s->header, header, headerLength);
+    s->headerLength = headerLength;
+    s->segmentStart = -1;
+
+    *handle = s;
+    return 0; /* Success */
+}
+
+static void segment_store_free(struct segment_store_s *s)
+{
+    segment_store_close_segment(s);
+    free(s->header);
+    free(s->dir);
+    free(s);
+}
+
+/**
+ * @brief         Append one binary record, rotating to a new segment when unixtime leaves the
+ *                current one. Not thread safe, call from one thread.
+ * @return          0 - Success
+ * @return        < 0 - Error, the record was not stored
+ */
+static int segment_store_append(struct segment_store_s *s, const void *record, int lengthBytes,
+    int64_t unixtime, int on_air)
+{
+    time_t start = unixtime - (unixtime % s->segmentSeconds);
+    if (start != s->segmentStart || !s->seg) {
+        if (segment_store_open_segment(s, start) < 0) {
+            s->errors++;
+            return -1;
+        }
+    }
+
+    uint8_t entry[sizeof(struct segment_index_s)];
+    memset(entry, 0, sizeof(entry));
+    record_put_le(record_put_le(entry, (uint64_t)unixtime, 8), s->segOffset, 4);
+    entry[12] = on_air ? 1 : 0;
+
+    if (fwrite(record, 1, lengthBytes, s->seg) != (size_t)lengthBytes ||
+        fwrite(entry, 1, sizeof(entry), s->idx) != sizeof(entry))
+    {
+        s->errors++;
+        return -1;
+    }
+    s->segOffset += lengthBytes;
+    s->records++;
+
+    return 0; /* Success */
+}
+
+/* Push everything appended so far to the kernel, call at the end of a batch */
+static void segment_store_flush(struct segment_store_s *s)
+{
+    /* Record before index, so an index entry never points past the end of its segment */
+    if (s->seg)
+        fflush(s->seg);
+    if (s->idx)
+        fflush(s->idx);
+}
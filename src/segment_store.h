@@ -0,0 +1,21 @@
+#ifndef SEGMENT_STORE_H
+#define SEGMENT_STORE_H
+
+#include <stdint.h>
+
+/* On disk names and index entry of the feature store, shared by the writer (segment_store.c)
+ * and readers (store_uc_01.c).
+ */
+#define SEGMENT_STORE_DEFAULT_SECONDS 3600
+#define SEGMENT_STORE_PREFIX "uc01-"
+
+/* Little endian on disk, 16 bytes */
+struct segment_index_s
+{
+    int64_t unixtime;
+    uint32_t offset;         /* Of the record in the .seg file */
+    uint8_t on_air;          /* Label */
+    uint8_t reserved[3];
+};
+
+#endif /* SEGMENT_STORE_H */
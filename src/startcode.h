@@ -0,0 +1,188 @@
+#ifndef STARTCODE_H
+#define STARTCODE_H
+
+/* Fast search for the 00 00 01 NAL start code prefix.
+ *
+ * The scalar version is always available. On x86 we also carry SSE2 and AVX2 versions
+ * and pick the widest one the CPU supports at runtime. On aarch64 NEON is part of the
+ * base ISA, so no dispatch is needed there.
+ *
+ * Every implementation returns the first position p in [buf, end - 3] where
+ * p[0] == 0x00, p[1] == 0x00 and p[2] == 0x01, or NULL.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LTN_STARTCODE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define LTN_STARTCODE_NEON 1
+#endif
+
+typedef const uint8_t *(*ltn_startcode_find_fn)(const uint8_t *buf, const uint8_t *end);
+
+static inline const uint8_t *ltn_startcode_find_c(const uint8_t *p, const uint8_t *end)
+{
+	if (end - p < 3)
+		return NULL;
+
+	const uint8_t *last = end - 3;
+	while (p <= last) {
+		/* p[2] decides how far we can skip. Anything above 0x01 can't be part of
+		 * a start code at p, p + 1 or p + 2.
+		 */
+		if (p[2] > 1) {
+			p += 3;
+		} else
+		if (p[2] == 0) {
+			p++;
+		} else {
+			if (p[0] == 0 && p[1] == 0)
+				return p;
+			p += 3;
+		}
+	}
+
+	return NULL;
+}
+
+#if LTN_STARTCODE_X86
+__attribute__((target("sse2")))
+static inline const uint8_t *ltn_startcode_find_sse2(const uint8_t *p, const uint8_t *end)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+
+	/* Compare 16 candidate positions at a time, we need two bytes of lookahead past the block. */
+	while (end - p >= 16 + 2) {
+		__m128i b0 = _mm_loadu_si128((const __m128i *)(p + 0));
+		__m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+		__m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+
+		__m128i m = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+			_mm_cmpeq_epi8(b2, one));
+
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(m);
+		if (mask)
+			return p + __builtin_ctz(mask);
+
+		p += 16;
+	}
+
+	return ltn_startcode_find_c(p, end);
+}
+
+__attribute__((target("avx2")))
+static inline const uint8_t *ltn_startcode_find_avx2(const uint8_t *p, const uint8_t *end)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+
+	while (end - p >= 32 + 2) {
+		__m256i b0 = _mm256_loadu_si256((const __m256i *)(p + 0));
+		__m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+		__m256i b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+
+		__m256i m = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+			_mm256_cmpeq_epi8(b2, one));
+
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(m);
+		if (mask)
+			return p + __builtin_ctz(mask);
+
+		p += 32;
+	}
+
+	return ltn_startcode_find_sse2(p, end);
+}
+#endif /* LTN_STARTCODE_X86 */
+
+#if LTN_STARTCODE_NEON
+static inline const uint8_t *ltn_startcode_find_neon(const uint8_t *p, const uint8_t *end)
+{
+	const uint8x16_t zero = vdupq_n_u8(0);
+	const uint8x16_t one = vdupq_n_u8(1);
+
+	while (end - p >= 16 + 2) {
+		uint8x16_t m = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(p + 0), zero), vceqq_u8(vld1q_u8(p + 1), zero)),
+			vceqq_u8(vld1q_u8(p + 2), one));
+
+		/* No movemask on NEON, narrow each byte lane to a nibble and look at the 64bit result. */
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+		if (mask)
+			return p + (__builtin_ctzll(mask) >> 2);
+
+		p += 16;
+	}
+
+	return ltn_startcode_find_c(p, end);
+}
+#endif /* LTN_STARTCODE_NEON */
+
+static const struct ltn_startcode_impl_s
+{
+	const char *name;
+	ltn_startcode_find_fn find;
+} ltn_startcode_impls[] = {
+#if LTN_STARTCODE_X86
+	{ "avx2",   ltn_startcode_find_avx2, },
+	{ "sse2",   ltn_startcode_find_sse2, },
+#endif
+#if LTN_STARTCODE_NEON
+	{ "neon",   ltn_startcode_find_neon, },
+#endif
+	{ "scalar", ltn_startcode_find_c, },
+	{ NULL, NULL },
+};
+
+static ltn_startcode_find_fn ltn_startcode_find_impl = NULL;
+static const char *ltn_startcode_find_name = NULL;
+
+static inline int ltn_startcode_supported(const char *name)
+{
+#if LTN_STARTCODE_X86
+	__builtin_cpu_init();
+	if (strcmp(name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if (strcmp(name, "sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+#endif
+	return 1;
+}
+
+/**
+ * @brief         Select the start code scanner implementation. Called implicitly on first use,
+ *                callers that spawn threads should call it once up front.
+ * @param[in]     const char *name - "avx2", "sse2", "neon", "scalar" or NULL for the best the CPU supports.
+ * @return          0 - Success
+ * @return        < 0 - Error, name is unknown or not supported on this CPU
+ */
+static inline int ltn_startcode_select(const char *name)
+{
+	for (int i = 0; ltn_startcode_impls[i].name; i++) {
+		if (name && strcmp(name, ltn_startcode_impls[i].name) != 0)
+			continue;
+		if (!ltn_startcode_supported(ltn_startcode_impls[i].name))
+			continue;
+
+		ltn_startcode_find_impl = ltn_startcode_impls[i].find;
+		ltn_startcode_find_name = ltn_startcode_impls[i].name;
+		return 0; /* Success */
+	}
+
+	return -1; /* Not found */
+}
+
+static inline const uint8_t *ltn_startcode_find(const uint8_t *p, const uint8_t *end)
+{
+	if (__builtin_expect(ltn_startcode_find_impl == NULL, 0))
+		ltn_startcode_select(NULL);
+
+	return ltn_startcode_find_impl(p, end);
+}
+
+#endif /* STARTCODE_H */
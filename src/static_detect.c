@@ -0,0 +1,173 @@
+#include <stdint.h>
+#include <string.h>
+
+/* Static picture detection without decoding. An encoder fed a still image (an off air slate)
+ * codes it the same way picture after picture: P and B slices collapse to runs of skipped
+ * macroblocks and come out byte for byte identical, and each GOP repeats the last one's I
+ * slices and sizes. So every slice's data, from just past the header fields that change per
+ * picture (frame_num, POC), is fingerprinted and compared against the same slice of the
+ * previous picture and of the picture at the same GOP position one GOP earlier. Picture sizes
+ * are compared by GOP position as well.
+ *
+ * Hashing runs four independent 64 bit lanes over 32 bytes at a time, so the cost is close to
+ * a read of the slice. Nothing is kept but the fingerprints.
+ */
+#define STATIC_MAX_GOP 256       /* GOP positions tracked, longer GOPs wrap onto earlier positions */
+#define STATIC_MAX_SLICES 16     /* Slices fingerprinted per picture, the rest are ignored */
+
+#define STATIC_P1 0x9e3779b185ebca87ULL
+#define STATIC_P2 0xc2b2ae3d27d4eb4fULL
+#define STATIC_P3 0x165667b19e3779f9ULL
+#define STATIC_P4 0x85ebca77c2b2ae63ULL
+
+struct static_picture_s
+{
+    uint64_t hash[STATIC_MAX_SLICES];
+    uint32_t bytes;
+    uint16_t slices;         /* Fingerprinted, at most STATIC_MAX_SLICES */
+    int16_t type;            /* Slice type of the first slice, codec specific, -1 when unused */
+};
+
+struct static_detect_s
+{
+    int gopPos;              /* Of the current picture, decode order since the last random access picture, -1 before one */
+    int slice;               /* Slices seen in the current picture, 0 between pictures */
+    struct static_picture_s cur;
+    struct static_picture_s prev;
+    struct static_picture_s gop[STATIC_MAX_GOP];
+};
+
+static inline uint64_t static_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t static_load64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t static_round(uint64_t acc, uint64_t v)
+{
+    return static_rotl(acc + (v * STATIC_P2), 31) * STATIC_P1;
+}
+
+/* 64 bit fingerprint of a buffer, not cryptographic, byte order dependent */
+static uint64_t static_hash64(const uint8_t *p, int len)
+{
+    const uint8_t *end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t a = STATIC_P1 + STATIC_P2, b = STATIC_P2, c = 0, d = -STATIC_P1;
+        do {
+            a = static_round(a, static_load64(p));
+            b = static_round(b, static_load64(p + 8));
+            c = static_round(c, static_load64(p + 16));
+            d = static_round(d, static_load64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = static_rotl(a, 1) + static_rotl(b, 7) + static_rotl(c, 12) + static_rotl(d, 18);
+    } else {
+        h = STATIC_P3;
+    }
+    h += (uint64_t)len;
+
+    while (end - p >= 8) {
+        h ^= static_round(0, static_load64(p));
+        h = (static_rotl(h, 27) * STATIC_P1) + STATIC_P4;
+        p += 8;
+    }
+    while (p < end) {
+        h ^= (*p++) * STATIC_P3;
+        h = static_rotl(h, 11) * STATIC_P1;
+    }
+
+    h ^= h >> 33;
+    h *= STATIC_P2;
+    h ^= h >> 29;
+    h *= STATIC_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void static_detect_reset(struct static_detect_s *sd)
+{
+    memset(sd, 0, sizeof(*sd));
+    sd->gopPos = -1;
+    sd->prev.type = -1;
+    for (int i = 0; i < STATIC_MAX_GOP; i++)
+        sd->gop[i].type = -1;
+}
+
+/**
+ * @brief         Fingerprint one slice of the current picture, the first slice starts a picture.
+ * @param[in]     int irap - Boolean. The picture is a random access picture (IDR, CRA, BLA), GOP position 0.
+ * @param[in]     int type - Slice type, only compared for equality.
+ * @param[in]     const uint8_t *data, int len - The slice from the end of its parsed header fields.
+ * @return          1 - Repeats the previous picture or the previous GOP
+ * @return          0 - Doesn't
+ * @return        < 0 - Not fingerprinted, too many slices in the picture
+ */
+static int static_detect_slice(struct static_detect_s *sd, int irap, int type, const uint8_t *data, int len)
+{
+    if (sd->slice == 0) {
+        if (irap) {
+            sd->gopPos = 0;
+        } else
+        if (sd->gopPos >= 0) {
+            sd->gopPos++;
+        }
+        sd->cur.type = type;
+    }
+    int idx = sd->slice++;
+    if (idx >= STATIC_MAX_SLICES)
+        return -1;
+
+    uint64_t h = static_hash64(data, len > 0 ? len : 0);
+    sd->cur.hash[idx] = h;
+
+    if (sd->prev.type == type && sd->prev.slices > idx && sd->prev.hash[idx] == h)
+        return 1;
+
+    if (sd->gopPos >= 0) {
+        const struct static_picture_s *e = &sd->gop[sd->gopPos % STATIC_MAX_GOP];
+        if (e->type == type && e->slices > idx && e->hash[idx] == h)
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief         The current picture is complete.
+ * @param[in]     uint32_t bytes - Size of its slices.
+ * @return        >= 0 - Size similarity with the picture at the same GOP position one GOP ago,
+ *                       1 - |a - b| / max(a, b)
+ * @return         < 0 - No slices, or nothing to compare with yet
+ */
+static float static_detect_picture(struct static_detect_s *sd, uint32_t bytes)
+{
+    if (sd->slice == 0)
+        return -1.0f;
+
+    sd->cur.bytes = bytes;
+    sd->cur.slices = sd->slice < STATIC_MAX_SLICES ? sd->slice : STATIC_MAX_SLICES;
+    sd->slice = 0;
+
+    float similarity = -1.0f;
+    if (sd->gopPos >= 0) {
+        struct static_picture_s *e = &sd->gop[sd->gopPos % STATIC_MAX_GOP];
+        if (e->type >= 0) {
+            uint32_t hi = e->bytes > bytes ? e->bytes : bytes;
+            uint32_t lo = e->bytes > bytes ? bytes : e->bytes;
+            similarity = hi ? (float)lo / hi : 1.0f;
+        }
+        *e = sd->cur;
+    }
+    sd->prev = sd->cur;
+
+    return similarity;
+}
@@ -0,0 +1,298 @@
+#if defined(__linux__)
+#define _GNU_SOURCE /* getopt(), scandir() with --std=c11 */
+#endif
+
+/* Pull records back out of a probe_uc_01 feature store (-d), see segment_store.c.
+ * Segments are chosen by name, records by their index entries, and runs of adjacent matching
+ * records are written straight out of the mapped segment, so a range streams at disk speed.
+ * Usage: store_uc_01 -d dir [-s start] [-e end] [-l on|off] [-F binary|json] [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The writer half of record.c is the probes, not ours */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "record.c"
+#pragma GCC diagnostic pop
+#include "record_reader.c"
+#include "segment_store.h"
+
+struct segment_file_s
+{
+    int64_t start;
+    int suffix;              /* Later segments of the same slot, see segment_store.c */
+    char name[256];
+};
+
+struct reader_ctx_s
+{
+    char *dir;
+    int64_t start;           /* Inclusive */
+    int64_t end;             /* Exclusive */
+    int label;               /* -1 any, otherwise the on_air value wanted */
+    int json;                /* Boolean */
+    int verbose;
+
+    uint8_t *header;         /* Of the first segment read, binary output is one stream */
+    int headerLength;
+    struct record_layout_s layout;
+
+    uint64_t records;
+    uint64_t bytes;
+};
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s -d dir [-s start unixtime] [-e end unixtime] [-l on|off] [-F binary|json] [-v]\n", prog);
+    printf("  Writes the records in [start, end) to stdout, binary (def) or json\n");
+}
+
+static int segment_file_cmp(const void *a, const void *b)
+{
+    const struct segment_file_s *x = a, *y = b;
+    if (x->start != y->start)
+        return x->start < y->start ? -1 : 1;
+    return x->suffix < y->suffix ? -1 : x->suffix > y->suffix;
+}
+
+/* Map a whole file read only. Returns NULL for a missing or empty file. */
+static const uint8_t *map_file(const char *fn, size_t *len)
+{
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    *len = st.st_size;
+    return p;
+}
+
+static int output_run(struct reader_ctx_s *ctx, const uint8_t *p, size_t len)
+{
+    if (!ctx->json) {
+        fwrite(p, 1, len, stdout);
+        ctx->bytes += len;
+        return 0;
+    }
+
+    char line[RECORD_MAX_BYTES * 4];
+    for (size_t i = 0; i < len; i += ctx->layout.recordLength) {
+        int n = record_binary_to_json(&ctx->layout, p + i, line, sizeof(line));
+        if (n < 0)
+            return -1;
+        fwrite(line, 1, n, stdout);
+        ctx->bytes += n;
+    }
+    return 0;
+}
+
+static int read_segment(struct reader_ctx_s *ctx, struct segment_file_s *sf)
+{
+    char fn[1024];
+    size_t segLength = 0, idxLength = 0;
+
+    snprintf(fn, sizeof(fn), "%s/%s.seg", ctx->dir, sf->name);
+    const uint8_t *seg = map_file(fn, &segLength);
+    snprintf(fn, sizeof(fn), "%s/%s.idx", ctx->dir, sf->name);
+    const uint8_t *idx = map_file(fn, &idxLength);
+    if (!seg || !idx) {
+        if (seg)
+            munmap((void *)seg, segLength);
+        if (idx)
+            munmap((void *)idx, idxLength);
+        return 0; /* Empty, or being created */
+    }
+
+    int ret = 0;
+    struct record_layout_s layout;
+    if (record_binary_parse_header(seg, segLength, &layout) < 0) {
+        fprintf(stderr, "%s.seg: not a record segment, skipped\n", sf->name);
+        goto done;
+    }
+
+    if (!ctx->header) {
+        ctx->header = malloc(layout.headerLength);
+        memcpy(ctx->header, seg, layout.headerLength);
+        ctx->headerLength = layout.headerLength;
+        ctx->layout = layout;
+        if (!ctx->json) {
+            fwrite(ctx->header, 1, ctx->headerLength, stdout);
+        }
+    } else
+    if (layout.headerLength != ctx->headerLength || memcmp(seg, ctx->header, ctx->headerLength) != 0) {
+        if (!ctx->json) {
+            /* One binary stream has one header */
+            fprintf(stderr, "%s.seg: record layout differs from earlier segments, stopping\n", sf->name);
+            ret = -1;
+            goto done;
+        }
+        ctx->layout = layout; /* json carries its own keys, follow the segment */
+    }
+
+    /* Coalesce adjacent matches into a single write */
+    size_t runStart = 0, runLength = 0;
+    for (size_t i = 0; i + sizeof(struct segment_index_s) <= idxLength; i += sizeof(struct segment_index_s)) {
+        int64_t unixtime = (int64_t)record_get_le(idx + i, 8);
+        size_t offset = record_get_le(idx + i + 8, 4);
+        int on_air = idx[i + 12];
+
+        int match = unixtime >= ctx->start && unixtime < ctx->end && (ctx->label < 0 || ctx->label == on_air) &&
+            offset + layout.recordLength <= segLength;
+        if (!match)
+            continue;
+
+        ctx->records++;
+        if (runLength && runStart + runLength == offset) {
+            runLength += layout.recordLength;
+            continue;
+        }
+        if (runLength && output_run(ctx, seg + runStart, runLength) < 0) {
+            ret = -1;
+            goto done;
+        }
+        runStart = offset;
+        runLength = layout.recordLength;
+    }
+    if (runLength && output_run(ctx, seg + runStart, runLength) < 0)
+        ret = -1;
+
+done:
+    munmap((void *)seg, segLength);
+    munmap((void *)idx, idxLength);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    struct reader_ctx_s ctxs, *ctx = &ctxs;
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->start = INT64_MIN;
+    ctx->end = INT64_MAX;
+    ctx->label = -1;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "?hd:e:F:l:s:v")) != -1) {
+        switch(ch) {
+        case 'd':
+            ctx->dir = optarg;
+            break;
+        case 'e':
+            ctx->end = strtoll(optarg, NULL, 10);
+            break;
+        case 'F':
+            if (strcmp(optarg, "json") == 0) {
+                ctx->json = 1;
+            } else
+            if (strcmp(optarg, "binary") == 0) {
+                ctx->json = 0;
+            } else {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'l':
+            if (strcmp(optarg, "on") == 0) {
+                ctx->label = 1;
+            } else
+            if (strcmp(optarg, "off") == 0) {
+                ctx->label = 0;
+            } else {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 's':
+            ctx->start = strtoll(optarg, NULL, 10);
+            break;
+        case 'v':
+            ctx->verbose++;
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (!ctx->dir) {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    DIR *d = opendir(ctx->dir);
+    if (!d) {
+        perror(ctx->dir);
+        exit(1);
+    }
+
+    int count = 0, allocated = 0;
+    struct segment_file_s *files = NULL;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        int64_t start;
+        int suffix = 0, n = 0;
+        if ((sscanf(de->d_name, SEGMENT_STORE_PREFIX "%" SCNd64 ".seg%n", &start, &n) != 1 || de->d_name[n] != 0) &&
+            (sscanf(de->d_name, SEGMENT_STORE_PREFIX "%" SCNd64 ".%d.seg%n", &start, &suffix, &n) != 2 ||
+             de->d_name[n] != 0 || suffix < 1))
+            continue;
+        if (count == allocated) {
+            allocated = allocated ? allocated * 2 : 64;
+            files = realloc(files, sizeof(*files) * allocated);
+        }
+        files[count].start = start;
+        files[count].suffix = suffix;
+        if (suffix) {
+            snprintf(files[count].name, sizeof(files[count].name), SEGMENT_STORE_PREFIX "%" PRId64 ".%d", start, suffix);
+        } else {
+            snprintf(files[count].name, sizeof(files[count].name), SEGMENT_STORE_PREFIX "%" PRId64, start);
+        }
+        count++;
+    }
+    closedir(d);
+    qsort(files, count, sizeof(*files), segment_file_cmp);
+
+    int segments = 0;
+    for (int i = 0; i < count; i++) {
+        /* A segment runs until the next slot starts, every segment of a slot is read */
+        if (files[i].start >= ctx->end)
+            break;
+        int next = i + 1;
+        while (next < count && files[next].start == files[i].start)
+            next++;
+        if (next < count && files[next].start <= ctx->start)
+            continue;
+
+        segments++;
+        if (read_segment(ctx, &files[i]) < 0)
+            break;
+    }
+    fflush(stdout);
+
+    if (ctx->verbose) {
+        fprintf(stderr, "%" PRIu64 " records, %" PRIu64 " bytes from %d of %d segments\n",
+            ctx->records, ctx->bytes, segments, count);
+    }
+
+    free(files);
+    free(ctx->header);
+
+    return 0;
+}
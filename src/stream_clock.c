@@ -0,0 +1,82 @@
+#include <stdint.h>
+#include <string.h>
+
+/* Time derived from the stream itself, rather than the walltime packets happened to arrive.
+ * Follows the PCR of a single pid and unwraps it into a monotonic 27MHz tick count, so
+ * replayed captures and live streams produce the same timeline.
+ */
+#define STREAM_CLOCK_HZ 27000000LL
+#define STREAM_CLOCK_WRAP ((1LL << 33) * 300)
+
+/* A jump larger than this is a discontinuity (splice, looped capture), not elapsed time */
+#define STREAM_CLOCK_MAX_STEP (10 * STREAM_CLOCK_HZ)
+
+struct stream_clock_s
+{
+    int pid;                 /* PCR pid being followed, 0x2000 locks onto the first pid carrying a PCR */
+    int locked;              /* Boolean. At least one PCR has been seen */
+    uint64_t lastPCR;        /* Last raw 27MHz PCR */
+    int64_t ticks;           /* 27MHz ticks since the first PCR, unwrapped */
+    uint64_t discontinuities;
+};
+
+/* Returns 0 and the 27MHz PCR if pkt carries one */
+static int stream_clock_packet_pcr(const uint8_t *pkt, uint64_t *pcr)
+{
+    if ((pkt[3] & 0x20) == 0)
+        return -1; /* No adaptation field */
+    if (pkt[4] < 7 || (pkt[5] & 0x10) == 0)
+        return -1; /* No PCR */
+
+    uint64_t base = ((uint64_t)pkt[6] << 25) | ((uint64_t)pkt[7] << 17) | ((uint64_t)pkt[8] << 9) |
+        ((uint64_t)pkt[9] << 1) | (pkt[10] >> 7);
+    uint64_t ext = ((pkt[10] & 0x01) << 8) | pkt[11];
+
+    *pcr = (base * 300) + ext;
+    return 0; /* Success */
+}
+
+static void stream_clock_init(struct stream_clock_s *clk, int pid)
+{
+    memset(clk, 0, sizeof(*clk));
+    clk->pid = pid;
+}
+
+/* Advance the clock from any PCRs in a buffer of aligned transport packets. */
+static void stream_clock_write(struct stream_clock_s *clk, const uint8_t *pkts, int packetCount)
+{
+    for (int i = 0; i < packetCount; i++) {
+        const uint8_t *pkt = pkts + (i * 188);
+        uint64_t pcr;
+
+        if (stream_clock_packet_pcr(pkt, &pcr) < 0)
+            continue;
+
+        int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+        if (clk->pid == 0x2000) {
+            clk->pid = pid;
+        }
+        if (pid != clk->pid)
+            continue;
+
+        if (clk->locked) {
+            int64_t delta = (int64_t)pcr - (int64_t)clk->lastPCR;
+            if (delta < 0 && delta < -(STREAM_CLOCK_WRAP / 2)) {
+                delta += STREAM_CLOCK_WRAP;
+            }
+            if (delta < 0 || delta > STREAM_CLOCK_MAX_STEP) {
+                clk->discontinuities++;
+                delta = 0;
+            }
+            clk->ticks += delta;
+        }
+        clk->lastPCR = pcr;
+        clk->locked = 1;
+    }
+}
+
+/* Milliseconds since the first PCR */
+static int64_t stream_clock_ms(struct stream_clock_s *clk)
+{
+    return clk->ticks / (STREAM_CLOCK_HZ / 1000);
+}
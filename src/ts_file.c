@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Read only, memory mapped transport stream capture, for replaying files through the probe
+ * faster than real time. Packets are handed to the analysis pipeline straight out of the
+ * mapping, nothing is copied.
+ */
+struct ts_file_s
+{
+    int fd;
+    const uint8_t *map;
+    size_t lengthBytes;
+    time_t mtime;
+    size_t pos;              /* Offset of the next packet to be read */
+    uint64_t resyncs;        /* Times we lost 0x47 alignment and had to hunt for it */
+};
+
+/* Two consecutive sync bytes, good enough to lock onto a capture */
+static int ts_file_synced(struct ts_file_s *f, size_t pos)
+{
+    if (pos + 188 > f->lengthBytes)
+        return 0;
+    if (f->map[pos] != 0x47)
+        return 0;
+    if (pos + 376 <= f->lengthBytes && f->map[pos + 188] != 0x47)
+        return 0;
+    return 1;
+}
+
+static void ts_file_resync(struct ts_file_s *f)
+{
+    while (f->pos + 188 <= f->lengthBytes && !ts_file_synced(f, f->pos))
+        f->pos++;
+}
+
+static void ts_file_close(struct ts_file_s *f)
+{
+    if (f->map)
+        munmap((void *)f->map, f->lengthBytes);
+    if (f->fd >= 0)
+        close(f->fd);
+    free(f);
+}
+
+/**
+ * @brief         Open and map a .ts capture for replay.
+ * @param[out]    struct ts_file_s **handle - new file
+ * @param[in]     const char *filename
+ * @return          0 - Success
+ * @return        < 0 - Error
+ */
+static int ts_file_open(struct ts_file_s **handle, const char *filename)
+{
+    struct ts_file_s *f = calloc(1, sizeof(*f));
+    if (!f)
+        return -1;
+
+    f->fd = open(filename, O_RDONLY);
+    if (f->fd < 0) {
+        perror("ts_file: open");
+        ts_file_close(f);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(f->fd, &st) < 0 || st.st_size < 188) {
+        fprintf(stderr, "ts_file: %s is not a transport stream capture\n", filename);
+        ts_file_close(f);
+        return -1;
+    }
+    f->lengthBytes = st.st_size;
+    f->mtime = st.st_mtime;
+
+    void *map = mmap(NULL, f->lengthBytes, PROT_READ, MAP_PRIVATE, f->fd, 0);
+    if (map == MAP_FAILED) {
+        perror("ts_file: mmap");
+        ts_file_close(f);
+        return -1;
+    }
+    f->map = map;
+
+    /* One pass, front to back, let the kernel read ahead aggressively */
+    madvise(map, f->lengthBytes, MADV_SEQUENTIAL);
+
+    ts_file_resync(f);
+
+    *handle = f;
+    return 0; /* Success */
+}
+
+/**
+ * @brief         Next run of aligned packets, up to maxPackets, pointing into the mapping.
+ * @return        > 0 - Number of packets at *pkts
+ * @return          0 - End of file
+ */
+static int ts_file_read(struct ts_file_s *f, const uint8_t **pkts, int maxPackets)
+{
+    if (f->pos + 188 <= f->lengthBytes && f->map[f->pos] != 0x47) {
+        f->resyncs++;
+        ts_file_resync(f);
+    }
+
+    int count = 0;
+    while (count < maxPackets && f->pos + ((count + 1) * 188) <= f->lengthBytes &&
+        f->map[f->pos + (count * 188)] == 0x47)
+    {
+        count++;
+    }
+
+    *pkts = f->map + f->pos;
+    f->pos += count * 188;
+
+    return count;
+}
+
+/**
+ * @brief         Playout duration of the capture in milliseconds, from the first and last PCR
+ *                of the pid the clock locks onto. Assumes no discontinuities.
+ * @return        >= 0 - Duration
+ * @return        < 0 - No PCR found
+ */
+static int64_t ts_file_pcr_span_ms(struct ts_file_s *f)
+{
+    uint64_t first = 0, last = 0;
+    int pid = -1;
+
+    /* Head */
+    for (size_t pos = f->pos; pos + 188 <= f->lengthBytes; pos += 188) {
+        if (f->map[pos] == 0x47 && stream_clock_packet_pcr(&f->map[pos], &first) == 0) {
+            pid = ((f->map[pos + 1] & 0x1f) << 8) | f->map[pos + 2];
+            break;
+        }
+    }
+    if (pid < 0 || f->pos + 188 > f->lengthBytes)
+        return -1;
+
+    /* Tail, walk backwards one packet at a time from the last aligned packet */
+    size_t pos = f->pos + (((f->lengthBytes - f->pos) / 188) - 1) * 188;
+    while (1) {
+        const uint8_t *pkt = &f->map[pos];
+        if (pkt[0] == 0x47 && (((pkt[1] & 0x1f) << 8) | pkt[2]) == pid && stream_clock_packet_pcr(pkt, &last) == 0)
+            break;
+        if (pos < f->pos + 188)
+            return -1;
+        pos -= 188;
+    }
+
+    int64_t ticks = (int64_t)last - (int64_t)first;
+    if (ticks < 0)
+        ticks += STREAM_CLOCK_WRAP;
+
+    return ticks / (STREAM_CLOCK_HZ / 1000);
+}
@@ -0,0 +1,517 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Synthetic H.264 in MPEG-TS, for benchmarking the probe without a capture. One program,
+ * a PAT, a PMT and a constant rate mux with null packet padding and a PCR on the video pid.
+ *
+ * Every picture is an AUD, a SPS/PPS pair on IDRs, then slices with real slice headers
+ * (parseable through to the QP by h264_params.c) followed by random slice data. The share
+ * of zero bytes in the slice data controls how often emulation prevention kicks in, real
+ * CABAC data is around 1%. Emulation prevention is applied so the only 00 00 01 sequences
+ * are start codes, same as a compliant encoder.
+ *
+ * GOPs are closed, IDR then P pictures with bframes non-reference B pictures between them,
+ * in decode order with PTS/DTS reordered to match. Output is deterministic for a given set
+ * of params.
+ */
+#define TS_GEN_PMT_PID 0x1000
+#define TS_GEN_PSI_INTERVAL 3    /* Pictures between PAT/PMT repeats, ~100ms at 29.97 */
+#define TS_GEN_PTS_DELAY 63000   /* 90KHz. DTS leads the mux clock by 0.7 seconds */
+
+struct ts_gen_params_s
+{
+    int bitrate;             /* Video bits per second, the mux runs ~20% above it */
+    int gop;                 /* Pictures per IDR */
+    int bframes;             /* B pictures between reference pictures */
+    int slices;              /* Per picture */
+    int zeroPercent;         /* Of slice data bytes that are zero, drives emulation prevention */
+    int fpsNum, fpsDen;
+    int seconds;             /* Of video generated */
+    uint16_t pid;
+    uint32_t seed;
+};
+
+/* Bit writer with emulation prevention applied, the way an encoder writes a nal */
+struct ts_gen_bitwriter_s
+{
+    uint8_t *buf;
+    int bytes;
+    uint32_t acc;
+    int nbits;
+    int zeros;
+    uint64_t escapes;        /* Emulation prevention bytes inserted */
+};
+
+struct ts_gen_s
+{
+    struct ts_gen_params_s params;
+    uint64_t rng;
+
+    /* Elementary stream of the current picture, then its packets */
+    uint8_t *es;
+    int esSize;
+    uint8_t *pkts;
+    int pktsSize;            /* In packets */
+
+    int64_t pictures;        /* Total to generate */
+    int64_t decodeIndex;     /* Of the next picture */
+    int gopPos;              /* Decode position within the GOP */
+    int *gopDisplay;         /* Display index for each decode position of a GOP */
+    int *gopType;            /* slice_type % 5 for each decode position, 0 P, 1 B, 2 I */
+    double gopUnit;          /* Bytes of a B picture, P are twice and I four times the size */
+    int prevRefFrameNum;
+    int done;                /* Boolean. The closing PES has been written */
+
+    uint64_t packetIndex;    /* Packets muxed, the mux clock */
+    double ticksPerPacket;   /* 27MHz */
+    uint8_t cc[3];           /* Continuity counters, PAT, PMT, video */
+
+    /* What went into the stream, for checking the analysis against */
+    uint64_t sliceCount[3];  /* P, B, I as slice_type % 5 */
+    uint64_t sliceBytes;     /* Slice nals including their header byte, start codes excluded */
+    uint64_t escapes;
+    uint64_t packets;
+    uint64_t pesCount;
+};
+
+static void ts_gen_defaults(struct ts_gen_params_s *p)
+{
+    memset(p, 0, sizeof(*p));
+    p->bitrate = 20000000;
+    p->gop = 60;
+    p->bframes = 2;
+    p->slices = 4;
+    p->zeroPercent = 1;
+    p->fpsNum = 30000;
+    p->fpsDen = 1001;
+    p->seconds = 10;
+    p->pid = 0x100;
+    p->seed = 1;
+}
+
+static uint32_t ts_gen_rand(struct ts_gen_s *g)
+{
+    g->rng ^= g->rng << 13;
+    g->rng ^= g->rng >> 7;
+    g->rng ^= g->rng << 17;
+    return (uint32_t)g->rng;
+}
+
+static void ts_gen_put_byte(struct ts_gen_bitwriter_s *w, uint8_t b)
+{
+    if (w->zeros >= 2 && b <= 3) {
+        w->buf[w->bytes++] = 3;
+        w->zeros = 0;
+        w->escapes++;
+    }
+    w->buf[w->bytes++] = b;
+    w->zeros = b ? 0 : w->zeros + 1;
+}
+
+static void ts_gen_put_bits(struct ts_gen_bitwriter_s *w, int n, uint32_t v)
+{
+    for (int i = n - 1; i >= 0; i--) {
+        w->acc = (w->acc << 1) | ((v >> i) & 1);
+        if (++w->nbits == 8) {
+            ts_gen_put_byte(w, w->acc);
+            w->acc = 0;
+            w->nbits = 0;
+        }
+    }
+}
+
+static void ts_gen_put_ue(struct ts_gen_bitwriter_s *w, uint32_t v)
+{
+    int len = 32 - __builtin_clz(v + 1);
+    ts_gen_put_bits(w, len - 1, 0);
+    ts_gen_put_bits(w, len, v + 1);
+}
+
+static void ts_gen_put_se(struct ts_gen_bitwriter_s *w, int v)
+{
+    ts_gen_put_ue(w, v > 0 ? (2 * v) - 1 : -2 * v);
+}
+
+/* rbsp_trailing_bits() */
+static void ts_gen_put_trailing(struct ts_gen_bitwriter_s *w)
+{
+    ts_gen_put_bits(w, 1, 1);
+    if (w->nbits)
+        ts_gen_put_bits(w, 8 - w->nbits, 0);
+}
+
+/* Start code and nal header, written raw */
+static void ts_gen_nal_start(struct ts_gen_bitwriter_s *w, uint8_t nalHeader)
+{
+    w->buf[w->bytes++] = 0;
+    w->buf[w->bytes++] = 0;
+    w->buf[w->bytes++] = 1;
+    w->buf[w->bytes++] = nalHeader;
+    w->zeros = 0;
+}
+
+/* Main profile 1920x1088, 8 bit frame_num and pic_order_cnt_lsb */
+static void ts_gen_sps(struct ts_gen_bitwriter_s *w)
+{
+    ts_gen_nal_start(w, 0x67);
+    ts_gen_put_bits(w, 8, 77); /* profile_idc */
+    ts_gen_put_bits(w, 8, 0);  /* constraint flags */
+    ts_gen_put_bits(w, 8, 40); /* level_idc */
+    ts_gen_put_ue(w, 0);       /* seq_parameter_set_id */
+    ts_gen_put_ue(w, 4);       /* log2_max_frame_num_minus4 */
+    ts_gen_put_ue(w, 0);       /* pic_order_cnt_type */
+    ts_gen_put_ue(w, 4);       /* log2_max_pic_order_cnt_lsb_minus4 */
+    ts_gen_put_ue(w, 2);       /* max_num_ref_frames */
+    ts_gen_put_bits(w, 1, 0);  /* gaps_in_frame_num_value_allowed_flag */
+    ts_gen_put_ue(w, 119);     /* pic_width_in_mbs_minus1 */
+    ts_gen_put_ue(w, 67);      /* pic_height_in_map_units_minus1 */
+    ts_gen_put_bits(w, 1, 1);  /* frame_mbs_only_flag */
+    ts_gen_put_bits(w, 1, 1);  /* direct_8x8_inference_flag */
+    ts_gen_put_bits(w, 1, 0);  /* frame_cropping_flag */
+    ts_gen_put_bits(w, 1, 0);  /* vui_parameters_present_flag */
+    ts_gen_put_trailing(w);
+}
+
+/* CABAC, one reference per list, no weighted prediction */
+static void ts_gen_pps(struct ts_gen_bitwriter_s *w)
+{
+    ts_gen_nal_start(w, 0x68);
+    ts_gen_put_ue(w, 0);       /* pic_parameter_set_id */
+    ts_gen_put_ue(w, 0);       /* seq_parameter_set_id */
+    ts_gen_put_bits(w, 1, 1);  /* entropy_coding_mode_flag */
+    ts_gen_put_bits(w, 1, 0);  /* bottom_field_pic_order_in_frame_present_flag */
+    ts_gen_put_ue(w, 0);       /* num_slice_groups_minus1 */
+    ts_gen_put_ue(w, 0);       /* num_ref_idx_l0_default_active_minus1 */
+    ts_gen_put_ue(w, 0);       /* num_ref_idx_l1_default_active_minus1 */
+    ts_gen_put_bits(w, 1, 0);  /* weighted_pred_flag */
+    ts_gen_put_bits(w, 2, 0);  /* weighted_bipred_idc */
+    ts_gen_put_se(w, 0);       /* pic_init_qp_minus26 */
+    ts_gen_put_se(w, 0);       /* pic_init_qs_minus26 */
+    ts_gen_put_se(w, 0);       /* chroma_qp_index_offset */
+    ts_gen_put_bits(w, 1, 1);  /* deblocking_filter_control_present_flag */
+    ts_gen_put_bits(w, 1, 0);  /* constrained_intra_pred_flag */
+    ts_gen_put_bits(w, 1, 0);  /* redundant_pic_cnt_present_flag */
+    ts_gen_put_trailing(w);
+}
+
+/* type is slice_type % 5, 0 P, 1 B, 2 I */
+static void ts_gen_slice(struct ts_gen_s *g, struct ts_gen_bitwriter_s *w, int type, int idr, int firstMb,
+    int frameNum, int pocLsb, int dataBytes)
+{
+    int start = w->bytes;
+    uint64_t escapes = w->escapes;
+    int nal_ref_idc = type == 1 ? 0 : (idr ? 3 : 2);
+
+    ts_gen_nal_start(w, (nal_ref_idc << 5) | (idr ? 5 : 1));
+    ts_gen_put_ue(w, firstMb);
+    ts_gen_put_ue(w, type + 5);   /* All slices of the picture are this type */
+    ts_gen_put_ue(w, 0);          /* pic_parameter_set_id */
+    ts_gen_put_bits(w, 8, frameNum);
+    if (idr)
+        ts_gen_put_ue(w, 0);      /* idr_pic_id */
+    ts_gen_put_bits(w, 8, pocLsb);
+    if (type == 1)
+        ts_gen_put_bits(w, 1, 1); /* direct_spatial_mv_pred_flag */
+    if (type != 2)
+        ts_gen_put_bits(w, 1, 0); /* num_ref_idx_active_override_flag */
+    if (type != 2)
+        ts_gen_put_bits(w, 1, 0); /* ref_pic_list_modification_flag_l0 */
+    if (type == 1)
+        ts_gen_put_bits(w, 1, 0); /* ref_pic_list_modification_flag_l1 */
+    if (nal_ref_idc && idr)
+        ts_gen_put_bits(w, 2, 0); /* no_output_of_prior_pics_flag, long_term_reference_flag */
+    if (nal_ref_idc && !idr)
+        ts_gen_put_bits(w, 1, 0); /* adaptive_ref_pic_marking_mode_flag */
+    if (type != 2)
+        ts_gen_put_ue(w, 0);      /* cabac_init_idc */
+    ts_gen_put_se(w, (int)(ts_gen_rand(g) % 9) - 4); /* slice_qp_delta */
+    ts_gen_put_ue(w, 0);          /* disable_deblocking_filter_idc */
+    ts_gen_put_se(w, 0);          /* slice_alpha_c0_offset_div2 */
+    ts_gen_put_se(w, 0);          /* slice_beta_offset_div2 */
+    while (w->nbits)
+        ts_gen_put_bits(w, 1, 1); /* cabac_alignment_one_bit */
+
+    /* Slice data, then a last byte that ends the nal without a trailing zero */
+    for (int i = 0; i < dataBytes; i++) {
+        uint32_t r = ts_gen_rand(g);
+        ts_gen_put_byte(w, (int)(r % 100) < g->params.zeroPercent ? 0 : 1 + ((r >> 8) % 255));
+    }
+    ts_gen_put_byte(w, 0x80);
+
+    g->sliceCount[type]++;
+    g->sliceBytes += w->bytes - start - 3;
+    g->escapes += w->escapes - escapes;
+}
+
+/* MPEG-2 CRC32, ISO-13818-1 Annex A */
+static uint32_t ts_gen_crc32(const uint8_t *p, int len)
+{
+    uint32_t crc = 0xffffffff;
+    for (int i = 0; i < len; i++) {
+        crc ^= (uint32_t)p[i] << 24;
+        for (int b = 0; b < 8; b++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+    }
+    return crc;
+}
+
+static uint8_t *ts_gen_packet(struct ts_gen_s *g, int *count, uint16_t pid, int pusi, int ccIndex, int payload)
+{
+    uint8_t *pkt = g->pkts + ((*count)++ * 188);
+    pkt[0] = 0x47;
+    pkt[1] = (pusi ? 0x40 : 0) | (pid >> 8);
+    pkt[2] = pid & 0xff;
+    pkt[3] = payload ? 0x10 : 0x00;
+    if (payload && ccIndex >= 0)
+        pkt[3] |= g->cc[ccIndex]++ & 0x0f;
+    g->packetIndex++;
+    return pkt;
+}
+
+/* A single packet section, pointer field then the section and its CRC, stuffed with 0xff */
+static void ts_gen_section(struct ts_gen_s *g, int *count, uint16_t pid, int ccIndex, const uint8_t *section, int len)
+{
+    uint8_t *pkt = ts_gen_packet(g, count, pid, 1, ccIndex, 1);
+    memset(pkt + 4, 0xff, 184);
+    pkt[4] = 0;
+    memcpy(pkt + 5, section, len);
+    uint32_t crc = ts_gen_crc32(section, len);
+    pkt[5 + len + 0] = crc >> 24;
+    pkt[5 + len + 1] = crc >> 16;
+    pkt[5 + len + 2] = crc >> 8;
+    pkt[5 + len + 3] = crc;
+}
+
+static void ts_gen_psi(struct ts_gen_s *g, int *count)
+{
+    const uint8_t pat[] = {
+        0x00, 0xb0, 13, 0x00, 0x01, 0xc1, 0x00, 0x00,
+        0x00, 0x01, 0xe0 | (TS_GEN_PMT_PID >> 8), TS_GEN_PMT_PID & 0xff,
+    };
+    ts_gen_section(g, count, 0, 0, pat, sizeof(pat));
+
+    uint16_t pid = g->params.pid;
+    const uint8_t pmt[] = {
+        0x02, 0xb0, 18, 0x00, 0x01, 0xc1, 0x00, 0x00,
+        0xe0 | (pid >> 8), pid & 0xff, 0xf0, 0x00,
+        0x1b, 0xe0 | (pid >> 8), pid & 0xff, 0xf0, 0x00,
+    };
+    ts_gen_section(g, count, TS_GEN_PMT_PID, 1, pmt, sizeof(pmt));
+}
+
+static void ts_gen_timestamp(uint8_t *p, int marker, int64_t ts)
+{
+    p[0] = (marker << 4) | (((ts >> 30) & 0x07) << 1) | 1;
+    p[1] = ts >> 22;
+    p[2] = (((ts >> 15) & 0x7f) << 1) | 1;
+    p[3] = ts >> 7;
+    p[4] = ((ts & 0x7f) << 1) | 1;
+}
+
+/* Packetize es[0..len) as one PES, PCR in the first packet, adaptation field stuffing in the last */
+static void ts_gen_pes(struct ts_gen_s *g, int *count, int len, int64_t pts, int64_t dts, int rai)
+{
+    uint8_t hdr[19] = { 0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x80, 0xc0, 10 };
+    ts_gen_timestamp(&hdr[9], 3, pts);
+    ts_gen_timestamp(&hdr[14], 1, dts);
+
+    uint16_t pid = g->params.pid;
+    int pos = -(int)sizeof(hdr); /* Negative while writing the PES header */
+    int first = 1;
+    while (pos < len) {
+        uint8_t *pkt = ts_gen_packet(g, count, pid, first, 2, 1);
+        int af = 0;
+        if (first) {
+            uint64_t pcr = (uint64_t)((g->packetIndex - 1) * g->ticksPerPacket);
+            pkt[3] |= 0x20;
+            pkt[4] = 7;
+            pkt[5] = 0x10 | (rai ? 0x40 : 0);
+            uint64_t base = pcr / 300, ext = pcr % 300;
+            pkt[6] = base >> 25;
+            pkt[7] = base >> 17;
+            pkt[8] = base >> 9;
+            pkt[9] = base >> 1;
+            pkt[10] = ((base & 1) << 7) | 0x7e | (ext >> 8);
+            pkt[11] = ext;
+            af = 8;
+        }
+
+        int room = 184 - af;
+        int remaining = len - pos;
+        if (remaining < room) {
+            /* Stuff the last packet with (more) adaptation field */
+            int stuff = room - remaining;
+            if (af) {
+                memset(pkt + 12, 0xff, stuff);
+                pkt[4] += stuff;
+            } else {
+                pkt[3] |= 0x20;
+                pkt[4] = stuff - 1;
+                if (stuff > 1) {
+                    pkt[5] = 0;
+                    memset(pkt + 6, 0xff, stuff - 2);
+                }
+            }
+            af += stuff;
+            room = remaining;
+        }
+
+        uint8_t *dst = pkt + 4 + af;
+        for (int i = 0; i < room; i++, pos++)
+            dst[i] = pos < 0 ? hdr[pos + sizeof(hdr)] : g->es[pos];
+        first = 0;
+    }
+    g->pesCount++;
+}
+
+static void ts_gen_free(struct ts_gen_s *g)
+{
+    free(g->es);
+    free(g->pkts);
+    free(g->gopDisplay);
+    free(g->gopType);
+    free(g);
+}
+
+/**
+ * @brief         Create a generator.
+ * @param[out]    struct ts_gen_s **handle
+ * @param[in]     const struct ts_gen_params_s *params - Start from ts_gen_defaults()
+ * @return          0 - Success
+ * @return        < 0 - Error, params out of range
+ */
+static int ts_gen_alloc(struct ts_gen_s **handle, const struct ts_gen_params_s *params)
+{
+    const struct ts_gen_params_s *p = params;
+    if (p->bitrate < 100000 || p->gop < 1 || p->gop > 128 || p->bframes < 0 || p->slices < 1 || p->slices > 68 ||
+        p->zeroPercent < 0 || p->zeroPercent > 100 || p->fpsNum < 1 || p->fpsDen < 1 || p->seconds < 1 ||
+        p->pid < 0x20 || p->pid >= 0x1fff || p->pid == TS_GEN_PMT_PID)
+    {
+        return -1;
+    }
+
+    struct ts_gen_s *g = calloc(1, sizeof(*g));
+    if (!g)
+        return -1;
+    g->params = *p;
+    g->rng = 0x9e3779b97f4a7c15ULL ^ p->seed;
+
+    /* Room for an I picture of up to four times the average size, plus headers and escapes */
+    int avgBytes = (int)(((int64_t)p->bitrate * p->fpsDen) / ((int64_t)p->fpsNum * 8));
+    g->esSize = (avgBytes * 8) + (p->slices * 64) + 4096;
+    g->pktsSize = (g->esSize / 160) + 1024;
+    g->es = malloc(g->esSize);
+    g->pkts = malloc(g->pktsSize * 188);
+    g->gopDisplay = malloc(p->gop * sizeof(int));
+    g->gopType = malloc(p->gop * sizeof(int));
+    if (!g->es || !g->pkts || !g->gopDisplay || !g->gopType) {
+        ts_gen_free(g);
+        return -1;
+    }
+
+    /* Decode order of a GOP: I, then each P followed by the B pictures it anchors */
+    int n = 0, prev = 0, weights = 4;
+    g->gopType[n] = 2;
+    g->gopDisplay[n++] = 0;
+    while (prev < p->gop - 1) {
+        int next = prev + p->bframes + 1;
+        if (next > p->gop - 1)
+            next = p->gop - 1;
+        g->gopType[n] = 0;
+        g->gopDisplay[n++] = next;
+        weights += 2;
+        for (int k = prev + 1; k < next; k++) {
+            g->gopType[n] = 1;
+            g->gopDisplay[n++] = k;
+            weights += 1;
+        }
+        prev = next;
+    }
+    g->gopUnit = (double)avgBytes * p->gop / weights;
+
+    /* Mux 20% over the video rate, plus room for the PSI */
+    double muxrate = (p->bitrate * 1.2) + (2 * 188 * 8 * ((double)p->fpsNum / p->fpsDen) / TS_GEN_PSI_INTERVAL);
+    g->ticksPerPacket = (188 * 8 * 27000000.0) / muxrate;
+    g->pictures = ((int64_t)p->seconds * p->fpsNum) / p->fpsDen;
+
+    *handle = g;
+    return 0; /* Success */
+}
+
+/**
+ * @brief         Generate the next picture, or the closing PES that completes the last one.
+ * @param[out]    const uint8_t **pkts - Aligned packets, valid until the next call
+ * @return        > 0 - Number of packets at *pkts
+ * @return          0 - Done
+ */
+static int ts_gen_next(struct ts_gen_s *g, const uint8_t **pkts)
+{
+    const struct ts_gen_params_s *p = &g->params;
+    int count = 0;
+    *pkts = g->pkts;
+
+    if (g->done)
+        return 0;
+
+    int64_t dur90 = (90000LL * p->fpsDen) / p->fpsNum;
+    int64_t dts = TS_GEN_PTS_DELAY + (g->decodeIndex * dur90);
+
+    /* Hold the picture back until the constant rate mux clock reaches its DTS */
+    while ((g->packetIndex * g->ticksPerPacket) / 300 < dts - TS_GEN_PTS_DELAY && count < g->pktsSize / 2) {
+        uint8_t *pkt = ts_gen_packet(g, &count, 0x1fff, 0, -1, 1);
+        memset(pkt + 4, 0xff, 184);
+    }
+    if (g->decodeIndex % TS_GEN_PSI_INTERVAL == 0)
+        ts_gen_psi(g, &count);
+
+    struct ts_gen_bitwriter_s w = { .buf = g->es };
+    ts_gen_nal_start(&w, 0x09);
+    ts_gen_put_bits(&w, 3, 7); /* primary_pic_type, anything */
+    ts_gen_put_trailing(&w);
+
+    if (g->decodeIndex == g->pictures) {
+        /* An access unit delimiter on its own, so the PES before it is complete */
+        ts_gen_pes(g, &count, w.bytes, dts, dts, 0);
+        g->done = 1;
+        g->packets += count;
+        return count;
+    }
+
+    int gopPos = g->gopPos;
+    int display = g->gopDisplay[gopPos];
+    int type = g->gopType[gopPos];
+    int idr = gopPos == 0;
+
+    int frameNum;
+    if (idr) {
+        frameNum = 0;
+        g->prevRefFrameNum = 0;
+    } else {
+        frameNum = (g->prevRefFrameNum + 1) % 256;
+        if (type != 1)
+            g->prevRefFrameNum = frameNum;
+    }
+
+    if (idr) {
+        ts_gen_sps(&w);
+        ts_gen_pps(&w);
+    }
+
+    /* Picture size by type, I:P:B as 4:2:1 averaging out to the bitrate, +/- 10% */
+    int bytes = (int)(g->gopUnit * (type == 2 ? 4 : type == 0 ? 2 : 1));
+    bytes = (bytes * (90 + (int)(ts_gen_rand(g) % 21))) / 100;
+
+    int mbs = 120 * 68;
+    for (int s = 0; s < p->slices; s++) {
+        ts_gen_slice(g, &w, type, idr, (mbs / p->slices) * s, frameNum, (2 * display) % 256, bytes / p->slices);
+    }
+
+    int64_t pts = TS_GEN_PTS_DELAY + ((g->decodeIndex - gopPos + display + 1) * dur90);
+    ts_gen_pes(g, &count, w.bytes, pts, dts, idr);
+
+    g->decodeIndex++;
+    g->gopPos = (gopPos + 1) % p->gop;
+    g->packets += count;
+    return count;
+}
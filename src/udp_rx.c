@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/time.h>
+
+/* Native UDP / multicast receiver, an alternative to AVIO for udp:// urls.
+ * Waits in epoll and pulls up to UDP_RX_BATCH datagrams per recvmmsg() call straight into
+ * the ingest ring, each stamped with the kernel receive time (SO_TIMESTAMPNS).
+ * Linux only, elsewhere udp_rx_alloc() fails and the caller should stay on AVIO.
+ */
+#if defined(__linux__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#define UDP_RX_BATCH 64
+#define UDP_RX_SOCKET_BUFFER (16 * 1024 * 1024)
+
+struct udp_rx_s
+{
+    int fd;
+    int epfd;
+
+    /* Lifetime counters, only touched by the receive thread */
+    uint64_t syscalls;          /* recvmmsg() calls that returned data */
+    uint64_t datagrams;
+    uint64_t truncated;         /* Datagrams larger than a ring slot, the tail was lost */
+
+    /* Datagrams land here when the ring is full, then get discarded */
+    struct pkt_ring_slot_s *scratch;
+};
+
+/* Split udp://[@]a.b.c.d:port[?localaddr=e.f.g.h&...] into its parts. Other query
+ * parameters are AVIO options and are ignored.
+ */
+static int udp_rx_parse_url(const char *url, char *addr, int addrlen, int *port, char *localaddr, int localaddrlen)
+{
+    if (strncmp(url, "udp://", 6) != 0)
+        return -1;
+
+    const char *p = url + 6;
+    if (*p == '@')
+        p++;
+
+    const char *colon = strchr(p, ':');
+    if (!colon || colon == p || (colon - p) >= addrlen)
+        return -1;
+
+    memcpy(addr, p, colon - p);
+    addr[colon - p] = 0;
+
+    *port = atoi(colon + 1);
+    if (*port <= 0 || *port > 65535)
+        return -1;
+
+    localaddr[0] = 0;
+    const char *la = strstr(colon, "localaddr=");
+    if (la) {
+        la += strlen("localaddr=");
+        int len = strcspn(la, "&");
+        if (len >= localaddrlen)
+            return -1;
+        memcpy(localaddr, la, len);
+        localaddr[len] = 0;
+    }
+
+    return 0; /* Success */
+}
+
+static void udp_rx_free(struct udp_rx_s *rx)
+{
+#if defined(__linux__)
+    if (rx->epfd >= 0)
+        close(rx->epfd);
+    if (rx->fd >= 0)
+        close(rx->fd);
+#endif
+    free(rx->scratch);
+    free(rx);
+}
+
+/**
+ * @brief         Open a udp:// url for native reception.
+ * @param[out]    struct udp_rx_s **handle - new receiver
+ * @param[in]     const char *url - udp://a.b.c.d:port, multicast groups are joined automatically.
+ * @return          0 - Success
+ * @return        < 0 - Error, or not supported on this platform
+ */
+static int udp_rx_alloc(struct udp_rx_s **handle, const char *url)
+{
+#if defined(__linux__)
+    char addr[64], localaddr[64];
+    int port;
+    if (udp_rx_parse_url(url, addr, sizeof(addr), &port, localaddr, sizeof(localaddr)) < 0) {
+        fprintf(stderr, "udp_rx: unable to parse url %s\n", url);
+        return -1;
+    }
+
+    struct in_addr group;
+    if (inet_pton(AF_INET, addr, &group) != 1) {
+        fprintf(stderr, "udp_rx: %s is not an IPv4 address\n", addr);
+        return -1;
+    }
+
+    struct udp_rx_s *rx = calloc(1, sizeof(*rx));
+    if (!rx)
+        return -1;
+    rx->epfd = -1;
+    rx->scratch = malloc(sizeof(struct pkt_ring_slot_s) * UDP_RX_BATCH);
+
+    rx->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (rx->fd < 0 || !rx->scratch) {
+        perror("udp_rx: socket");
+        udp_rx_free(rx);
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(rx->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    /* Best effort, capped by net.core.rmem_max */
+    int rcvbuf = UDP_RX_SOCKET_BUFFER;
+    setsockopt(rx->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    if (setsockopt(rx->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+        perror("udp_rx: SO_TIMESTAMPNS");
+    }
+
+    struct sockaddr_in sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    sa.sin_addr = IN_MULTICAST(ntohl(group.s_addr)) ? group : (struct in_addr){ .s_addr = htonl(INADDR_ANY) };
+    if (bind(rx->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        perror("udp_rx: bind");
+        udp_rx_free(rx);
+        return -1;
+    }
+
+    if (IN_MULTICAST(ntohl(group.s_addr))) {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = group;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (localaddr[0] && inet_pton(AF_INET, localaddr, &mreq.imr_interface) != 1) {
+            fprintf(stderr, "udp_rx: localaddr %s is not an IPv4 address\n", localaddr);
+            udp_rx_free(rx);
+            return -1;
+        }
+        if (setsockopt(rx->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+            perror("udp_rx: IP_ADD_MEMBERSHIP");
+            udp_rx_free(rx);
+            return -1;
+        }
+    }
+
+    rx->epfd = epoll_create1(0);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = rx->fd };
+    if (rx->epfd < 0 || epoll_ctl(rx->epfd, EPOLL_CTL_ADD, rx->fd, &ev) < 0) {
+        perror("udp_rx: epoll");
+        udp_rx_free(rx);
+        return -1;
+    }
+
+    *handle = rx;
+    return 0; /* Success */
+#else
+    fprintf(stderr, "udp_rx: the native udp receiver needs linux, staying on AVIO\n");
+    return -1;
+#endif
+}
+
+/**
+ * @brief         Wait up to timeoutMs for data, then move every waiting datagram into the ring,
+ *                up to UDP_RX_BATCH per system call. Datagrams that don't fit in the ring are
+ *                dropped and counted as ring overruns.
+ * @return        >= 0 - Number of datagrams received
+ * @return        < 0 - Fatal socket error
+ */
+static int udp_rx_read(struct udp_rx_s *rx, struct pkt_ring_s *ring, int timeoutMs)
+{
+#if defined(__linux__)
+    struct epoll_event ev;
+    int n = epoll_wait(rx->epfd, &ev, 1, timeoutMs);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+    if (n == 0)
+        return 0;
+
+    struct mmsghdr msgs[UDP_RX_BATCH];
+    struct iovec iovs[UDP_RX_BATCH];
+    struct pkt_ring_slot_s *slots[UDP_RX_BATCH];
+    char cmsgbuf[UDP_RX_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+
+    int total = 0;
+    while (1) {
+        uint32_t avail = pkt_ring_producer_available(ring);
+        int count = avail < UDP_RX_BATCH ? avail : UDP_RX_BATCH;
+        int toRing = count;
+        if (count == 0) {
+            /* Ring is full, keep the socket drained anyway */
+            count = UDP_RX_BATCH;
+        }
+
+        for (int i = 0; i < count; i++) {
+            slots[i] = toRing ? pkt_ring_producer_slot_at(ring, i) : &rx->scratch[i];
+            iovs[i].iov_base = slots[i]->pkts;
+            iovs[i].iov_len = PKT_RING_SLOT_BYTES;
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = cmsgbuf[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(cmsgbuf[i]);
+        }
+
+        int r = recvmmsg(rx->fd, msgs, count, MSG_DONTWAIT, NULL);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+            return -1;
+        }
+        if (r == 0)
+            break;
+
+        rx->syscalls++;
+        rx->datagrams += r;
+        total += r;
+
+        if (!toRing) {
+            pkt_ring_producer_overrun_n(ring, r);
+            continue;
+        }
+
+        for (int i = 0; i < r; i++) {
+            struct pkt_ring_slot_s *slot = slots[i];
+
+            slot->shortRead = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || (msgs[i].msg_len % 188);
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                rx->truncated++;
+
+            /* Whole packets only */
+            slot->lengthBytes = (msgs[i].msg_len / 188) * 188;
+            slot->marker = 0;
+            slot->readNs = 0;
+            slot->eagains = 0;
+
+            int stamped = 0;
+            for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cm; cm = CMSG_NXTHDR(&msgs[i].msg_hdr, cm)) {
+                if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+                    struct timespec kts;
+                    memcpy(&kts, CMSG_DATA(cm), sizeof(kts));
+                    slot->ts.tv_sec = kts.tv_sec;
+                    slot->ts.tv_usec = kts.tv_nsec / 1000;
+                    stamped = 1;
+                    break;
+                }
+            }
+            if (!stamped) {
+                gettimeofday(&slot->ts, NULL);
+            }
+        }
+        pkt_ring_producer_commit_n(ring, r);
+
+        if (r < count)
+            break; /* Socket drained */
+    }
+
+    return total;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,55 @@
+import json
+import numpy as np
+import tensorflow as tf
+from joblib import load
+
+# Export the trained classifier and its scaler for the probe's native inference (src/mlp.c),
+# plus a reference set of keras predictions that src/model_uc_01 checks the C code against.
+
+model_path = "uc01-model-on_air_classifier.keras"
+scaler_path = "uc01-scaler.joblib"
+weights_path = "uc01-model.txt"
+reference_path = "uc01-model-reference.txt"
+
+# Must match uc01-train-model.py
+feature_names = [
+    "avc_ibp_total_slice_count", "avc_ibp_total_slice_size",
+    "transport_bit_count", "i_count", "p_count", "b_count"
+]
+
+model = tf.keras.models.load_model(model_path)
+scaler = load(scaler_path)
+
+def floats(values):
+    return " ".join(repr(float(v)) for v in values)
+
+with open(weights_path, "w") as f:
+    f.write("uc01-mlp 1\n")
+    f.write("features %d %s\n" % (len(feature_names), " ".join(feature_names)))
+    f.write("scaler_mean %s\n" % floats(scaler.mean_))
+    f.write("scaler_scale %s\n" % floats(scaler.scale_))
+    for layer in model.layers:
+        if not isinstance(layer, tf.keras.layers.Dense):
+            continue
+        kernel, bias = layer.get_weights()
+        activation = layer.get_config()["activation"]
+        f.write("dense %d %d %s\n" % (kernel.shape[0], kernel.shape[1], activation))
+        for row in kernel:
+            f.write(floats(row) + "\n")
+        f.write(floats(bias) + "\n")
+
+# Reference predictions, every training record plus some extremes the probe can produce
+with open("uc01-training.json") as f:
+    records = json.load(f)
+
+X = np.array([[r[fn] for fn in feature_names] for r in records], dtype=np.float32)
+X = np.vstack([X, np.zeros((1, len(feature_names)), dtype=np.float32),
+    np.array([[120, 40000000, 60000000, 4, 60, 60]], dtype=np.float32)])
+
+proba = model.predict(scaler.transform(X), verbose=0)[:, 0]
+
+with open(reference_path, "w") as f:
+    for x, p in zip(X, proba):
+        f.write("%s %s\n" % (floats(x), repr(float(p))))
+
+print(f"Wrote {weights_path} and {len(X)} reference predictions to {reference_path}.")
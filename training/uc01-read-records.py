@@ -0,0 +1,68 @@
+import sys
+import json
+import math
+import struct
+import argparse
+
+# Read the binary record stream written by probe_uc_01 -F binary (layout in src/record.c).
+# The stream describes itself, so records from older or newer probes still come back as
+# dicts keyed by the names in uc01-schema.json. Prints a json array, suitable for
+# validate_json.py or as training input.
+
+TYPES = {
+    1: ("<I", 4),   # RECORD_U32
+    2: ("<q", 8),   # RECORD_I64
+    3: ("<f", 4),   # RECORD_F32
+    4: ("<B", 1),   # RECORD_BOOL
+}
+
+def load_records(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if data[0:4] != b"UC01":
+        raise ValueError(f"{path}: not a uc01 binary record stream")
+    version, count, length = struct.unpack_from("<HHH", data, 4)
+    if version != 1:
+        raise ValueError(f"{path}: unsupported record version {version}")
+
+    pos = 10
+    fields = []
+    for _ in range(count):
+        ftype, nlen = data[pos], data[pos + 1]
+        name = data[pos + 2:pos + 2 + nlen].decode("ascii")
+        fields.append((name, ftype))
+        pos += 2 + nlen
+
+    records = []
+    while pos + length <= len(data):
+        if data[pos:pos + 4] != b"UC1R":
+            raise ValueError(f"{path}: lost record alignment at offset {pos}")
+        off = pos + 4
+        r = {}
+        for name, ftype in fields:
+            fmt, width = TYPES[ftype]
+            value = struct.unpack_from(fmt, data, off)[0]
+            off += width
+            if ftype == 4:
+                value = bool(value)
+            elif ftype == 3:
+                if math.isnan(value):
+                    continue  # Optional field, absent
+                value = round(value, 6)
+            r[name] = value
+        records.append(r)
+        pos += length
+
+    return records
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Convert a probe_uc_01 binary record stream to json.")
+    parser.add_argument("input", help="Binary record file, from probe_uc_01 -F binary -o <file>")
+    args = parser.parse_args()
+
+    records = load_records(args.input)
+    print("[")
+    for i, r in enumerate(records):
+        print(json.dumps(r) + ("," if i < len(records) - 1 else ""))
+    print("]")